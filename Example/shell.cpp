@@ -1,4 +1,6 @@
 #include "router_hal.h"
+#include "router_stats.h"
+#include <fcntl.h>
 #include <ncurses.h>
 #include <readline/history.h>
 #include <readline/readline.h>
@@ -6,6 +8,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 void printMAC(macaddr_t mac) {
   printf("%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3],
@@ -21,6 +27,115 @@ bool cont = false;
 in_addr_t addrs[N_IFACE_ON_BOARD] = {0x0100000a, 0x0101000a, 0x0102000a,
                                     0x0103000a};
 
+const char *dropNames[HAL_N_DROP] = {"truncated", "checksum", "no route",
+                                     "no arp", "ttl", "too big"};
+
+// map the stats file of another process, NULL on failure
+const HAL_StatsPage *mapStats(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  void *page = mmap(NULL, sizeof(HAL_StatsPage), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (page == MAP_FAILED) {
+    return NULL;
+  }
+  const HAL_StatsPage *stats = (const HAL_StatsPage *)page;
+  if (stats->magic != HAL_STATS_MAGIC || stats->version != HAL_STATS_VERSION ||
+      stats->slot_size != sizeof(HAL_StatsSlot) ||
+      stats->n_iface != HAL_MAX_IFACES || stats->n_drop != HAL_N_DROP ||
+      stats->n_histograms != HAL_STATS_HISTOGRAMS) {
+    munmap(page, sizeof(HAL_StatsPage));
+    return NULL;
+  }
+  return stats;
+}
+
+// send one command to the control socket of a router and print the reply
+int controlCommand(const char *path, const char *command) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  FILE *f = fdopen(fd, "r+");
+  fprintf(f, "%s\n", command);
+  fflush(f);
+  char line[1024];
+  // the reply ends with a line of "."
+  while (fgets(line, sizeof(line), f) && strcmp(line, ".\n") != 0) {
+    fputs(line, stdout);
+  }
+  fclose(f);
+  return 0;
+}
+
+// print the counters, or their rates over interval seconds if it is positive
+void printStats(const HAL_StatsPage *stats, int interval) {
+  HAL_StatsSlot now, before;
+  HAL_StatsSum(stats, &now);
+  double scale = 1;
+  if (interval > 0) {
+    before = now;
+    sleep(interval);
+    HAL_StatsSum(stats, &now);
+    scale = 1.0 / interval;
+  }
+  const char *unit = interval > 0 ? "/s" : "";
+  for (int i = 0; i < HAL_MAX_IFACES; i++) {
+    HAL_IfaceCounters c = now.iface[i];
+    // interfaces beyond the fixed ones only when they are in use
+    if (i >= N_IFACE_ON_BOARD && c.rx_packets == 0 && c.tx_packets == 0) {
+      continue;
+    }
+    if (interval > 0) {
+      c.rx_packets -= before.iface[i].rx_packets;
+      c.rx_bytes -= before.iface[i].rx_bytes;
+      c.tx_packets -= before.iface[i].tx_packets;
+      c.tx_bytes -= before.iface[i].tx_bytes;
+    }
+    printf("%d: rx %.0f packets%s %.0f bytes%s, tx %.0f packets%s %.0f bytes%s, "
+           "kernel drops %llu\n",
+           i, c.rx_packets * scale, unit, c.rx_bytes * scale, unit,
+           c.tx_packets * scale, unit, c.tx_bytes * scale, unit,
+           (unsigned long long)stats->kernel_drops[i]);
+  }
+  for (int i = 0; i < HAL_N_DROP; i++) {
+    uint64_t n = now.drops[i] - (interval > 0 ? before.drops[i] : 0);
+    printf("drop %s: %.0f%s\n", dropNames[i], n * scale, unit);
+  }
+  // histograms published by the router, e.g. time per forwarding stage
+  for (int i = 0; i < HAL_STATS_HISTOGRAMS; i++) {
+    const HAL_Histogram *h = &stats->histograms[i];
+    if (h->name[0] == 0 || h->count == 0) {
+      continue;
+    }
+    double ns = h->unit_hz ? 1e9 / h->unit_hz : 0;
+    if (ns == 0) {
+      printf("%.15s: %llu samples, rate unknown\n", h->name,
+             (unsigned long long)h->count);
+      continue;
+    }
+    printf("%.15s: %llu samples, avg %.1f ns, p50 %.0f ns, p99 %.0f ns, "
+           "p99.9 %.0f ns, max %.0f ns\n",
+           h->name, (unsigned long long)h->count, h->sum * ns / h->count,
+           HAL_HistogramPercentile(h, 0.5) * ns,
+           HAL_HistogramPercentile(h, 0.99) * ns,
+           HAL_HistogramPercentile(h, 0.999) * ns, h->max * ns);
+  }
+}
+
 void interrupt(int _) {
   printf("Interrupt\n");
   cont = false;
@@ -123,6 +238,43 @@ int main() {
           break;
         }
       }
+    } else if (strncmp(buffer, "stats", strlen("stats")) == 0) {
+      char path[256];
+      int interval = 0;
+      int n = sscanf(buffer, "stats %255s %d", path, &interval);
+      if (n < 1) {
+        // counters of this shell
+        const HAL_StatsPage *stats = HAL_GetStats();
+        if (stats) {
+          printStats(stats, 0);
+        } else {
+          printf("Stats not supported\n");
+        }
+      } else {
+        const HAL_StatsPage *stats = mapStats(path);
+        if (stats) {
+          printStats(stats, interval);
+          munmap((void *)stats, sizeof(HAL_StatsPage));
+        } else {
+          printf("Not a stats file: %s\n", path);
+        }
+      }
+    } else if (strncmp(buffer, "ctl", strlen("ctl")) == 0) {
+      // ctl [-s socket] command
+      const char *path = "router.ctl";
+      char custom[256];
+      const char *command = buffer + strlen("ctl");
+      int skip = 0;
+      if (sscanf(command, " -s %255s %n", custom, &skip) == 1 && skip > 0) {
+        path = custom;
+        command += skip;
+      }
+      while (*command == ' ') {
+        command++;
+      }
+      if (controlCommand(path, command) < 0) {
+        printf("Cannot connect to %s\n", path);
+      }
     } else if (strncmp(buffer, "quit", strlen("quit")) == 0) {
       free(buffer);
       break;
@@ -135,6 +287,10 @@ int main() {
       printf("\tcap: capture one packet\n");
       printf("\tout index: send random packet to interface\n");
       printf("\tloop: read packets until interrupted\n");
+      printf("\tstats [file [seconds]]: print counters of this shell or of a "
+             "stats file, or their rates over some seconds\n");
+      printf("\tctl [-s socket] command: query a running router, e.g. ctl "
+             "summary, ctl lookup a.b.c.d, ctl dump\n");
       printf("\tquit: exit shell\n");
     }
     free(buffer);
@@ -9,6 +9,16 @@
 #include <arpa/inet.h>
 #elif defined ROUTER_BACKEND_STDIO
 #include <arpa/inet.h>
+#elif defined ROUTER_BACKEND_MEMORY
+#include <arpa/inet.h>
+#elif defined ROUTER_BACKEND_SIM
+#include <arpa/inet.h>
+#elif defined ROUTER_BACKEND_AFXDP
+#include <arpa/inet.h>
+#elif defined ROUTER_BACKEND_IO_URING
+#include <arpa/inet.h>
+#elif defined ROUTER_BACKEND_PACKET
+#include <arpa/inet.h>
 #elif defined ROUTER_BACKEND_XILINX
 typedef uint32_t in_addr_t;
 #endif
@@ -16,7 +26,15 @@ typedef uint32_t in_addr_t;
 
 // multicasting dst addr
 #define MULTICAST_ADDR 0x090000e0
+// 接口数，Linux 后端的 VLAN trunk 模式（见 HAL_TRUNK_INTERFACE）可以在编译时
+// 用 -DN_IFACE_ON_BOARD=n 增加，因为 if_index_mask 是 int，最多为 30
+#ifndef N_IFACE_ON_BOARD
 #define N_IFACE_ON_BOARD 4
+#endif
+// HAL_InitInterfaces 在运行时最多能配置的接口数
+#define HAL_MAX_IFACES 1024
+// 接口 MTU 的上限（巨型帧），不含以太网头
+#define HAL_MAX_MTU 9000
 typedef uint8_t macaddr_t[6];
 
 enum HAL_ERROR_NUMBER {
@@ -44,6 +62,84 @@ extern "C" {
  */
 int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]);
 
+/**
+ * @brief 按运行时给出的接口初始化，代替 HAL_Init，同样只能调用一次
+ *
+ * 之后各函数的接口索引号为 [0, n-1]；接口多于 31 个时只能用
+ * HAL_ReceiveIPPacketAny 接收。只有 Linux 后端支持超过 N_IFACE_ON_BOARD
+ * 个接口，并按名字打开网口（trunk 模式下名字是 VLAN 号）；其它后端忽略
+ * names，使用前 n 个固定的接口
+ *
+ * @param debug IN，同 HAL_Init
+ * @param n IN，接口数，[1, HAL_MAX_IFACES]
+ * @param names IN，n 个接口的名字，为空指针时使用后端默认的接口
+ * @param if_addrs IN，n 个接口的 IPv4 地址
+ * @return int 0 表示成功，非 0 表示失败
+ */
+int HAL_InitInterfaces(int debug, int n, const char *const *names,
+                       const in_addr_t *if_addrs);
+
+/**
+ * @brief 获取接口数，即 HAL_InitInterfaces 的 n，用 HAL_Init 初始化时为
+ * N_IFACE_ON_BOARD
+ *
+ * @return int 接口数
+ */
+int HAL_InterfaceCount();
+
+/**
+ * @brief 获取接口的 MTU，即能发送的最长 IPv4 报文
+ *
+ * Linux、packet 和 io_uring 后端返回内核中网口的 MTU，Xilinx 后端返回
+ * HAL_MAX_MTU，其余后端返回 1500
+ *
+ * @param if_index IN，接口索引号
+ * @return int >0 表示 MTU，<0 表示发生错误
+ */
+int HAL_GetInterfaceMtu(int if_index);
+
+// HAL_SetReceivePolicy 的接收策略，即没有报文可读时如何等待
+enum HAL_RX_POLICY {
+  HAL_RX_BLOCK,    // 阻塞等待，默认
+  HAL_RX_BUSY,     // 一直忙等，占满一个核，唤醒延迟最低
+  HAL_RX_ADAPTIVE, // 收到报文后忙等一段时间，之后阻塞等待
+};
+// HAL_RX_ADAPTIVE 默认的忙等时间（微秒）
+#define HAL_RX_SPIN_US 200
+
+/**
+ * @brief 设置接收策略
+ *
+ * Linux、packet、io_uring 和 AFXDP 后端在等待报文时遵循这个策略，其余后端
+ * 忽略它。忙等的两种策略还会对 socket 设置 SO_BUSY_POLL（需要内核支持，超过
+ * net.core.busy_read 时需要 CAP_NET_ADMIN），为此需要在 HAL_Init 之前调用
+ *
+ * @param policy IN，见 HAL_RX_POLICY
+ * @param spin_us IN，HAL_RX_ADAPTIVE 在收到报文后忙等的微秒数，也是
+ * SO_BUSY_POLL 的微秒数
+ * @return int 0 表示成功，非 0 表示失败
+ */
+int HAL_SetReceivePolicy(int policy, int spin_us);
+
+// HAL_SetLinkCallback 的回调函数，up 非零表示接口恢复连通，为零表示断开
+typedef void (*HAL_LinkCallback)(int if_index, int up);
+
+/**
+ * @brief 设置接口链路状态变化时的回调函数
+ *
+ * 接口被关闭或失去载波、以及恢复时，HAL 在 HAL_ReceiveIPPacket 或
+ * HAL_ReceiveIPPacketAny 等待报文的过程中调用 callback，路由器可以立即
+ * 撤销经过这个接口的路由，而不必等到超时。设置时所有接口视为连通，已经
+ * 断开的接口随后通知一次。callback 中可以发送报文，但不能再接收
+ *
+ * Linux 后端通过 rtnetlink 订阅内核的接口事件（trunk 模式下所有接口跟随
+ * trunk 网口），SIM 后端在 HAL_SimSetLinkUp 时通知链路两端，其余后端不支持
+ *
+ * @param callback IN，回调函数，NULL 表示取消
+ * @return int 0 表示成功，HAL_ERR_NOT_SUPPORTED 表示后端不支持
+ */
+int HAL_SetLinkCallback(HAL_LinkCallback callback);
+
 /**
  * @brief 获取从启动到当前时刻的毫秒数
  *
@@ -77,7 +173,8 @@ int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac);
 /**
  * @brief 接收一个 IPv4
  * 报文，保证不会收到自己发送的报文；请保证缓冲区大小足够大（如大于常见的
- * MTU），报文只能读取一次
+ * MTU），报文只能读取一次。Linux 和 packet 后端可能收到 GRO/GSO 合并后大于 MTU
+ * 的报文，最长 65535 字节
  *
  * @param if_index_mask IN，接口索引号的 bitset，最低的 N_IFACE_ON_BOARD
  * 位有效，对于每一位，1 代表接收对应接口，0
@@ -94,6 +191,14 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
                         macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
                         int *if_index);
 
+/**
+ * @brief 从所有接口接收一个 IPv4 报文，参数和返回值同 HAL_ReceiveIPPacket
+ *
+ * 不受 int 位数的限制；Linux 后端只检查有报文的接口，开销与接口总数无关
+ */
+int HAL_ReceiveIPPacketAny(uint8_t *buffer, size_t length, macaddr_t src_mac,
+                           macaddr_t dst_mac, int64_t timeout, int *if_index);
+
 /**
  * @brief 发送一个 IP 报文，它的源 MAC 地址就是对应接口的 MAC 地址
  *
@@ -102,10 +207,239 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
  * @param length IN，待发送报文的长度
  * @param dst_mac IN，IPv4 报文下层的目的 MAC 地址
  * @return int 0 表示成功，非 0 为失败
+ *
+ * packet 后端中 length 可以大于 MTU：转发的是刚收到的 GRO/GSO 合并报文时，
+ * 沿用它的分段信息交给内核或网卡分段（GSO），其它大于 MTU 的 TCP 报文按出接口
+ * 的 MTU 分段；接口不支持 GSO 时由 HAL 在软件中分段
  */
 int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
                      macaddr_t dst_mac);
 
+#ifdef ROUTER_BACKEND_LINUX
+// HAL_OffloadRoute 一个前缀最多的等价路径数
+#define HAL_OFFLOAD_MAX_PATHS 8
+
+/**
+ * @brief LINUX 后端专用：把一条路由下发到内核的 main 路由表，之后由内核转发
+ * 匹配它的报文
+ *
+ * 请求先放入缓冲区，缓冲区满或调用 HAL_OffloadFlush 时通过 rtnetlink
+ * 一次发送；下发的路由的 protocol 为 rip（RTPROT_RIP），可以用
+ * `ip route show proto rip` 查看，删除时也只删除这类路由
+ *
+ * @param addr IN，前缀，大端序，仅最低 len 位可能非零
+ * @param len IN，前缀长度，[0, 32]
+ * @param nexthops IN，n 个下一跳，0 表示直连
+ * @param if_indices IN，n 个接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param n IN，等价路径数，0 表示删除这个前缀，最多 HAL_OFFLOAD_MAX_PATHS
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_OffloadRoute(in_addr_t addr, uint32_t len, const in_addr_t *nexthops,
+                     const int *if_indices, int n);
+
+/**
+ * @brief LINUX 后端专用：发送缓冲区中所有下发路由的请求
+ *
+ * @return int >=0 表示被内核拒绝的请求数，<0 表示发生错误
+ */
+int HAL_OffloadFlush();
+
+/**
+ * @brief LINUX 后端专用：删除内核 main 路由表中所有 protocol 为 rip 的路由，
+ * 如上次运行留下的路由
+ *
+ * @return int >=0 表示删除的路由数，<0 表示发生错误
+ */
+int HAL_OffloadClear();
+
+/**
+ * @brief LINUX 后端专用：在所有接口上挂载 XDP 程序，由它在驱动中直接转发报文
+ *
+ * XDP 程序按 HAL_XdpUpdateRoute 设置的路由做最长前缀匹配，按 HAL 的 ARP
+ * 表（自动同步）改写 MAC 地址，TTL 减一并增量更新校验和后重定向到出接口；
+ * 它处理不了的报文（发给路由器自己的、组播、带 IP 选项的、TTL 不大于 1
+ * 的、查不到路由或下一跳 MAC 地址的）照常由 HAL_ReceiveIPPacket 收到。
+ * 被 XDP 程序转发的报文不经过 HAL，也不计入统计页。程序在进程退出时自动卸载
+ *
+ * @param flags IN，XDP_FLAGS_SKB_MODE 等挂载模式，0 表示由内核选择；veth
+ * 上的原生模式要求重定向的目标接口的对端也挂载了 XDP 程序或打开了 GRO
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_XdpAttach(int flags);
+
+/**
+ * @brief LINUX 后端专用：设置或删除 XDP 程序使用的一条路由
+ *
+ * @param addr IN，前缀，大端序，仅最低 len 位可能非零
+ * @param len IN，前缀长度，[0, 32]
+ * @param nexthop IN，下一跳，0 表示直连
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]，负数表示删除这个前缀
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_XdpUpdateRoute(in_addr_t addr, uint32_t len, in_addr_t nexthop,
+                       int if_index);
+#endif
+
+#ifdef ROUTER_BACKEND_MEMORY
+/**
+ * @brief MEMORY 后端专用：追加一个待接收的 IPv4 报文，报文被复制到内存中
+ *
+ * HAL_ReceiveIPPacket 按追加的顺序返回这些报文，全部返回后返回 HAL_ERR_EOF
+ * 可以在 HAL_Init 之前调用
+ *
+ * @param if_index IN，接收报文的接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param buffer IN，IPv4 报文
+ * @param length IN，IPv4 报文的长度
+ * @param src_mac IN，IPv4 报文下层的源 MAC 地址
+ * @param dst_mac IN，IPv4 报文下层的目的 MAC 地址
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_MemoryEnqueue(int if_index, const uint8_t *buffer, size_t length,
+                      const macaddr_t src_mac, const macaddr_t dst_mac);
+
+/**
+ * @brief MEMORY 后端专用：设置所有报文被接收完后再从头重放的次数，并从头开始接收
+ *
+ * @param times IN，重放次数，0 表示不重放
+ */
+void HAL_MemorySetRepeat(uint64_t times);
+
+/**
+ * @brief MEMORY 后端专用：添加一条 ARP 表项
+ *
+ * 这个后端不会发送 ARP 请求，不在表中的 IP 地址总是查询失败
+ *
+ * @param if_index IN，接口索引号，[0, N_IFACE_ON_BOARD-1]
+ * @param ip IN，IP 地址
+ * @param mac IN，对应的 MAC 地址
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_MemoryAddArp(int if_index, in_addr_t ip, const macaddr_t mac);
+
+/**
+ * @brief MEMORY 后端专用：设置是否记录发送的报文，默认不记录，只计数
+ *
+ * @param record IN，非零表示记录
+ */
+void HAL_MemorySetRecord(int record);
+
+/**
+ * @brief MEMORY 后端专用：读取第 index 个被记录的发送报文
+ *
+ * @param index IN，按发送顺序的序号，从 0 开始
+ * @param buffer OUT，IPv4 报文，由调用者分配
+ * @param length IN，缓冲区大小
+ * @param if_index OUT，发送的接口索引号
+ * @param dst_mac OUT，IPv4 报文下层的目的 MAC 地址
+ * @return int >0 表示报文长度，<0 表示不存在
+ */
+int HAL_MemoryGetSent(size_t index, uint8_t *buffer, size_t length,
+                      int *if_index, macaddr_t dst_mac);
+
+/**
+ * @brief MEMORY 后端专用：获取接收、发送的报文数和发送的字节数
+ */
+void HAL_MemoryGetCounters(uint64_t *o_rx_packets, uint64_t *o_tx_packets,
+                           uint64_t *o_tx_bytes);
+#endif
+
+#ifdef ROUTER_BACKEND_SIM
+/**
+ * @brief SIM 后端专用：创建一个路由器，返回它的编号，从 0 开始
+ *
+ * 其它 HAL 函数都作用于 HAL_SimSelect 选中的路由器，创建后需要重新选择
+ *
+ * @return int 路由器编号
+ */
+int HAL_SimCreateRouter();
+
+/**
+ * @brief SIM 后端专用：选中一个路由器，之后的 HAL 调用都作用于它
+ *
+ * @param router IN，路由器编号
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_SimSelect(int router);
+
+/**
+ * @brief SIM 后端专用：用一条点对点链路连接两个路由器的接口
+ *
+ * 每个接口最多连接一条链路，ARP 只能查询到链路另一端接口的地址
+ *
+ * @param router1 IN，一端的路由器编号
+ * @param if_index1 IN，一端的接口索引号
+ * @param router2 IN，另一端的路由器编号
+ * @param if_index2 IN，另一端的接口索引号
+ * @param latency IN，单向延迟（毫秒）
+ * @param loss IN，丢包率，[0, 1]
+ * @return int >=0 表示链路编号，<0 表示失败
+ */
+int HAL_SimConnect(int router1, int if_index1, int router2, int if_index2,
+                   uint64_t latency, double loss);
+
+/**
+ * @brief SIM 后端专用：设置链路的状态，断开的链路丢弃所有报文
+ *
+ * 状态改变时，两端的路由器下一次接收时收到 HAL_SetLinkCallback 的通知，
+ * 在此之前 HAL_SimNextArrival 返回当前时刻
+ *
+ * @param link IN，链路编号
+ * @param up IN，非零表示连通
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_SimSetLinkUp(int link, int up);
+
+/**
+ * @brief SIM 后端专用：设置链路的丢包率
+ *
+ * 与 HAL_SimSetLinkUp 不同，两端的路由器不会收到通知，丢包率为 1 时模拟
+ * 交换机背后或者对端进程的故障，只能靠协议本身发现
+ *
+ * @param link IN，链路编号
+ * @param loss IN，丢包率，[0, 1]
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_SimSetLinkLoss(int link, double loss);
+
+/**
+ * @brief SIM 后端专用：设置虚拟时钟，即 HAL_GetTicks 的返回值
+ *
+ * @param now IN，毫秒数
+ */
+void HAL_SimSetTicks(uint64_t now);
+
+/**
+ * @brief SIM 后端专用：获取下一个报文到达路由器的时刻
+ *
+ * @param router IN，路由器编号
+ * @return uint64_t 毫秒数，没有待到达的报文时为 UINT64_MAX
+ */
+uint64_t HAL_SimNextArrival(int router);
+
+/**
+ * @brief SIM 后端专用：获取路由器接收和发送的报文数
+ */
+void HAL_SimGetCounters(int router, uint64_t *o_rx_packets,
+                        uint64_t *o_tx_packets);
+#endif
+
+#ifdef ROUTER_BACKEND_AFXDP
+/**
+ * @brief AFXDP 后端专用：接收一个 IPv4 报文，但不复制，报文留在 UMEM 中
+ *
+ * 参数和返回值同 HAL_ReceiveIPPacket，只是 *o_packet 指向 UMEM 中的报文，
+ * 它在下一次调用 HAL_AfxdpReceiveInPlace 或 HAL_ReceiveIPPacket 之前有效，
+ * 可以原地修改；以 *o_packet 和不超过返回值的长度调用 HAL_SendIPPacket 时，
+ * 报文直接从这个帧发出，不再复制，之后 *o_packet 不再有效
+ *
+ * @param o_packet OUT，IPv4 报文在 UMEM 中的地址
+ * @return int >0 表示读取的 IPv4 报文长度，0 表示超时返回，<0 表示发生错误
+ */
+int HAL_AfxdpReceiveInPlace(int if_index_mask, uint8_t **o_packet,
+                            macaddr_t src_mac, macaddr_t dst_mac,
+                            int64_t timeout, int *if_index);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,7 +3,13 @@
 
 // don't include this file in your own code.
 #include "router_hal.h"
+#include "router_stats.h"
+#include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
 // send igmp join to the multicast address
 void HAL_JoinIGMPGroup(int if_index, in_addr_t ip) {
@@ -37,4 +43,176 @@ void HAL_JoinIGMPGroup(int if_index, in_addr_t ip) {
   HAL_SendIPPacket(if_index, buffer, sizeof(buffer), dst_mac);
 }
 
+#ifndef HAL_RUNTIME_INTERFACES
+// backends with fixed interfaces use the first n of them
+int HAL_InitInterfaces(int debug, int n, const char *const *names,
+                       const in_addr_t *if_addrs) {
+  if (n <= 0 || n > N_IFACE_ON_BOARD || if_addrs == NULL) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  in_addr_t addrs[N_IFACE_ON_BOARD] = {0};
+  memcpy(addrs, if_addrs, n * sizeof(in_addr_t));
+  return HAL_Init(debug, addrs);
+}
+
+int HAL_InterfaceCount() { return N_IFACE_ON_BOARD; }
+
+int HAL_ReceiveIPPacketAny(uint8_t *buffer, size_t length, macaddr_t src_mac,
+                           macaddr_t dst_mac, int64_t timeout, int *if_index) {
+  return HAL_ReceiveIPPacket((1 << N_IFACE_ON_BOARD) - 1, buffer, length,
+                             src_mac, dst_mac, timeout, if_index);
+}
+#endif
+
+#ifndef HAL_INTERFACE_MTU
+// backends without a kernel to ask use the Ethernet default
+int HAL_GetInterfaceMtu(int if_index) {
+  if (if_index < 0 || if_index >= HAL_InterfaceCount()) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  return 1500;
+}
+#endif
+
+#ifndef HAL_LINK_EVENTS
+// nothing tells these backends about the links
+int HAL_SetLinkCallback(HAL_LinkCallback callback) {
+  return HAL_ERR_NOT_SUPPORTED;
+}
+#endif
+
+// receive policy, see HAL_SetReceivePolicy
+static int hal_rx_policy = HAL_RX_BLOCK;
+static int hal_rx_spin_us = HAL_RX_SPIN_US;
+// packets have arrived since the last wait, and when the spin after them ends
+static bool hal_rx_traffic = false;
+static uint64_t hal_rx_spin_end = 0;
+
+int HAL_SetReceivePolicy(int policy, int spin_us) {
+  if (policy < HAL_RX_BLOCK || policy > HAL_RX_ADAPTIVE || spin_us < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  hal_rx_policy = policy;
+  hal_rx_spin_us = spin_us;
+  return 0;
+}
+
+// called for every packet received
+static inline void HAL_RxPolicyPacket() { hal_rx_traffic = true; }
+
+// the timeout in milliseconds (-1 for none) of a wait for packets: 0 while
+// spinning, the caller then looks for packets again at once
+static inline int64_t HAL_RxPolicyWait(int64_t wait) {
+  if (hal_rx_policy == HAL_RX_BUSY) {
+    return 0;
+  } else if (hal_rx_policy == HAL_RX_BLOCK || wait == 0) {
+    return wait;
+  }
+  // the clock is read only when idle
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  uint64_t now = (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+  if (hal_rx_traffic) {
+    hal_rx_traffic = false;
+    hal_rx_spin_end = now + (uint64_t)hal_rx_spin_us * 1000;
+  }
+  return now < hal_rx_spin_end ? 0 : wait;
+}
+
+// busy polling of the driver queue on a socket, for the spinning policies
+static inline void HAL_RxPolicySocket(int fd) {
+#ifdef SO_BUSY_POLL
+  if (hal_rx_policy != HAL_RX_BLOCK && hal_rx_spin_us > 0) {
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &hal_rx_spin_us,
+               sizeof(hal_rx_spin_us));
+  }
+#endif
+}
+
+// counters live here until HAL_StatsOpen moves them into a shared file
+static HAL_StatsPage hal_stats_local = {
+    HAL_STATS_MAGIC,    HAL_STATS_VERSION, sizeof(HAL_StatsSlot),
+    HAL_STATS_SLOTS,    HAL_MAX_IFACES,    HAL_N_DROP,
+    HAL_STATS_HISTOGRAMS};
+static HAL_StatsPage *hal_stats = &hal_stats_local;
+static int hal_stats_threads = 0;
+static __thread int hal_stats_slot = -1;
+
+// the slot of the calling thread, the last one is shared by late threads
+static inline HAL_StatsSlot *HAL_StatsThreadSlot() {
+  if (hal_stats_slot < 0) {
+    int index = __atomic_fetch_add(&hal_stats_threads, 1, __ATOMIC_RELAXED);
+    hal_stats_slot = index < HAL_STATS_SLOTS - 1 ? index : HAL_STATS_SLOTS - 1;
+  }
+  return &hal_stats->slots[hal_stats_slot];
+}
+
+// readers may sample at any time, so stores are atomic but not locked
+// unless the slot is shared
+static inline void HAL_StatsAdd(uint64_t *counter, uint64_t n) {
+  if (hal_stats_slot == HAL_STATS_SLOTS - 1) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+  } else {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+  }
+}
+
+static inline void HAL_StatsCountRx(int if_index, size_t bytes) {
+  HAL_IfaceCounters *c = &HAL_StatsThreadSlot()->iface[if_index];
+  HAL_StatsAdd(&c->rx_packets, 1);
+  HAL_StatsAdd(&c->rx_bytes, bytes);
+}
+
+static inline void HAL_StatsCountTx(int if_index, size_t bytes) {
+  HAL_IfaceCounters *c = &HAL_StatsThreadSlot()->iface[if_index];
+  HAL_StatsAdd(&c->tx_packets, 1);
+  HAL_StatsAdd(&c->tx_bytes, bytes);
+}
+
+static inline void HAL_StatsSetKernelDrops(int if_index, uint64_t drops) {
+  __atomic_store_n(&hal_stats->kernel_drops[if_index], drops,
+                   __ATOMIC_RELAXED);
+}
+
+int HAL_StatsOpen(const char *path) {
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return HAL_ERR_UNKNOWN;
+  }
+  if (ftruncate(fd, sizeof(HAL_StatsPage)) < 0) {
+    close(fd);
+    return HAL_ERR_UNKNOWN;
+  }
+  void *page = mmap(NULL, sizeof(HAL_StatsPage), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (page == MAP_FAILED) {
+    return HAL_ERR_UNKNOWN;
+  }
+  memcpy(page, hal_stats, sizeof(HAL_StatsPage));
+  if (hal_stats != &hal_stats_local) {
+    munmap(hal_stats, sizeof(HAL_StatsPage));
+  }
+  hal_stats = (HAL_StatsPage *)page;
+  return 0;
+}
+
+const HAL_StatsPage *HAL_GetStats() { return hal_stats; }
+
+void HAL_StatsCountDrop(int reason) {
+  if (reason < 0 || reason >= HAL_N_DROP) {
+    return;
+  }
+  HAL_StatsAdd(&HAL_StatsThreadSlot()->drops[reason], 1);
+}
+
+HAL_Histogram *HAL_StatsHistogram(int index, const char *name) {
+  if (index < 0 || index >= HAL_STATS_HISTOGRAMS) {
+    return NULL;
+  }
+  HAL_Histogram *h = &hal_stats->histograms[index];
+  strncpy(h->name, name, sizeof(h->name) - 1);
+  return h;
+}
+
 #endif
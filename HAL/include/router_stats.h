@@ -0,0 +1,186 @@
+#ifndef __ROUTER_STATS_H__
+#define __ROUTER_STATS_H__
+
+#include "router_hal.h"
+
+// 统计页的布局，HAL 和读取统计的程序共用，可以被 C 和 C++ 包含
+#define HAL_STATS_MAGIC 0x54534c48 // "HLST"
+#define HAL_STATS_VERSION 4
+// 前 HAL_STATS_SLOTS - 1 个线程各自独占一个槽，其余线程共用最后一个槽
+#define HAL_STATS_SLOTS 8
+#define HAL_CACHE_LINE 64
+// 供路由器发布的直方图个数，如转发各阶段的耗时
+#define HAL_STATS_HISTOGRAMS 8
+// 直方图的桶：小于 8 的值各占一个桶，之后每个 2 的幂分成 8 个桶，误差不超过 12.5%
+#define HAL_HIST_SUB_BITS 3
+#define HAL_HIST_BUCKETS 256
+
+// 路由器丢弃报文的原因
+enum HAL_DROP_REASON {
+  HAL_DROP_TRUNCATED, // 报文比接收缓冲区大
+  HAL_DROP_CHECKSUM,  // IP 校验和错误
+  HAL_DROP_NO_ROUTE,  // 查不到路由
+  HAL_DROP_NO_ARP,    // 查不到下一跳的 MAC 地址
+  HAL_DROP_TTL,       // TTL 减为 0
+  HAL_DROP_TOO_BIG,   // 大于出接口的 MTU 且不允许分片（DF）
+  HAL_N_DROP,
+};
+
+typedef struct {
+  uint64_t rx_packets;
+  uint64_t rx_bytes; // IPv4 报文的字节数，不含以太网头
+  uint64_t tx_packets;
+  uint64_t tx_bytes;
+} HAL_IfaceCounters;
+
+// 每个槽只被一个线程写，按缓存行对齐，避免线程之间的伪共享
+typedef struct {
+  HAL_IfaceCounters iface[HAL_MAX_IFACES];
+  uint64_t drops[HAL_N_DROP];
+} __attribute__((aligned(HAL_CACHE_LINE))) HAL_StatsSlot;
+
+// 只被一个线程写
+typedef struct {
+  char name[16];    // 空字符串表示未使用
+  uint64_t unit_hz; // 每秒的计数单位数，如 TSC 频率，0 表示未知
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[HAL_HIST_BUCKETS];
+} __attribute__((aligned(HAL_CACHE_LINE))) HAL_Histogram;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t slot_size;
+  uint32_t n_slots;
+  uint32_t n_iface;
+  uint32_t n_drop;
+  uint32_t n_histograms;
+  // 内核丢弃的报文数（如 pcap_stats），由后端定期更新，不支持的后端为 0
+  uint64_t kernel_drops[HAL_MAX_IFACES];
+  HAL_StatsSlot slots[HAL_STATS_SLOTS];
+  HAL_Histogram histograms[HAL_STATS_HISTOGRAMS];
+} HAL_StatsPage;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief 把统计页放到文件 path 中，其它进程可以只读映射这个文件来采样计数器
+ *
+ * 调用前的计数会被复制到文件中；不调用时统计页只在进程内存中
+ *
+ * @param path IN，统计文件的路径，不存在时创建
+ * @return int 0 表示成功，非 0 为失败
+ */
+int HAL_StatsOpen(const char *path);
+
+/**
+ * @brief 获取本进程的统计页
+ *
+ * @return const HAL_StatsPage* 统计页，不支持统计的后端返回 NULL
+ */
+const HAL_StatsPage *HAL_GetStats();
+
+/**
+ * @brief 记录路由器丢弃了一个报文，计入调用线程的槽
+ *
+ * @param reason IN，丢弃原因，见 HAL_DROP_REASON
+ */
+void HAL_StatsCountDrop(int reason);
+
+/**
+ * @brief 获取统计页中的第 index 个直方图并设置它的名字，之后由调用者记录
+ *
+ * HAL_StatsOpen 会移动统计页，请在它之后调用
+ *
+ * @param index IN，[0, HAL_STATS_HISTOGRAMS-1]
+ * @param name IN，名字，最多 15 个字符
+ * @return HAL_Histogram* 直方图，不支持统计的后端或 index 无效时返回 NULL
+ */
+HAL_Histogram *HAL_StatsHistogram(int index, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @brief 把所有槽的计数器加起来，可以在转发进行时调用
+ *
+ * @param page IN，统计页
+ * @param o_total OUT，各接口和各丢弃原因的总数
+ */
+static inline void HAL_StatsSum(const HAL_StatsPage *page,
+                                HAL_StatsSlot *o_total) {
+  uint64_t *total = (uint64_t *)o_total;
+  const int n = (sizeof(HAL_IfaceCounters) * HAL_MAX_IFACES +
+                 sizeof(uint64_t) * HAL_N_DROP) / sizeof(uint64_t);
+  for (int i = 0; i < n; i++) {
+    total[i] = 0;
+  }
+  for (uint32_t s = 0; s < page->n_slots && s < HAL_STATS_SLOTS; s++) {
+    const uint64_t *slot = (const uint64_t *)&page->slots[s];
+    for (int i = 0; i < n; i++) {
+      total[i] += __atomic_load_n(&slot[i], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/**
+ * @brief 值 v 所在的桶
+ */
+static inline int HAL_HistogramBucket(uint64_t v) {
+  if (v < (1 << HAL_HIST_SUB_BITS)) {
+    return (int)v;
+  }
+  int e = 63 - __builtin_clzll(v);
+  int bucket = ((e - HAL_HIST_SUB_BITS + 1) << HAL_HIST_SUB_BITS) +
+               (int)((v >> (e - HAL_HIST_SUB_BITS)) &
+                     ((1 << HAL_HIST_SUB_BITS) - 1));
+  return bucket < HAL_HIST_BUCKETS ? bucket : HAL_HIST_BUCKETS - 1;
+}
+
+/**
+ * @brief 桶中最大的值
+ */
+static inline uint64_t HAL_HistogramBucketMax(int bucket) {
+  if (bucket < (1 << HAL_HIST_SUB_BITS)) {
+    return bucket;
+  }
+  int shift = (bucket >> HAL_HIST_SUB_BITS) - 1;
+  uint64_t sub = bucket & ((1 << HAL_HIST_SUB_BITS) - 1);
+  return (((1 << HAL_HIST_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+static inline void HAL_HistogramRecord(HAL_Histogram *h, uint64_t v) {
+  h->buckets[HAL_HistogramBucket(v)]++;
+  h->count++;
+  h->sum += v;
+  if (v > h->max) {
+    h->max = v;
+  }
+}
+
+/**
+ * @brief 分位数，返回所在桶中最大的值，不超过记录到的最大值
+ *
+ * @param h IN，直方图
+ * @param q IN，[0, 1]，如 0.999
+ * @return uint64_t 分位数，单位与记录的值相同
+ */
+static inline uint64_t HAL_HistogramPercentile(const HAL_Histogram *h,
+                                               double q) {
+  uint64_t rank = (uint64_t)(h->count * q), seen = 0;
+  for (int i = 0; i < HAL_HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen > rank) {
+      uint64_t v = HAL_HistogramBucketMax(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+#endif
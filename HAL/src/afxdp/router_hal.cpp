@@ -0,0 +1,741 @@
+#include "router_hal.h"
+#include "router_hal_common.h"
+#include <stdio.h>
+
+#include <errno.h>
+#include <ifaddrs.h>
+#include <linux/if_packet.h>
+#include <linux/if_xdp.h>
+#include <map>
+#include <net/if.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+
+#ifndef HAL_PLATFORM_TESTING
+#include "../linux/platform/standard.h"
+#else
+#include "../linux/platform/testing.h"
+#endif
+#include "../linux/xdp.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+// One AF_XDP socket per interface and queue. All of them share one UMEM, so a
+// frame received on one interface is sent on another from the same memory.
+
+const int IP_OFFSET = 14;
+// queues 0 .. AFXDP_QUEUES - 1 of each interface get a socket, traffic of
+// the other queues still goes to the kernel
+#ifndef AFXDP_QUEUES
+#define AFXDP_QUEUES 1
+#endif
+const int N_SOCKETS = N_IFACE_ON_BOARD * AFXDP_QUEUES;
+const uint32_t FRAME_SIZE = 2048;
+const uint32_t N_FRAMES = 8192;
+// size of each of the four rings of a socket
+const uint32_t RING_SIZE = 2048;
+// fill and completion rings are handled, and TX is kicked, this many at a time
+const uint32_t BATCH = 64;
+const uint64_t NO_FRAME = ~0ull;
+
+bool inited = false;
+int debugEnabled = 0;
+in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
+macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
+
+std::map<std::pair<in_addr_t, int>, macaddr_t> arp_table;
+std::map<std::pair<in_addr_t, int>, uint64_t> arp_timer;
+
+// a ring shared with the kernel, we own the producer of the fill and TX rings
+// and the consumer of the RX and completion rings
+struct XskRing {
+  uint32_t *producer;
+  uint32_t *consumer;
+  uint32_t *flags;
+  void *descs;
+  void *map;
+  size_t map_size;
+};
+
+struct XskSocket {
+  int fd; // -1 if the interface does not exist
+  int if_index;
+  XskRing rx, tx, fill, comp;
+  // descriptors queued on TX since the last kick
+  uint32_t tx_pending;
+};
+
+uint8_t *umem = NULL;
+XskSocket sockets[N_SOCKETS];
+// frames owned by us and not in use
+uint64_t free_frames[N_FRAMES];
+uint32_t n_free = 0;
+// the frame handed out by HAL_AfxdpReceiveInPlace
+uint64_t inplace_frame = NO_FRAME;
+int xsk_links[N_IFACE_ON_BOARD] = {-1, -1, -1, -1};
+int next_socket = 0;
+int64_t xsk_stats_time = 0;
+
+static uint32_t ringAvailable(const XskRing &r) {
+  return __atomic_load_n(r.producer, __ATOMIC_ACQUIRE) - *r.consumer;
+}
+
+static uint32_t ringFree(const XskRing &r) {
+  return RING_SIZE - (*r.producer - __atomic_load_n(r.consumer, __ATOMIC_ACQUIRE));
+}
+
+static void ringProduce(XskRing &r, uint32_t n) {
+  __atomic_store_n(r.producer, *r.producer + n, __ATOMIC_RELEASE);
+}
+
+static void ringConsume(XskRing &r, uint32_t n) {
+  __atomic_store_n(r.consumer, *r.consumer + n, __ATOMIC_RELEASE);
+}
+
+static bool mapRing(int fd, XskRing &r, const struct xdp_ring_offset &off,
+                    size_t desc_size, off_t pgoff) {
+  r.map_size = off.desc + RING_SIZE * desc_size;
+  r.map = mmap(NULL, r.map_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd, pgoff);
+  if (r.map == MAP_FAILED) {
+    return false;
+  }
+  r.producer = (uint32_t *)((uint8_t *)r.map + off.producer);
+  r.consumer = (uint32_t *)((uint8_t *)r.map + off.consumer);
+  r.flags = (uint32_t *)((uint8_t *)r.map + off.flags);
+  r.descs = (uint8_t *)r.map + off.desc;
+  return true;
+}
+
+static void freeFrame(uint64_t addr) {
+  // RX descriptors point behind the headroom, the frame starts at the chunk
+  free_frames[n_free++] = addr - addr % FRAME_SIZE;
+}
+
+// take back the frames the kernel has sent
+static void reapCompletions(XskSocket &s) {
+  uint32_t n = ringAvailable(s.comp);
+  if (n == 0) {
+    return;
+  }
+  const uint64_t *addrs = (const uint64_t *)s.comp.descs;
+  for (uint32_t i = 0; i < n; i++) {
+    freeFrame(addrs[(*s.comp.consumer + i) % RING_SIZE]);
+  }
+  ringConsume(s.comp, n);
+}
+
+// give free frames to the kernel for reception, a batch at a time
+static void refillFrames(XskSocket &s, uint32_t target) {
+  uint32_t queued = *s.fill.producer - __atomic_load_n(s.fill.consumer, __ATOMIC_ACQUIRE);
+  if (queued + BATCH > target) {
+    return;
+  }
+  uint32_t n = target - queued;
+  if (n > n_free) {
+    n = n_free;
+  }
+  uint64_t *addrs = (uint64_t *)s.fill.descs;
+  for (uint32_t i = 0; i < n; i++) {
+    addrs[(*s.fill.producer + i) % RING_SIZE] = free_frames[--n_free];
+  }
+  ringProduce(s.fill, n);
+}
+
+static void kickTx(XskSocket &s) {
+  if (s.tx_pending == 0) {
+    return;
+  }
+  s.tx_pending = 0;
+  if (*s.tx.flags & XDP_RING_NEED_WAKEUP) {
+    // EAGAIN and EBUSY only mean that the kernel is still sending
+    sendto(s.fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+  }
+}
+
+static void kickAll() {
+  for (int i = 0; i < N_SOCKETS; i++) {
+    if (sockets[i].fd >= 0) {
+      kickTx(sockets[i]);
+    }
+  }
+}
+
+// queue a frame for sending, it is freed by the completion ring
+static int submitFrame(int if_index, uint64_t addr, uint32_t len) {
+  XskSocket &s = sockets[if_index * AFXDP_QUEUES];
+  reapCompletions(s);
+  if (ringFree(s.tx) == 0) {
+    kickTx(s);
+    freeFrame(addr);
+    return HAL_ERR_UNKNOWN;
+  }
+  struct xdp_desc *desc =
+      &((struct xdp_desc *)s.tx.descs)[*s.tx.producer % RING_SIZE];
+  desc->addr = addr;
+  desc->len = len;
+  desc->options = 0;
+  ringProduce(s.tx, 1);
+  if (++s.tx_pending >= BATCH) {
+    kickTx(s);
+  }
+  return 0;
+}
+
+// a free frame for a copy, or NO_FRAME if all frames are in flight
+static uint64_t allocFrame() {
+  if (n_free == 0) {
+    for (int i = 0; i < N_SOCKETS; i++) {
+      if (sockets[i].fd >= 0) {
+        reapCompletions(sockets[i]);
+      }
+    }
+  }
+  return n_free ? free_frames[--n_free] : NO_FRAME;
+}
+
+static int sendFrame(int if_index, const uint8_t *frame, size_t len) {
+  if (len > FRAME_SIZE) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  uint64_t addr = allocFrame();
+  if (addr == NO_FRAME) {
+    return HAL_ERR_UNKNOWN;
+  }
+  memcpy(umem + addr, frame, len);
+  int res = submitFrame(if_index, addr, len);
+  // not forwarding, nothing to batch with
+  kickTx(sockets[if_index * AFXDP_QUEUES]);
+  return res;
+}
+
+static void sendArp(int if_index, const uint8_t *dst_mac, uint16_t opcode,
+                    const uint8_t *target_mac, in_addr_t target_ip) {
+  uint8_t buffer[64] = {0};
+  memcpy(buffer, dst_mac, sizeof(macaddr_t));
+  memcpy(&buffer[6], interface_mac[if_index], sizeof(macaddr_t));
+  // ARP
+  buffer[12] = 0x08;
+  buffer[13] = 0x06;
+  // hardware type
+  buffer[15] = 0x01;
+  // protocol type
+  buffer[16] = 0x08;
+  // hardware size
+  buffer[18] = 0x06;
+  // protocol size
+  buffer[19] = 0x04;
+  // opcode
+  buffer[21] = opcode;
+  // sender
+  memcpy(&buffer[22], interface_mac[if_index], sizeof(macaddr_t));
+  memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
+  // target
+  memcpy(&buffer[32], target_mac, sizeof(macaddr_t));
+  memcpy(&buffer[38], &target_ip, sizeof(in_addr_t));
+  sendFrame(if_index, buffer, sizeof(buffer));
+}
+
+// learn from and answer an ARP packet
+static void handleArp(int port, const uint8_t *packet) {
+  macaddr_t mac;
+  memcpy(mac, &packet[22], sizeof(macaddr_t));
+  in_addr_t ip;
+  memcpy(&ip, &packet[28], sizeof(in_addr_t));
+  memcpy(arp_table[std::pair<in_addr_t, int>(ip, port)], mac,
+         sizeof(macaddr_t));
+  if (debugEnabled) {
+    fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
+            inet_ntoa(in_addr{ip}));
+  }
+  in_addr_t dst_ip;
+  memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
+  // ask me: reply
+  if (dst_ip == interface_addrs[port] && packet[21] == 0x01) {
+    sendArp(port, &packet[6], 0x02, &packet[22], ip);
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
+              inet_ntoa(in_addr{ip}));
+    }
+  }
+}
+
+// drops of the sockets, refreshed once per second
+static void updateKernelDrops() {
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    uint64_t drops = 0;
+    for (int q = 0; q < AFXDP_QUEUES; q++) {
+      XskSocket &s = sockets[i * AFXDP_QUEUES + q];
+      struct xdp_statistics st;
+      socklen_t len = sizeof(st);
+      if (s.fd >= 0 && getsockopt(s.fd, SOL_XDP, XDP_STATISTICS, &st, &len) == 0) {
+        drops += st.rx_dropped + st.rx_ring_full + st.rx_fill_ring_empty_descs;
+      }
+    }
+    HAL_StatsSetKernelDrops(i, drops);
+  }
+}
+
+/**
+ * Wait for the next IPv4 frame on the interfaces of if_index_mask, handling
+ * ARP on the way; the frame belongs to the caller until freeFrame
+ * @return the frame length, 0 on timeout
+ */
+static int receiveFrame(int if_index_mask, int64_t timeout, int *o_port,
+                        uint64_t *o_addr) {
+  int64_t begin = HAL_GetTicks();
+  if (begin >= xsk_stats_time + 1000) {
+    updateKernelDrops();
+    xsk_stats_time = begin;
+  }
+  // what the router sent while handling the last packet goes out now
+  kickAll();
+  while (true) {
+    // round robin
+    for (int k = 0; k < N_SOCKETS; k++) {
+      int i = (next_socket + k) % N_SOCKETS;
+      XskSocket &s = sockets[i];
+      if (s.fd < 0 || (if_index_mask & (1 << s.if_index)) == 0) {
+        continue;
+      }
+      reapCompletions(s);
+      refillFrames(s, RING_SIZE / 2);
+      if (ringAvailable(s.rx) == 0) {
+        continue;
+      }
+      struct xdp_desc desc =
+          ((struct xdp_desc *)s.rx.descs)[*s.rx.consumer % RING_SIZE];
+      ringConsume(s.rx, 1);
+      next_socket = (i + 1) % N_SOCKETS;
+      uint8_t *packet = umem + desc.addr;
+      if (desc.len >= IP_OFFSET && packet[12] == 0x08 && packet[13] == 0x00) {
+        *o_port = s.if_index;
+        *o_addr = desc.addr;
+        HAL_RxPolicyPacket();
+        return desc.len;
+      } else if (desc.len >= 42 && packet[12] == 0x08 && packet[13] == 0x06) {
+        handleArp(s.if_index, packet);
+      }
+      freeFrame(desc.addr);
+      // look at this socket again first, it may have more
+      next_socket = i;
+      k = -1;
+    }
+
+    int64_t wait = -1;
+    if (timeout != -1) {
+      wait = begin + timeout - (int64_t)HAL_GetTicks();
+      if (wait < 0) {
+        wait = 0;
+      }
+    }
+    struct pollfd fds[N_SOCKETS];
+    int n = 0;
+    for (int i = 0; i < N_SOCKETS; i++) {
+      if (sockets[i].fd >= 0 && (if_index_mask & (1 << sockets[i].if_index))) {
+        fds[n].fd = sockets[i].fd;
+        fds[n].events = POLLIN;
+        n++;
+      }
+    }
+    // poll also wakes up the driver when the fill rings need it, while
+    // spinning it returns at once
+    int64_t spin = HAL_RxPolicyWait(wait);
+    if (poll(fds, n, spin) <= 0 && spin == wait && wait != -1) {
+      return 0;
+    }
+  }
+}
+
+// create the socket of an interface and queue, the first one registers the UMEM
+static int openSocket(XskSocket &s, int ifindex, int queue, int shared_fd,
+                      bool copy) {
+  int fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  HAL_RxPolicySocket(fd);
+  if (shared_fd < 0) {
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)umem;
+    reg.len = (uint64_t)N_FRAMES * FRAME_SIZE;
+    reg.chunk_size = FRAME_SIZE;
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  // every socket has its own fill and completion rings
+  int size = RING_SIZE;
+  if (setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0 ||
+      setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0 ||
+      setsockopt(fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0 ||
+      setsockopt(fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0) {
+    close(fd);
+    return -1;
+  }
+  struct xdp_mmap_offsets off;
+  socklen_t len = sizeof(off);
+  if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len) < 0 ||
+      !mapRing(fd, s.rx, off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+      !mapRing(fd, s.tx, off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) ||
+      !mapRing(fd, s.fill, off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+      !mapRing(fd, s.comp, off.cr, sizeof(uint64_t),
+               XDP_UMEM_PGOFF_COMPLETION_RING)) {
+    close(fd);
+    return -1;
+  }
+  // the kernel only looks at the fill ring after bind
+  s.fd = fd;
+  refillFrames(s, RING_SIZE / 2);
+
+  struct sockaddr_xdp addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sxdp_family = AF_XDP;
+  addr.sxdp_ifindex = ifindex;
+  addr.sxdp_queue_id = queue;
+  if (shared_fd < 0) {
+    // zero copy where the driver supports it, e.g. not on veth
+    addr.sxdp_flags = XDP_USE_NEED_WAKEUP | (copy ? XDP_COPY : 0);
+  } else {
+    // the mode is that of the socket which registered the UMEM
+    addr.sxdp_flags = XDP_SHARED_UMEM;
+    addr.sxdp_shared_umem_fd = shared_fd;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    s.fd = -1;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// the program of an interface, every packet goes to the socket of its queue
+static std::vector<struct bpf_insn> xskAssemble(int xsks_fd) {
+  typedef XdpAssembler A;
+  A a;
+  a.load(BPF_W, A::R2, A::R1, offsetof(struct xdp_md, rx_queue_index));
+  a.loadMap(A::R1, xsks_fd);
+  // queues without a socket
+  a.mov(A::R3, XDP_PASS);
+  a.call(BPF_FUNC_redirect_map);
+  a.exit();
+  return a.finish();
+}
+
+extern "C" {
+int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  if (inited) {
+    return 0;
+  }
+  debugEnabled = debug;
+
+  // find matching interfaces and get their MAC address
+  struct ifaddrs *ifaddr, *ifa;
+  if (getifaddrs(&ifaddr) < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_Init: getifaddrs failed with %s\n", strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+
+  for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr == NULL)
+      continue;
+    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+      if (ifa->ifa_addr->sa_family == AF_PACKET &&
+          strcmp(ifa->ifa_name, interfaces[i]) == 0) {
+        // found
+        memcpy(interface_mac[i],
+               ((struct sockaddr_ll *)ifa->ifa_addr)->sll_addr,
+               sizeof(macaddr_t));
+        memcpy(arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)],
+               interface_mac[i], sizeof(macaddr_t));
+        if (debugEnabled) {
+          fprintf(stderr, "HAL_Init: found MAC addr of interface %s\n",
+                  interfaces[i]);
+        }
+        break;
+      }
+    }
+  }
+  freeifaddrs(ifaddr);
+
+  umem = (uint8_t *)mmap(NULL, (size_t)N_FRAMES * FRAME_SIZE,
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (umem == MAP_FAILED) {
+    umem = NULL;
+    return HAL_ERR_UNKNOWN;
+  }
+  for (uint32_t i = 0; i < N_FRAMES; i++) {
+    free_frames[n_free++] = (uint64_t)(N_FRAMES - 1 - i) * FRAME_SIZE;
+  }
+
+  // AFXDP_COPY in the environment forces copy mode
+  bool copy = getenv("AFXDP_COPY") != NULL;
+  int shared_fd = -1;
+  static char log[65536];
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    for (int q = 0; q < AFXDP_QUEUES; q++) {
+      sockets[i * AFXDP_QUEUES + q].fd = -1;
+      sockets[i * AFXDP_QUEUES + q].if_index = i;
+    }
+    int ifindex = if_nametoindex(interfaces[i]);
+    if (ifindex == 0) {
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_Init: interface %s does not exist\n",
+                interfaces[i]);
+      }
+      continue;
+    }
+    int xsks = bpfCreateMap(BPF_MAP_TYPE_XSKMAP, sizeof(int), sizeof(int),
+                            AFXDP_QUEUES, 0);
+    int opened = 0;
+    for (int q = 0; q < AFXDP_QUEUES && xsks >= 0; q++) {
+      XskSocket &s = sockets[i * AFXDP_QUEUES + q];
+      int fd = openSocket(s, ifindex, q, shared_fd, copy);
+      if (fd < 0) {
+        if (debugEnabled) {
+          fprintf(stderr, "HAL_Init: AF_XDP socket for %s queue %d failed: %s\n",
+                  interfaces[i], q, strerror(errno));
+        }
+        continue;
+      }
+      if (shared_fd < 0) {
+        shared_fd = fd;
+      }
+      bpfUpdate(xsks, &q, &fd);
+      opened++;
+    }
+    int prog = opened ? xdpLoad(xskAssemble(xsks), debugEnabled ? log : NULL,
+                                sizeof(log))
+                      : -1;
+    if (prog >= 0) {
+      xsk_links[i] = xdpAttach(prog, ifindex, 0);
+      close(prog);
+    }
+    // the program holds the map
+    if (xsks >= 0) {
+      close(xsks);
+    }
+    if (xsk_links[i] < 0) {
+      if (debugEnabled && opened) {
+        fprintf(stderr, "HAL_Init: XDP program for %s failed: %s\n%s",
+                interfaces[i], strerror(errno), prog < 0 ? log : "");
+      }
+      for (int q = 0; q < AFXDP_QUEUES; q++) {
+        XskSocket &s = sockets[i * AFXDP_QUEUES + q];
+        // keep the socket which registered the UMEM
+        if (s.fd >= 0 && s.fd != shared_fd) {
+          close(s.fd);
+          s.fd = -1;
+        }
+      }
+      continue;
+    }
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_Init: AF_XDP enabled for %s\n", interfaces[i]);
+    }
+  }
+
+  memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
+
+  inited = true;
+  // send igmp to join RIP multicast group
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (xsk_links[i] >= 0) {
+      HAL_JoinIGMPGroup(i, if_addrs[i]);
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_Init: Joining RIP multicast group 224.0.0.9 for %s\n",
+                interfaces[i]);
+      }
+    }
+  }
+  return 0;
+}
+
+uint64_t HAL_GetTicks() {
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  // millisecond
+  return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
+}
+
+int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  // handle multicast
+  if ((ip & 0xe0) == 0xe0) {
+    uint8_t multicasting_mac[6] = {0x01, 0, 0x5e, (uint8_t)((ip >> 8) & 0x7f), (uint8_t)(ip >> 16), (uint8_t)(ip >> 24)};
+    memcpy(o_mac, multicasting_mac, sizeof(macaddr_t));
+    return 0;
+  }
+
+  // lookup arp table
+  auto it = arp_table.find(std::pair<in_addr_t, int>(ip, if_index));
+  if (it != arp_table.end()) {
+    memcpy(o_mac, it->second, sizeof(macaddr_t));
+    return 0;
+  } else if (xsk_links[if_index] >= 0 &&
+             arp_timer[std::pair<in_addr_t, int>(ip, if_index)] + 1000 <
+                 HAL_GetTicks()) {
+    // not found, send arp request
+    // rate limit arp request by 1 req/s
+    arp_timer[std::pair<in_addr_t, int>(ip, if_index)] = HAL_GetTicks();
+    if (debugEnabled) {
+      fprintf(
+          stderr,
+          "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
+          inet_ntoa(in_addr{ip}));
+    }
+    static const uint8_t broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    static const uint8_t unknown[6] = {0};
+    sendArp(if_index, broadcast, 0x01, unknown, ip);
+  }
+  return HAL_ERR_IP_NOT_EXIST;
+}
+
+int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  memcpy(o_mac, interface_mac[if_index], sizeof(macaddr_t));
+  return 0;
+}
+
+int HAL_AfxdpReceiveInPlace(int if_index_mask, uint8_t **o_packet,
+                            macaddr_t src_mac, macaddr_t dst_mac,
+                            int64_t timeout, int *if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (if_index == NULL) ||
+      (o_packet == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (inplace_frame != NO_FRAME) {
+    freeFrame(inplace_frame);
+    inplace_frame = NO_FRAME;
+  }
+
+  bool flag = false;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (xsk_links[i] >= 0 && (if_index_mask & (1 << i))) {
+      flag = true;
+    }
+  }
+  if (!flag) {
+    if (debugEnabled) {
+      fprintf(stderr,
+              "HAL_ReceiveIPPacket: no viable interfaces open for capture\n");
+    }
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  uint64_t addr;
+  int len = receiveFrame(if_index_mask, timeout, if_index, &addr);
+  if (len == 0) {
+    return 0;
+  }
+  uint8_t *packet = umem + addr;
+  memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
+  memcpy(src_mac, &packet[6], sizeof(macaddr_t));
+  HAL_StatsCountRx(*if_index, len - IP_OFFSET);
+  inplace_frame = addr;
+  *o_packet = &packet[IP_OFFSET];
+  return len - IP_OFFSET;
+}
+
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
+  if (buffer == NULL) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  uint8_t *packet;
+  int res = HAL_AfxdpReceiveInPlace(if_index_mask, &packet, src_mac, dst_mac,
+                                    timeout, if_index);
+  if (res > 0) {
+    memcpy(buffer, packet, (size_t)res < length ? res : length);
+    freeFrame(inplace_frame);
+    inplace_frame = NO_FRAME;
+  }
+  return res;
+}
+
+int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                     macaddr_t dst_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (xsk_links[if_index] < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  uint64_t addr;
+  bool inplace = inplace_frame != NO_FRAME &&
+                 buffer == umem + inplace_frame + IP_OFFSET;
+  if (inplace) {
+    // the frame of HAL_AfxdpReceiveInPlace, its ethernet header is reused
+    addr = inplace_frame;
+    inplace_frame = NO_FRAME;
+  } else {
+    addr = allocFrame();
+    if (addr == NO_FRAME) {
+      return HAL_ERR_UNKNOWN;
+    }
+  }
+  if (addr % FRAME_SIZE + IP_OFFSET + length > FRAME_SIZE) {
+    freeFrame(addr);
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  uint8_t *eth_buffer = umem + addr;
+  memcpy(eth_buffer, dst_mac, sizeof(macaddr_t));
+  memcpy(&eth_buffer[6], interface_mac[if_index], sizeof(macaddr_t));
+  // IPv4
+  eth_buffer[12] = 0x08;
+  eth_buffer[13] = 0x00;
+  if (!inplace) {
+    memcpy(&eth_buffer[IP_OFFSET], buffer, length);
+  }
+  int res = submitFrame(if_index, addr, length + IP_OFFSET);
+  if (res != 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_SendIPPacket: TX ring of %s is full\n",
+              interfaces[if_index]);
+    }
+    return res;
+  }
+  // forwarded frames are kicked in batches, everything else right away
+  if (!inplace) {
+    kickTx(sockets[if_index * AFXDP_QUEUES]);
+  }
+  HAL_StatsCountTx(if_index, length);
+  return 0;
+}
+}
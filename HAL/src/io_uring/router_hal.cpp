@@ -0,0 +1,651 @@
+#include "router_hal.h"
+// HAL_GetInterfaceMtu is implemented here
+#define HAL_INTERFACE_MTU
+#include "router_hal_common.h"
+#include <stdio.h>
+
+#include <errno.h>
+#include <ifaddrs.h>
+#include <linux/if_packet.h>
+#include <linux/io_uring.h>
+#include <map>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+
+#ifndef HAL_PLATFORM_TESTING
+#include "../linux/platform/standard.h"
+#else
+#include "../linux/platform/testing.h"
+#endif
+#include "../linux/packet.h"
+
+// Raw AF_PACKET sockets (see ../linux/packet.h) driven by io_uring: each socket has a multishot recv
+// that takes buffers from a provided buffer ring, and sends are queued and
+// submitted in batches, so one io_uring_enter covers many packets.
+
+const int IP_OFFSET = 14;
+const uint32_t SQ_ENTRIES = 256;
+const uint32_t CQ_ENTRIES = 4096;
+// receive buffers, shared by all sockets
+const uint32_t N_RX_BUFFERS = 1024;
+// a jumbo frame of HAL_MAX_MTU fits
+const uint32_t BUFFER_SIZE = (IP_OFFSET + HAL_MAX_MTU + 255) & ~255u;
+const uint16_t BUFFER_GROUP = 0;
+const uint32_t N_TX_BUFFERS = 256;
+// queued sends are submitted when there are this many, when the receiver
+// waits, or when the oldest one has waited for a millisecond
+const uint32_t TX_BATCH = 32;
+// user_data of sends, the rest is the buffer index; recvs use the interface
+const uint64_t USER_DATA_TX = 1ull << 32;
+
+bool inited = false;
+int debugEnabled = 0;
+in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
+macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
+
+int packet_fds[N_IFACE_ON_BOARD] = {-1, -1, -1, -1};
+int interface_mtu[N_IFACE_ON_BOARD];
+// whether the multishot recv of a socket is still active
+bool recv_armed[N_IFACE_ON_BOARD];
+uint64_t kernel_drops[N_IFACE_ON_BOARD];
+int64_t stats_time = 0;
+
+std::map<std::pair<in_addr_t, int>, macaddr_t> arp_table;
+std::map<std::pair<in_addr_t, int>, uint64_t> arp_timer;
+
+int ring_fd = -1;
+uint32_t *sq_head, *sq_tail, sq_mask;
+struct io_uring_sqe *sqes;
+uint32_t *cq_head, *cq_tail, cq_mask;
+struct io_uring_cqe *cqes;
+// SQEs written since the last io_uring_enter
+uint32_t sq_unsubmitted = 0;
+
+struct io_uring_buf_ring *rx_ring;
+uint8_t *rx_buffers;
+
+// received packets whose completions have been reaped, in order
+struct RxReady {
+  uint16_t buffer;
+  uint16_t if_index;
+  int len;
+};
+RxReady rx_ready[N_RX_BUFFERS];
+uint32_t rx_ready_head = 0, rx_ready_tail = 0;
+
+uint8_t *tx_buffers;
+uint32_t tx_free[N_TX_BUFFERS];
+uint32_t n_tx_free = 0;
+// sends queued but not submitted
+uint32_t tx_queued = 0;
+uint64_t tx_queued_time = 0;
+
+static int uringEnter(unsigned to_submit, unsigned min_complete, unsigned flags,
+                      void *arg, size_t arg_size) {
+  return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags,
+                 arg, arg_size);
+}
+
+/**
+ * Submit the queued SQEs, and wait for min_complete completions at most
+ * timeout milliseconds (-1 for infinity) if wait is set
+ */
+static void uringSubmit(bool wait, unsigned min_complete, int64_t timeout) {
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  void *argp = NULL;
+  size_t arg_size = 0;
+  if (wait && timeout >= 0 && min_complete > 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    argp = &arg;
+    arg_size = sizeof(arg);
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+  int res = uringEnter(sq_unsubmitted, min_complete, flags, argp, arg_size);
+  if (res >= 0) {
+    sq_unsubmitted -= res;
+  } else if (errno != ETIME && errno != EINTR && errno != EBUSY &&
+             debugEnabled) {
+    fprintf(stderr, "HAL: io_uring_enter failed with %s\n", strerror(errno));
+  }
+  tx_queued = 0;
+}
+
+static struct io_uring_sqe *getSqe() {
+  uint32_t tail = *sq_tail;
+  if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == SQ_ENTRIES) {
+    uringSubmit(false, 0, 0);
+    if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == SQ_ENTRIES) {
+      return NULL;
+    }
+  }
+  struct io_uring_sqe *sqe = &sqes[tail & sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  sq_unsubmitted++;
+  return sqe;
+}
+
+static void armRecv(int if_index) {
+  struct io_uring_sqe *sqe = getSqe();
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = packet_fds[if_index];
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = if_index;
+  recv_armed[if_index] = true;
+}
+
+// give a receive buffer back to the kernel
+static void recycleBuffer(uint16_t buffer) {
+  uint16_t tail = rx_ring->tail;
+  // not rx_ring->bufs, older headers misplace it in C++
+  struct io_uring_buf *buf =
+      (struct io_uring_buf *)rx_ring + (tail & (N_RX_BUFFERS - 1));
+  buf->addr = (uint64_t)(uintptr_t)&rx_buffers[(size_t)buffer * BUFFER_SIZE];
+  buf->len = BUFFER_SIZE;
+  buf->bid = buffer;
+  __atomic_store_n(&rx_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+// move received packets to rx_ready and free the buffers of finished sends
+static void reapCompletions() {
+  uint32_t head = *cq_head;
+  uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+    if (cqe->user_data & USER_DATA_TX) {
+      tx_free[n_tx_free++] = cqe->user_data & ~USER_DATA_TX;
+      if (cqe->res < 0 && debugEnabled) {
+        fprintf(stderr, "HAL_SendIPPacket: send failed with %s\n",
+                strerror(-cqe->res));
+      }
+      continue;
+    }
+    int if_index = cqe->user_data;
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      recv_armed[if_index] = false;
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+      uint16_t buffer = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      if (cqe->res > 0) {
+        RxReady &r = rx_ready[rx_ready_tail++ % N_RX_BUFFERS];
+        r.buffer = buffer;
+        r.if_index = if_index;
+        r.len = cqe->res;
+      } else {
+        recycleBuffer(buffer);
+      }
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS && debugEnabled) {
+      fprintf(stderr, "HAL_ReceiveIPPacket: recv on %s failed with %s\n",
+              interfaces[if_index], strerror(-cqe->res));
+    }
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  // a multishot recv stops e.g. when it runs out of buffers
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (packet_fds[i] >= 0 && !recv_armed[i]) {
+      armRecv(i);
+    }
+  }
+}
+
+// queue a frame for sending, it is copied to a send buffer
+static int queueFrame(int if_index, const uint8_t *header, size_t header_len,
+                      const uint8_t *data, size_t len) {
+  if (header_len + len > BUFFER_SIZE) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (n_tx_free == 0) {
+    // wait for a send to finish
+    uringSubmit(true, 1, -1);
+    reapCompletions();
+    if (n_tx_free == 0) {
+      return HAL_ERR_UNKNOWN;
+    }
+  }
+  struct io_uring_sqe *sqe = getSqe();
+  if (!sqe) {
+    return HAL_ERR_UNKNOWN;
+  }
+  uint32_t index = tx_free[--n_tx_free];
+  uint8_t *frame = &tx_buffers[(size_t)index * BUFFER_SIZE];
+  memcpy(frame, header, header_len);
+  if (len > 0) {
+    memcpy(&frame[header_len], data, len);
+  }
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = packet_fds[if_index];
+  sqe->addr = (uint64_t)(uintptr_t)frame;
+  sqe->len = header_len + len;
+  sqe->user_data = USER_DATA_TX | index;
+  if (tx_queued++ == 0) {
+    tx_queued_time = HAL_GetTicks();
+  }
+  if (tx_queued >= TX_BATCH) {
+    uringSubmit(false, 0, 0);
+  }
+  return 0;
+}
+
+static void sendArp(int if_index, const uint8_t *dst_mac, uint8_t opcode,
+                    const uint8_t *target_mac, in_addr_t target_ip) {
+  uint8_t buffer[64] = {0};
+  memcpy(buffer, dst_mac, sizeof(macaddr_t));
+  memcpy(&buffer[6], interface_mac[if_index], sizeof(macaddr_t));
+  // ARP
+  buffer[12] = 0x08;
+  buffer[13] = 0x06;
+  // hardware type
+  buffer[15] = 0x01;
+  // protocol type
+  buffer[16] = 0x08;
+  // hardware size
+  buffer[18] = 0x06;
+  // protocol size
+  buffer[19] = 0x04;
+  // opcode
+  buffer[21] = opcode;
+  // sender
+  memcpy(&buffer[22], interface_mac[if_index], sizeof(macaddr_t));
+  memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
+  // target
+  memcpy(&buffer[32], target_mac, sizeof(macaddr_t));
+  memcpy(&buffer[38], &target_ip, sizeof(in_addr_t));
+  queueFrame(if_index, buffer, sizeof(buffer), NULL, 0);
+}
+
+// learn from and answer an ARP packet
+static void handleArp(int port, const uint8_t *packet) {
+  macaddr_t mac;
+  memcpy(mac, &packet[22], sizeof(macaddr_t));
+  in_addr_t ip;
+  memcpy(&ip, &packet[28], sizeof(in_addr_t));
+  memcpy(arp_table[std::pair<in_addr_t, int>(ip, port)], mac,
+         sizeof(macaddr_t));
+  if (debugEnabled) {
+    fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
+            inet_ntoa(in_addr{ip}));
+  }
+  in_addr_t dst_ip;
+  memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
+  // ask me: reply
+  if (dst_ip == interface_addrs[port] && packet[21] == 0x01) {
+    sendArp(port, &packet[6], 0x02, &packet[22], ip);
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
+              inet_ntoa(in_addr{ip}));
+    }
+  }
+}
+
+// drops of the sockets, refreshed once per second; reading them resets them
+static void updateKernelDrops() {
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    struct tpacket_stats st;
+    socklen_t len = sizeof(st);
+    if (packet_fds[i] >= 0 &&
+        getsockopt(packet_fds[i], SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+      kernel_drops[i] += st.tp_drops;
+      HAL_StatsSetKernelDrops(i, kernel_drops[i]);
+    }
+  }
+}
+
+static int uringOpen() {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  // completions are only posted within io_uring_enter, which we call anyway
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+            IORING_SETUP_DEFER_TASKRUN;
+  p.cq_entries = CQ_ENTRIES;
+  int fd = syscall(__NR_io_uring_setup, SQ_ENTRIES, &p);
+  if (fd < 0 && errno == EINVAL) {
+    // before Linux 6.1
+    p.flags = IORING_SETUP_CQSIZE;
+    fd = syscall(__NR_io_uring_setup, SQ_ENTRIES, &p);
+  }
+  if (fd < 0) {
+    return -1;
+  }
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) && cq_size > sq_size) {
+    sq_size = cq_size;
+  }
+  uint8_t *sq = (uint8_t *)mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  uint8_t *cq = sq;
+  if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = (uint8_t *)mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  }
+  sqes = (struct io_uring_sqe *)mmap(
+      NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  sq_head = (uint32_t *)(sq + p.sq_off.head);
+  sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+  sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+  // SQEs are used in order, the array maps each slot to itself
+  uint32_t *array = (uint32_t *)(sq + p.sq_off.array);
+  for (uint32_t i = 0; i < p.sq_entries; i++) {
+    array[i] = i;
+  }
+  cq_head = (uint32_t *)(cq + p.cq_off.head);
+  cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+  cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  ring_fd = fd;
+
+  // the provided buffer ring for receiving
+  rx_ring = (struct io_uring_buf_ring *)mmap(
+      NULL, N_RX_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  rx_buffers = (uint8_t *)mmap(NULL, (size_t)N_RX_BUFFERS * BUFFER_SIZE,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  tx_buffers = (uint8_t *)mmap(NULL, (size_t)N_TX_BUFFERS * BUFFER_SIZE,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (rx_ring == MAP_FAILED || rx_buffers == MAP_FAILED ||
+      tx_buffers == MAP_FAILED) {
+    return -1;
+  }
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)rx_ring;
+  reg.ring_entries = N_RX_BUFFERS;
+  reg.bgid = BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    return -1;
+  }
+  rx_ring->tail = 0;
+  for (uint32_t i = 0; i < N_RX_BUFFERS; i++) {
+    recycleBuffer(i);
+  }
+  for (uint32_t i = 0; i < N_TX_BUFFERS; i++) {
+    tx_free[n_tx_free++] = N_TX_BUFFERS - 1 - i;
+  }
+  return 0;
+}
+
+extern "C" {
+int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  if (inited) {
+    return 0;
+  }
+  debugEnabled = debug;
+
+  // find matching interfaces and get their MAC address
+  struct ifaddrs *ifaddr, *ifa;
+  if (getifaddrs(&ifaddr) < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_Init: getifaddrs failed with %s\n", strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+
+  for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr == NULL)
+      continue;
+    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+      if (ifa->ifa_addr->sa_family == AF_PACKET &&
+          strcmp(ifa->ifa_name, interfaces[i]) == 0) {
+        // found
+        memcpy(interface_mac[i],
+               ((struct sockaddr_ll *)ifa->ifa_addr)->sll_addr,
+               sizeof(macaddr_t));
+        memcpy(arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)],
+               interface_mac[i], sizeof(macaddr_t));
+        if (debugEnabled) {
+          fprintf(stderr, "HAL_Init: found MAC addr of interface %s\n",
+                  interfaces[i]);
+        }
+        break;
+      }
+    }
+  }
+  freeifaddrs(ifaddr);
+
+  if (uringOpen() < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_Init: io_uring setup failed with %s\n",
+              strerror(errno));
+    }
+    return HAL_ERR_NOT_SUPPORTED;
+  }
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    packet_fds[i] = packetOpen(interfaces[i], interface_mac[i], 0);
+    interface_mtu[i] = 1500;
+    if (packet_fds[i] >= 0) {
+      interface_mtu[i] = packetMtu(packet_fds[i], interfaces[i]);
+      HAL_RxPolicySocket(packet_fds[i]);
+      armRecv(i);
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_Init: packet socket enabled for %s\n",
+                interfaces[i]);
+      }
+    } else if (debugEnabled) {
+      fprintf(stderr,
+              "HAL_Init: packet socket disabled for %s, either the interface "
+              "does not exist or permission is denied\n",
+              interfaces[i]);
+    }
+  }
+  uringSubmit(false, 0, 0);
+
+  memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
+
+  inited = true;
+  // send igmp to join RIP multicast group
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (packet_fds[i] >= 0) {
+      HAL_JoinIGMPGroup(i, if_addrs[i]);
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_Init: Joining RIP multicast group 224.0.0.9 for %s\n",
+                interfaces[i]);
+      }
+    }
+  }
+  uringSubmit(false, 0, 0);
+  return 0;
+}
+
+uint64_t HAL_GetTicks() {
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  // millisecond
+  return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
+}
+
+int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  // handle multicast
+  if ((ip & 0xe0) == 0xe0) {
+    uint8_t multicasting_mac[6] = {0x01, 0, 0x5e, (uint8_t)((ip >> 8) & 0x7f), (uint8_t)(ip >> 16), (uint8_t)(ip >> 24)};
+    memcpy(o_mac, multicasting_mac, sizeof(macaddr_t));
+    return 0;
+  }
+
+  // lookup arp table
+  auto it = arp_table.find(std::pair<in_addr_t, int>(ip, if_index));
+  if (it != arp_table.end()) {
+    memcpy(o_mac, it->second, sizeof(macaddr_t));
+    return 0;
+  } else if (packet_fds[if_index] >= 0 &&
+             arp_timer[std::pair<in_addr_t, int>(ip, if_index)] + 1000 <
+                 HAL_GetTicks()) {
+    // not found, send arp request
+    // rate limit arp request by 1 req/s
+    arp_timer[std::pair<in_addr_t, int>(ip, if_index)] = HAL_GetTicks();
+    if (debugEnabled) {
+      fprintf(
+          stderr,
+          "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
+          inet_ntoa(in_addr{ip}));
+    }
+    static const uint8_t broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    static const uint8_t unknown[6] = {0};
+    sendArp(if_index, broadcast, 0x01, unknown, ip);
+  }
+  return HAL_ERR_IP_NOT_EXIST;
+}
+
+int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  memcpy(o_mac, interface_mac[if_index], sizeof(macaddr_t));
+  return 0;
+}
+
+int HAL_GetInterfaceMtu(int if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  return interface_mtu[if_index];
+}
+
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (if_index == NULL) || (buffer == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  bool flag = false;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (packet_fds[i] >= 0 && (if_index_mask & (1 << i))) {
+      flag = true;
+    }
+  }
+  if (!flag) {
+    if (debugEnabled) {
+      fprintf(stderr,
+              "HAL_ReceiveIPPacket: no viable interfaces open for capture\n");
+    }
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  int64_t begin = HAL_GetTicks();
+  if (begin >= stats_time + 1000) {
+    updateKernelDrops();
+    stats_time = begin;
+  }
+  if (tx_queued > 0 && begin > (int64_t)tx_queued_time) {
+    uringSubmit(false, 0, 0);
+  }
+  while (true) {
+    if (rx_ready_head == rx_ready_tail) {
+      reapCompletions();
+    }
+    while (rx_ready_head != rx_ready_tail) {
+      RxReady r = rx_ready[rx_ready_head++ % N_RX_BUFFERS];
+      const uint8_t *packet = &rx_buffers[(size_t)r.buffer * BUFFER_SIZE];
+      int port = r.if_index;
+      // packets of the other interfaces are dropped, all of them are
+      // received in practice; the socket filter has dropped our own
+      if ((if_index_mask & (1 << port)) == 0 || r.len < IP_OFFSET) {
+        // skip
+      } else if (packet[12] == 0x08 && packet[13] == 0x00) {
+        // IPv4
+        size_t ip_len = r.len - IP_OFFSET;
+        size_t real_length = length > ip_len ? ip_len : length;
+        memcpy(buffer, &packet[IP_OFFSET], real_length);
+        memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
+        memcpy(src_mac, &packet[6], sizeof(macaddr_t));
+        recycleBuffer(r.buffer);
+        *if_index = port;
+        HAL_StatsCountRx(port, ip_len);
+        HAL_RxPolicyPacket();
+        return ip_len;
+      } else if (r.len >= 42 && packet[12] == 0x08 && packet[13] == 0x06) {
+        // ARP
+        handleArp(port, packet);
+      }
+      recycleBuffer(r.buffer);
+    }
+
+    // nothing ready: submit what is queued, and wait for completions
+    int64_t wait = -1;
+    if (timeout != -1) {
+      wait = begin + timeout - (int64_t)HAL_GetTicks();
+      if (wait < 0) {
+        wait = 0;
+      }
+    }
+    // while spinning, completions are only collected
+    int64_t spin = HAL_RxPolicyWait(wait);
+    uringSubmit(true, spin == 0 ? 0 : 1, spin);
+    reapCompletions();
+    if (wait == 0 && rx_ready_head == rx_ready_tail) {
+      return 0;
+    }
+  }
+}
+
+int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                     macaddr_t dst_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (packet_fds[if_index] < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  uint8_t header[IP_OFFSET];
+  memcpy(header, dst_mac, sizeof(macaddr_t));
+  memcpy(&header[6], interface_mac[if_index], sizeof(macaddr_t));
+  // IPv4
+  header[12] = 0x08;
+  header[13] = 0x00;
+  int res = queueFrame(if_index, header, sizeof(header), buffer, length);
+  if (res != 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_SendIPPacket: no free send buffer\n");
+    }
+    return res;
+  }
+  HAL_StatsCountTx(if_index, length);
+  return 0;
+}
+}
@@ -0,0 +1,150 @@
+#ifndef __PACKET_H__
+#define __PACKET_H__
+
+// Raw AF_PACKET sockets for the backends that do without libpcap: the kernel
+// filters the traffic, so that only frames for the router reach user space
+
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// socket buffer sizes, HAL_RCVBUF and HAL_SNDBUF in the environment override them
+#ifndef PACKET_RCVBUF
+#define PACKET_RCVBUF (4 << 20)
+#endif
+#ifndef PACKET_SNDBUF
+#define PACKET_SNDBUF (1 << 20)
+#endif
+
+static inline int packetBufferSize(const char *env, int size) {
+  const char *value = getenv(env);
+  return value && atoi(value) > 0 ? atoi(value) : size;
+}
+
+static inline void packetSetBuffer(int fd, int force, int normal, int size) {
+  // beyond net.core.[rw]mem_max needs CAP_NET_ADMIN
+  if (setsockopt(fd, SOL_SOCKET, force, &size, sizeof(size)) < 0) {
+    setsockopt(fd, SOL_SOCKET, normal, &size, sizeof(size));
+  }
+}
+
+/**
+ * Open a raw socket on the interface name, with a filter that passes IPv4
+ * and ARP frames to mac, to a group address or the broadcast address, and
+ * drops frames sent by mac itself
+ * The interface is not put in promiscuous mode, the RIP multicast group is
+ * joined instead.
+ * @return the socket, -1 on error
+ */
+static inline int packetOpen(const char *name, const uint8_t mac[6], int flags) {
+  int ifindex = if_nametoindex(name);
+  if (ifindex == 0) {
+    return -1;
+  }
+  // no protocol yet, nothing is received before the filter is in place
+  int fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC | flags, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  uint32_t mac_high = (mac[0] << 8) | mac[1];
+  uint32_t mac_low = ((uint32_t)mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5];
+  struct sock_filter code[] = {
+      // own frames, when PACKET_IGNORE_OUTGOING is not supported
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_low, 0, 2),
+      BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_high, 10, 0),
+      // ethertype
+      BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 1, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_ARP, 0, 7),
+      // destination: a group address, or ours
+      BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+      BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 1, 4, 0),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 2),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_low, 0, 3),
+      BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_high, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, 0x40000),
+      BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  struct sock_fprog filter = {sizeof(code) / sizeof(code[0]), code};
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0) {
+    close(fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+  packetSetBuffer(fd, SO_RCVBUFFORCE, SO_RCVBUF,
+                  packetBufferSize("HAL_RCVBUF", PACKET_RCVBUF));
+  packetSetBuffer(fd, SO_SNDBUFFORCE, SO_SNDBUF,
+                  packetBufferSize("HAL_SNDBUF", PACKET_SNDBUF));
+
+  struct sockaddr_ll addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sll_family = AF_PACKET;
+  // ETH_P_ALL, as ARP and IPv4 are both needed; the filter narrows it
+  addr.sll_protocol = htons(ETH_P_ALL);
+  addr.sll_ifindex = ifindex;
+  // 224.0.0.9
+  struct packet_mreq mreq;
+  memset(&mreq, 0, sizeof(mreq));
+  mreq.mr_ifindex = ifindex;
+  mreq.mr_type = PACKET_MR_MULTICAST;
+  mreq.mr_alen = 6;
+  const uint8_t rip_mac[6] = {0x01, 0x00, 0x5e, 0x00, 0x00, 0x09};
+  memcpy(mreq.mr_address, rip_mac, sizeof(rip_mac));
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// MTU of the interface name, 1500 if fd can not tell
+static inline int packetMtu(int fd, const char *name) {
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+  return ioctl(fd, SIOCGIFMTU, &ifr) == 0 ? ifr.ifr_mtu : 1500;
+}
+
+// struct virtio_net_hdr, <linux/virtio_net.h> does not compile as C++
+struct packet_vnet_hdr {
+  uint8_t flags;
+  uint8_t gso_type;
+  uint16_t hdr_len;
+  uint16_t gso_size;
+  uint16_t csum_start;
+  uint16_t csum_offset;
+};
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+#define VIRTIO_NET_HDR_GSO_NONE 0
+#define VIRTIO_NET_HDR_GSO_TCPV4 1
+
+/**
+ * Prefix every frame received and sent on fd with a struct packet_vnet_hdr:
+ * GRO or GSO super-packets then come with their segmentation metadata, and a
+ * packet sent with gso_type set is segmented by the kernel or the NIC
+ * HAL_VNET_HDR=0 in the environment leaves it off
+ * @return whether the header is on
+ */
+static inline bool packetEnableVnet(int fd) {
+  const char *value = getenv("HAL_VNET_HDR");
+  if (value && atoi(value) == 0) {
+    return false;
+  }
+  int one = 1;
+  return setsockopt(fd, SOL_PACKET, PACKET_VNET_HDR, &one, sizeof(one)) == 0;
+}
+
+#endif
@@ -1,46 +1,496 @@
 #include "router_hal.h"
+// HAL_InitInterfaces, HAL_ReceiveIPPacketAny, HAL_GetInterfaceMtu and
+// HAL_SetLinkCallback are implemented here
+#define HAL_RUNTIME_INTERFACES
+#define HAL_INTERFACE_MTU
+#define HAL_LINK_EVENTS
 #include "router_hal_common.h"
 #include <stdio.h>
 
 #include <ifaddrs.h>
 #include <linux/if_packet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <map>
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <pcap.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
 #include <utility>
+#include <vector>
 
 #ifndef HAL_PLATFORM_TESTING
 #include "platform/standard.h"
 #else
 #include "platform/testing.h"
 #endif
+#include "xdp.h"
+
+#if N_IFACE_ON_BOARD > 4 && !defined(HAL_TRUNK_INTERFACE)
+#error "more than 4 interfaces need the VLAN trunk mode, see HAL_TRUNK_INTERFACE"
+#endif
 
 const int IP_OFFSET = 14;
 
+// VLAN trunk mode: the interfaces are VLANs on the port HAL_TRUNK_INTERFACE,
+// with a single capture handle for all; by default interface i is the VLAN
+// HAL_TRUNK_VLAN_BASE + i, HAL_InitInterfaces takes the numbers as names
+#ifdef HAL_TRUNK_INTERFACE
+const char *trunk_interface = HAL_TRUNK_INTERFACE;
+#else
+const char *trunk_interface = NULL;
+#endif
+#ifndef HAL_TRUNK_VLAN_BASE
+#define HAL_TRUNK_VLAN_BASE 1
+#endif
+// Ethernet header with the 802.1Q tag
+const int TRUNK_IP_OFFSET = 18;
+// whole frames, even GRO/GSO super-packets of 64 KiB
+const int SNAPLEN = 65536 + TRUNK_IP_OFFSET;
+pcap_t *trunk_handle = NULL;
+uint16_t trunk_vid[HAL_MAX_IFACES];
+// interface of each VLAN, -1 for none
+int16_t vid_iface[4096];
+
 bool inited = false;
 int debugEnabled = 0;
-in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
-macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
+int n_iface = N_IFACE_ON_BOARD;
+// interface names, VLAN numbers in trunk mode
+const char *iface_names[HAL_MAX_IFACES];
+in_addr_t interface_addrs[HAL_MAX_IFACES] = {0};
+macaddr_t interface_mac[HAL_MAX_IFACES] = {0};
+int interface_mtu[HAL_MAX_IFACES];
 
-pcap_t *pcap_in_handles[N_IFACE_ON_BOARD];
-pcap_t *pcap_out_handles[N_IFACE_ON_BOARD];
+pcap_t *pcap_in_handles[HAL_MAX_IFACES];
+pcap_t *pcap_out_handles[HAL_MAX_IFACES];
+// capture handles with frames waiting, for HAL_ReceiveIPPacketAny
+int epoll_fd = -1;
+int ready_ifaces[HAL_MAX_IFACES];
+int n_ready = 0;
+int next_ready = 0;
 
 std::map<std::pair<in_addr_t, int>, macaddr_t> arp_table;
 std::map<std::pair<in_addr_t, int>, uint64_t> arp_timer;
 
+int64_t pcap_stats_time = 0;
+
+// Ethernet header of a frame sent from if_index, tagged in trunk mode
+// @return the length of the header
+static int ethernetHeader(uint8_t *frame, int if_index, const macaddr_t dst_mac,
+                          uint16_t ethertype) {
+  memcpy(frame, dst_mac, sizeof(macaddr_t));
+  memcpy(&frame[6], interface_mac[if_index], sizeof(macaddr_t));
+  int offset = 12;
+  if (trunk_handle) {
+    uint16_t vid = trunk_vid[if_index];
+    frame[12] = 0x81;
+    frame[13] = 0x00;
+    frame[14] = vid >> 8;
+    frame[15] = vid;
+    offset = 16;
+  }
+  frame[offset] = ethertype >> 8;
+  frame[offset + 1] = ethertype;
+  return offset + 2;
+}
+
+// open the trunk, every interface sends through the same handle
+static int trunkOpen(char *error_buffer) {
+  trunk_handle = pcap_open_live(trunk_interface, SNAPLEN, 1, 1, error_buffer);
+  if (!trunk_handle) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_Init: failed to open trunk %s: %s\n",
+              trunk_interface, error_buffer);
+    }
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  pcap_setnonblock(trunk_handle, 1, error_buffer);
+  HAL_RxPolicySocket(pcap_get_selectable_fd(trunk_handle));
+  // untagged traffic of the host never reaches user space
+  struct bpf_program filter;
+  if (pcap_compile(trunk_handle, &filter, "vlan and (ip or arp)", 1,
+                   PCAP_NETMASK_UNKNOWN) == 0) {
+    pcap_setfilter(trunk_handle, &filter);
+    pcap_freecode(&filter);
+  }
+  memset(vid_iface, -1, sizeof(vid_iface));
+  for (int i = 0; i < n_iface; i++) {
+    int vid = atoi(iface_names[i]);
+    if (vid <= 0 || vid >= 4095 || vid_iface[vid] >= 0) {
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_Init: invalid or duplicate VLAN %s\n",
+                iface_names[i]);
+      }
+      return HAL_ERR_INVALID_PARAMETER;
+    }
+    trunk_vid[i] = vid;
+    vid_iface[vid] = i;
+    pcap_out_handles[i] = trunk_handle;
+  }
+  if (debugEnabled) {
+    fprintf(stderr, "HAL_Init: trunk %s carries %d VLANs\n", trunk_interface,
+            n_iface);
+  }
+  return 0;
+}
+
+// next frame of the trunk and its interface, NULL if there is none
+static const uint8_t *trunkNext(struct pcap_pkthdr *hdr, int *port) {
+  const uint8_t *packet;
+  while ((packet = pcap_next(trunk_handle, hdr)) != NULL) {
+    // demultiplex by the VLAN ID
+    if (hdr->caplen >= (size_t)TRUNK_IP_OFFSET && packet[12] == 0x81 &&
+        packet[13] == 0x00 &&
+        (*port = vid_iface[((packet[14] & 0x0f) << 8) | packet[15]]) >= 0) {
+      return packet;
+    }
+  }
+  return NULL;
+}
+
+// link state over rtnetlink, for HAL_SetLinkCallback
+HAL_LinkCallback link_callback = NULL;
+int link_fd = -1;
+// kernel index of each interface, and its state as last told to the callback
+int link_ifindex[HAL_MAX_IFACES];
+bool link_up[HAL_MAX_IFACES];
+// the state must be read again, after notifications were lost
+bool link_resync = false;
+
+static void linkReport(int if_index, bool up) {
+  if (link_up[if_index] == up) {
+    return;
+  }
+  link_up[if_index] = up;
+  if (debugEnabled) {
+    fprintf(stderr, "HAL_SetLinkCallback: link of interface %s is %s\n",
+            iface_names[if_index], up ? "up" : "down");
+  }
+  if (link_callback) {
+    link_callback(if_index, up);
+  }
+}
+
+// up and with a carrier, IFF_RUNNING follows the operational state
+static bool linkRunning(unsigned flags) {
+  return (flags & IFF_UP) && (flags & IFF_RUNNING);
+}
+
+// read the link notifications queued on link_fd and report the changes
+static void linkPoll() {
+  if (link_fd < 0) {
+    return;
+  }
+  uint8_t buffer[8192];
+  ssize_t n;
+  while ((n = recv(link_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) != 0) {
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      // ENOBUFS: some notifications were lost
+      link_resync = true;
+      continue;
+    }
+    int len = n;
+    for (struct nlmsghdr *h = (struct nlmsghdr *)buffer; NLMSG_OK(h, len);
+         h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_type != RTM_NEWLINK && h->nlmsg_type != RTM_DELLINK) {
+        continue;
+      }
+      struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(h);
+      bool up = h->nlmsg_type == RTM_NEWLINK && linkRunning(ifi->ifi_flags);
+      for (int i = 0; i < n_iface; i++) {
+        if (link_ifindex[i] == ifi->ifi_index) {
+          linkReport(i, up);
+        }
+      }
+    }
+  }
+  if (link_resync) {
+    link_resync = false;
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    for (int i = 0; i < n_iface && fd >= 0; i++) {
+      struct ifreq ifr;
+      memset(&ifr, 0, sizeof(ifr));
+      strncpy(ifr.ifr_name, trunk_interface ? trunk_interface : iface_names[i],
+              IFNAMSIZ - 1);
+      // a missing interface is down
+      linkReport(i, ioctl(fd, SIOCGIFFLAGS, &ifr) == 0 &&
+                        linkRunning(ifr.ifr_flags));
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+// the trunk is a single socket, so wait for it instead of polling
+static void trunkWait(int64_t deadline) {
+  int wait = -1;
+  if (deadline >= 0) {
+    int64_t left = deadline - (int64_t)HAL_GetTicks();
+    if (left <= 0) {
+      return;
+    }
+    wait = left;
+  }
+  // and for link notifications, poll skips link_fd while it is -1
+  struct pollfd fds[2] = {{pcap_get_selectable_fd(trunk_handle), POLLIN, 0},
+                          {link_fd, POLLIN, 0}};
+  if (poll(fds, 2, HAL_RxPolicyWait(wait)) > 0 && fds[1].revents) {
+    linkPoll();
+  }
+}
+
+// FIB offload over rtnetlink, routes of this program are tagged with RTPROT_RIP
+#ifndef RTPROT_RIP
+#define RTPROT_RIP 189
+#endif
+// requests are sent in batches of at most this many bytes
+const size_t OFFLOAD_BATCH = 32768;
+// large enough for a request of HAL_OFFLOAD_MAX_PATHS paths
+const size_t OFFLOAD_MAX_REQUEST = 512;
+
+int offload_fd = -1;
+uint32_t offload_seq = 0;
+uint8_t offload_buffer[OFFLOAD_BATCH];
+size_t offload_len = 0;
+// kernel index of each interface
+int offload_ifindex[HAL_MAX_IFACES];
+
+static int offloadOpen() {
+  if (offload_fd >= 0) {
+    return 0;
+  }
+  // the kernel knows nothing about the VLANs of the trunk
+  if (trunk_handle) {
+    return HAL_ERR_NOT_SUPPORTED;
+  }
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_Offload: netlink socket failed with %s\n",
+              strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+  struct sockaddr_nl local = {0};
+  local.nl_family = AF_NETLINK;
+  if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+    close(fd);
+    return HAL_ERR_UNKNOWN;
+  }
+  // errors only carry the header of the failed request
+  int one = 1;
+  setsockopt(fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+  for (int i = 0; i < n_iface; i++) {
+    offload_ifindex[i] = if_nametoindex(iface_names[i]);
+  }
+  offload_fd = fd;
+  return 0;
+}
+
+static void offloadAttr(struct nlmsghdr *h, int type, const void *data,
+                        size_t len) {
+  struct rtattr *rta =
+      (struct rtattr *)((uint8_t *)h + NLMSG_ALIGN(h->nlmsg_len));
+  rta->rta_type = type;
+  rta->rta_len = RTA_LENGTH(len);
+  memcpy(RTA_DATA(rta), data, len);
+  h->nlmsg_len = NLMSG_ALIGN(h->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+// count the errors the kernel has queued for our requests
+static int offloadErrors() {
+  int failed = 0;
+  uint8_t buffer[8192];
+  ssize_t n;
+  while ((n = recv(offload_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) != 0) {
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      // ENOBUFS: some errors were lost
+      failed++;
+      continue;
+    }
+    int len = n;
+    for (struct nlmsghdr *h = (struct nlmsghdr *)buffer; NLMSG_OK(h, len);
+         h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_type != NLMSG_ERROR) {
+        continue;
+      }
+      struct nlmsgerr *err = (struct nlmsgerr *)NLMSG_DATA(h);
+      // deleting a route that is not there is fine
+      if (err->error == 0 || err->error == -ESRCH || err->error == -ENOENT) {
+        continue;
+      }
+      failed++;
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_OffloadFlush: request %u failed with %s\n",
+                err->msg.nlmsg_seq, strerror(-err->error));
+      }
+    }
+  }
+  return failed;
+}
+
+// XDP fast path, maps are -1 until HAL_XdpAttach
+int xdp_routes_fd = -1;
+int xdp_neighbors_fd = -1;
+int xdp_links[HAL_MAX_IFACES];
+int xdp_ifindex[HAL_MAX_IFACES];
+
+// mirror a learnt ARP entry into the neighbors map of the XDP program
+static void xdpLearn(in_addr_t ip, int if_index, const macaddr_t mac) {
+  if (xdp_neighbors_fd < 0 || xdp_ifindex[if_index] == 0) {
+    return;
+  }
+  // packets to the router itself must reach it
+  for (int i = 0; i < n_iface; i++) {
+    if (ip == interface_addrs[i]) {
+      return;
+    }
+  }
+  XdpNeighborKey key = {ip, (uint32_t)if_index};
+  XdpNeighbor value;
+  memcpy(value.dst_mac, mac, sizeof(macaddr_t));
+  memcpy(value.src_mac, interface_mac[if_index], sizeof(macaddr_t));
+  value.ifindex = xdp_ifindex[if_index];
+  if (bpfUpdate(xdp_neighbors_fd, &key, &value) < 0 && debugEnabled) {
+    fprintf(stderr, "HAL_Xdp: failed to add neighbor %s: %s\n",
+            inet_ntoa(in_addr{ip}), strerror(errno));
+  }
+}
+
+// drops of the capture buffers, refreshed once per second
+static void updateKernelDrops() {
+  struct pcap_stat ps;
+  // drops of the trunk are not known by VLAN
+  if (trunk_handle && pcap_stats(trunk_handle, &ps) == 0) {
+    HAL_StatsSetKernelDrops(0, (uint64_t)ps.ps_drop + ps.ps_ifdrop);
+  }
+  for (int i = 0; i < n_iface; i++) {
+    if (pcap_in_handles[i] && pcap_stats(pcap_in_handles[i], &ps) == 0) {
+      HAL_StatsSetKernelDrops(i, (uint64_t)ps.ps_drop + ps.ps_ifdrop);
+    }
+  }
+}
+
+// handle a frame of port whose IPv4 or ARP payload starts at offset
+// @return the length of an IPv4 packet copied to buffer, 0 when the frame is
+// ARP or our own, -1 when it is something else
+static int handleFrame(const uint8_t *packet, size_t caplen, int port,
+                       int offset, uint8_t *buffer, size_t length,
+                       macaddr_t src_mac, macaddr_t dst_mac) {
+  if (caplen >= (size_t)offset &&
+      memcmp(&packet[6], interface_mac[port], sizeof(macaddr_t)) == 0) {
+    // skip outbound
+    return 0;
+  } else if (caplen >= (size_t)offset && packet[offset - 2] == 0x08 &&
+             packet[offset - 1] == 0x00) {
+    // IPv4
+    // TODO: what if len != caplen
+    // Beware: might be larger than MTU because of offloading
+    size_t ip_len = caplen - offset;
+    size_t real_length = length > ip_len ? ip_len : length;
+    memcpy(buffer, &packet[offset], real_length);
+    memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
+    memcpy(src_mac, &packet[6], sizeof(macaddr_t));
+    HAL_StatsCountRx(port, ip_len);
+    HAL_RxPolicyPacket();
+    return ip_len;
+  } else if (caplen >= (size_t)offset + 28 && packet[offset - 2] == 0x08 &&
+             packet[offset - 1] == 0x06) {
+    // ARP
+    const uint8_t *arp = &packet[offset];
+    // learn it
+    macaddr_t mac;
+    memcpy(mac, &arp[8], sizeof(macaddr_t));
+    in_addr_t ip;
+    memcpy(&ip, &arp[14], sizeof(in_addr_t));
+    memcpy(arp_table[std::pair<in_addr_t, int>(ip, port)], mac,
+           sizeof(macaddr_t));
+    xdpLearn(ip, port, mac);
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
+              inet_ntoa(in_addr{ip}));
+    }
+
+    in_addr_t dst_ip;
+    memcpy(&dst_ip, &arp[24], sizeof(in_addr_t));
+    // ask me: reply
+    if (dst_ip == interface_addrs[port] && arp[7] == 0x01) {
+      // reply
+      uint8_t buffer[64] = {0};
+      // dst mac, src mac and ARP
+      uint8_t *reply = &buffer[ethernetHeader(buffer, port, mac, 0x0806)];
+      memcpy(mac, interface_mac[port], sizeof(macaddr_t));
+      // hardware type
+      reply[1] = 0x01;
+      // protocol type
+      reply[2] = 0x08;
+      // hardware size
+      reply[4] = 0x06;
+      // protocol size
+      reply[5] = 0x04;
+      // opcode
+      reply[7] = 0x02;
+      // sender
+      memcpy(&reply[8], mac, sizeof(macaddr_t));
+      memcpy(&reply[14], &dst_ip, sizeof(in_addr_t));
+      // target
+      memcpy(&reply[18], &arp[8], sizeof(macaddr_t));
+      memcpy(&reply[24], &arp[14], sizeof(in_addr_t));
+
+      pcap_inject(pcap_out_handles[port], buffer, sizeof(buffer));
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
+                inet_ntoa(in_addr{ip}));
+      }
+    }
+    // otherwise: learn and ignore
+    return 0;
+  }
+  return -1;
+}
+
 extern "C" {
 int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  return HAL_InitInterfaces(debug, N_IFACE_ON_BOARD, NULL, if_addrs);
+}
+
+int HAL_InitInterfaces(int debug, int n, const char *const *names,
+                       const in_addr_t *if_addrs) {
   if (inited) {
     return 0;
   }
+  if (n <= 0 || n > HAL_MAX_IFACES || if_addrs == NULL ||
+      (names == NULL && !trunk_interface && n > N_IFACE_ON_BOARD)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
   debugEnabled = debug;
+  n_iface = n;
+  for (int i = 0; i < n_iface; i++) {
+    if (names) {
+      iface_names[i] = strdup(names[i]);
+    } else if (trunk_interface) {
+      char vid[8];
+      snprintf(vid, sizeof(vid), "%d", HAL_TRUNK_VLAN_BASE + i);
+      iface_names[i] = strdup(vid);
+    } else {
+      iface_names[i] = interfaces[i];
+    }
+  }
 
   // find matching interfaces and get their MAC address
   struct ifaddrs *ifaddr, *ifa;
@@ -54,58 +504,90 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
   for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
     if (ifa->ifa_addr == NULL)
       continue;
-    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    for (int i = 0; i < n_iface; i++) {
+      // in trunk mode, all of the interfaces have the MAC address of the trunk
+      const char *name = trunk_interface ? trunk_interface : iface_names[i];
       if (ifa->ifa_addr->sa_family == AF_PACKET &&
-          strcmp(ifa->ifa_name, interfaces[i]) == 0) {
+          strcmp(ifa->ifa_name, name) == 0) {
         // found
         memcpy(interface_mac[i],
                ((struct sockaddr_ll *)ifa->ifa_addr)->sll_addr,
                sizeof(macaddr_t));
         memcpy(arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)],
                interface_mac[i], sizeof(macaddr_t));
-        if (debugEnabled) {
+        if (debugEnabled && (!trunk_interface || i == 0)) {
           fprintf(stderr, "HAL_Init: found MAC addr of interface %s\n",
-                  interfaces[i]);
+                  name);
+        }
+        // in trunk mode, the trunk matches every interface
+        if (!trunk_interface) {
+          break;
         }
-        break;
       }
     }
   }
   freeifaddrs(ifaddr);
 
+  // the VLAN tag of trunk mode does not count in the MTU
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  for (int i = 0; i < n_iface; i++) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, trunk_interface ? trunk_interface : iface_names[i],
+            IFNAMSIZ - 1);
+    interface_mtu[i] = fd >= 0 && ioctl(fd, SIOCGIFMTU, &ifr) == 0 ? ifr.ifr_mtu : 1500;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
   // init pcap handles
   char error_buffer[PCAP_ERRBUF_SIZE];
-  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+  if (trunk_interface) {
+    int res = trunkOpen(error_buffer);
+    if (res != 0) {
+      return res;
+    }
+  } else {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  }
+  for (int i = 0; i < n_iface && !trunk_interface; i++) {
     pcap_in_handles[i] =
-        pcap_open_live(interfaces[i], BUFSIZ, 1, 1, error_buffer);
+        pcap_open_live(iface_names[i], SNAPLEN, 1, 1, error_buffer);
     if (pcap_in_handles[i]) {
       pcap_setnonblock(pcap_in_handles[i], 1, error_buffer);
+      struct epoll_event event = {0};
+      event.events = EPOLLIN;
+      event.data.u32 = i;
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD,
+                pcap_get_selectable_fd(pcap_in_handles[i]), &event);
+      HAL_RxPolicySocket(pcap_get_selectable_fd(pcap_in_handles[i]));
       if (debugEnabled) {
         fprintf(stderr, "HAL_Init: pcap capture enabled for %s\n",
-                interfaces[i]);
+                iface_names[i]);
       }
     } else {
       if (debugEnabled) {
         fprintf(stderr,
                 "HAL_Init: pcap capture disabled for %s, either the interface "
                 "does not exist or permission is denied\n",
-                interfaces[i]);
+                iface_names[i]);
       }
     }
     pcap_out_handles[i] =
-        pcap_open_live(interfaces[i], BUFSIZ, 1, 0, error_buffer);
+        pcap_open_live(iface_names[i], SNAPLEN, 1, 0, error_buffer);
   }
 
-  memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
+  memcpy(interface_addrs, if_addrs, n_iface * sizeof(in_addr_t));
 
   inited = true;
   // send igmp to join RIP multicast group
-  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+  for (int i = 0; i < n_iface; i++) {
     if (pcap_out_handles[i]) {
       HAL_JoinIGMPGroup(i, if_addrs[i]);
       if (debugEnabled) {
-        fprintf(stderr, "HAL_Init: Joining RIP multicast group 224.0.0.9 for %s\n",
-                interfaces[i]);
+        fprintf(stderr, "HAL_Init: Joining RIP multicast group 224.0.0.9 for interface %d\n",
+                i);
       }
     }
   }
@@ -123,7 +605,7 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
-  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+  if (if_index >= n_iface || if_index < 0) {
     return HAL_ERR_INVALID_PARAMETER;
   }
 
@@ -152,43 +634,49 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
           inet_ntoa(in_addr{ip}));
     }
     uint8_t buffer[64] = {0};
-    // dst mac
-    for (int i = 0; i < 6; i++) {
-      buffer[i] = 0xff;
-    }
-    // src mac
+    // dst mac: broadcast, src mac and ARP
+    const macaddr_t broadcast = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    uint8_t *arp = &buffer[ethernetHeader(buffer, if_index, broadcast, 0x0806)];
     macaddr_t mac;
     HAL_GetInterfaceMacAddress(if_index, mac);
-    memcpy(&buffer[6], mac, sizeof(macaddr_t));
-    // ARP
-    buffer[12] = 0x08;
-    buffer[13] = 0x06;
     // hardware type
-    buffer[15] = 0x01;
+    arp[1] = 0x01;
     // protocol type
-    buffer[16] = 0x08;
+    arp[2] = 0x08;
     // hardware size
-    buffer[18] = 0x06;
+    arp[4] = 0x06;
     // protocol size
-    buffer[19] = 0x04;
+    arp[5] = 0x04;
     // opcode
-    buffer[21] = 0x01;
+    arp[7] = 0x01;
     // sender
-    memcpy(&buffer[22], mac, sizeof(macaddr_t));
-    memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
+    memcpy(&arp[8], mac, sizeof(macaddr_t));
+    memcpy(&arp[14], &interface_addrs[if_index], sizeof(in_addr_t));
     // target
-    memcpy(&buffer[38], &ip, sizeof(in_addr_t));
+    memcpy(&arp[24], &ip, sizeof(in_addr_t));
 
     pcap_inject(pcap_out_handles[if_index], buffer, sizeof(buffer));
   }
   return HAL_ERR_IP_NOT_EXIST;
 }
 
+int HAL_InterfaceCount() { return n_iface; }
+
+int HAL_GetInterfaceMtu(int if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= n_iface || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  return interface_mtu[if_index];
+}
+
 int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
-  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+  if (if_index >= n_iface || if_index < 0) {
     return HAL_ERR_IFACE_NOT_EXIST;
   }
 
@@ -202,13 +690,14 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
-  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+  int n_mask = n_iface < 31 ? n_iface : 31;
+  if ((if_index_mask & ((1 << n_mask) - 1)) == 0 ||
       (timeout < 0 && timeout != -1) || (if_index == NULL) || (buffer == NULL)) {
     return HAL_ERR_INVALID_PARAMETER;
   }
 
-  bool flag = false;
-  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+  bool flag = trunk_handle != NULL;
+  for (int i = 0; i < n_mask; i++) {
     if (pcap_in_handles[i] && (if_index_mask & (1 << i))) {
       flag = true;
     }
@@ -223,94 +712,169 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
 
   int64_t begin = HAL_GetTicks();
   int64_t current_time = 0;
+  if (begin >= pcap_stats_time + 1000) {
+    updateKernelDrops();
+    pcap_stats_time = begin;
+  }
+  // this loop polls the handles in turn, link notifications are read once
+  linkPoll();
   // Round robin
   int current_port = 0;
   struct pcap_pkthdr hdr;
   do {
-    if ((if_index_mask & (1 << current_port)) == 0 ||
-        !pcap_in_handles[current_port]) {
-      current_port = (current_port + 1) % N_IFACE_ON_BOARD;
-      continue;
+    const uint8_t *packet;
+    int port = current_port;
+    int offset = IP_OFFSET;
+    if (trunk_handle) {
+      packet = trunkNext(&hdr, &port);
+      if (!packet) {
+        trunkWait(timeout == -1 ? -1 : begin + timeout);
+        continue;
+      }
+      if (port >= n_mask || (if_index_mask & (1 << port)) == 0) {
+        continue;
+      }
+      offset = TRUNK_IP_OFFSET;
+    } else {
+      if ((if_index_mask & (1 << current_port)) == 0 ||
+          !pcap_in_handles[current_port]) {
+        current_port = (current_port + 1) % n_mask;
+        continue;
+      }
+      packet = pcap_next(pcap_in_handles[current_port], &hdr);
     }
 
-    const uint8_t *packet = pcap_next(pcap_in_handles[current_port], &hdr);
-    if (packet && hdr.caplen >= IP_OFFSET &&
-        memcmp(&packet[6], interface_mac[current_port], sizeof(macaddr_t)) ==
-            0) {
-      // skip outbound
-      continue;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x00) {
-      // IPv4
-      // TODO: what if len != caplen
-      // Beware: might be larger than MTU because of offloading
-      size_t ip_len = hdr.caplen - IP_OFFSET;
-      size_t real_length = length > ip_len ? ip_len : length;
-      memcpy(buffer, &packet[IP_OFFSET], real_length);
-      memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
-      memcpy(src_mac, &packet[6], sizeof(macaddr_t));
-      *if_index = current_port;
-      return ip_len;
-    } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
-               packet[13] == 0x06) {
-      // ARP
-      // learn it
-      macaddr_t mac;
-      memcpy(mac, &packet[22], sizeof(macaddr_t));
-      in_addr_t ip;
-      memcpy(&ip, &packet[28], sizeof(in_addr_t));
-      memcpy(arp_table[std::pair<in_addr_t, int>(ip, current_port)], mac,
-             sizeof(macaddr_t));
-      if (debugEnabled) {
-        fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
-                inet_ntoa(in_addr{ip}));
+    if (packet) {
+      int res = handleFrame(packet, hdr.caplen, port, offset, buffer, length,
+                            src_mac, dst_mac);
+      if (res > 0) {
+        *if_index = port;
+        return res;
+      } else if (res == 0) {
+        // ARP, or outbound
+        continue;
       }
+    }
 
-      in_addr_t dst_ip;
-      memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
-      // ask me: reply
-      if (dst_ip == interface_addrs[current_port] && packet[21] == 0x01) {
-        // reply
-        uint8_t buffer[64] = {0};
-        // dst mac
-        memcpy(buffer, &packet[6], sizeof(macaddr_t));
-        // src mac
-        macaddr_t mac;
-        HAL_GetInterfaceMacAddress(current_port, mac);
-        memcpy(&buffer[6], mac, sizeof(macaddr_t));
-        // ARP
-        buffer[12] = 0x08;
-        buffer[13] = 0x06;
-        // hardware type
-        buffer[15] = 0x01;
-        // protocol type
-        buffer[16] = 0x08;
-        // hardware size
-        buffer[18] = 0x06;
-        // protocol size
-        buffer[19] = 0x04;
-        // opcode
-        buffer[21] = 0x02;
-        // sender
-        memcpy(&buffer[22], mac, sizeof(macaddr_t));
-        memcpy(&buffer[28], &dst_ip, sizeof(in_addr_t));
-        // target
-        memcpy(&buffer[32], &packet[22], sizeof(macaddr_t));
-        memcpy(&buffer[38], &packet[28], sizeof(in_addr_t));
-
-        pcap_inject(pcap_out_handles[current_port], buffer, sizeof(buffer));
-        if (debugEnabled) {
-          fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
-                  inet_ntoa(in_addr{ip}));
-        }
+    current_port = (current_port + 1) % n_mask;
+    // -1 for infinity
+  } while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1);
+  return 0;
+}
+
+int HAL_ReceiveIPPacketAny(uint8_t *buffer, size_t length, macaddr_t src_mac,
+                           macaddr_t dst_mac, int64_t timeout, int *if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((timeout < 0 && timeout != -1) || (if_index == NULL) ||
+      (buffer == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  int64_t begin = HAL_GetTicks();
+  if (begin >= pcap_stats_time + 1000) {
+    updateKernelDrops();
+    pcap_stats_time = begin;
+  }
+  if (link_resync) {
+    linkPoll();
+  }
+  struct pcap_pkthdr hdr;
+  while (true) {
+    const uint8_t *packet = NULL;
+    int port = 0;
+    int offset = IP_OFFSET;
+    if (trunk_handle) {
+      packet = trunkNext(&hdr, &port);
+      offset = TRUNK_IP_OFFSET;
+    } else {
+      // one frame from each interface that has some, in turn
+      while (!packet && next_ready < n_ready) {
+        port = ready_ifaces[next_ready++];
+        packet = pcap_next(pcap_in_handles[port], &hdr);
+      }
+    }
+
+    if (packet) {
+      int res = handleFrame(packet, hdr.caplen, port, offset, buffer, length,
+                            src_mac, dst_mac);
+      if (res > 0) {
+        *if_index = port;
+        return res;
       }
-      // otherwise: learn and ignore
       continue;
     }
 
-    current_port = (current_port + 1) % N_IFACE_ON_BOARD;
-    // -1 for infinity
-  } while ((current_time = HAL_GetTicks()) < begin + timeout || timeout == -1);
+    int64_t left = timeout == -1 ? -1 : begin + timeout - HAL_GetTicks();
+    if (timeout != -1 && left < 0) {
+      return 0;
+    }
+    if (trunk_handle) {
+      trunkWait(timeout == -1 ? -1 : begin + timeout);
+      if (timeout != -1 && left == 0) {
+        return 0;
+      }
+      continue;
+    }
+    // only the interfaces that are readable are polled next
+    struct epoll_event events[64];
+    int n = epoll_wait(epoll_fd, events, 64, HAL_RxPolicyWait(left));
+    if (n < 0 && errno != EINTR) {
+      return HAL_ERR_UNKNOWN;
+    }
+    n_ready = 0;
+    next_ready = 0;
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.u32 == HAL_MAX_IFACES) {
+        linkPoll();
+      } else {
+        ready_ifaces[n_ready++] = events[i].data.u32;
+      }
+    }
+    if (n <= 0 && left == 0) {
+      return 0;
+    }
+  }
+}
+
+int HAL_SetLinkCallback(HAL_LinkCallback callback) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  link_callback = callback;
+  if (!callback || link_fd >= 0) {
+    return 0;
+  }
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_SetLinkCallback: netlink socket failed with %s\n",
+              strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+  struct sockaddr_nl local = {0};
+  local.nl_family = AF_NETLINK;
+  local.nl_groups = RTMGRP_LINK;
+  if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+    close(fd);
+    return HAL_ERR_UNKNOWN;
+  }
+  for (int i = 0; i < n_iface; i++) {
+    link_ifindex[i] =
+        if_nametoindex(trunk_interface ? trunk_interface : iface_names[i]);
+    link_up[i] = true;
+  }
+  link_fd = fd;
+  // interfaces that are down already are reported by the next receive
+  link_resync = true;
+  if (epoll_fd >= 0) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.u32 = HAL_MAX_IFACES;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
   return 0;
 }
 
@@ -319,22 +883,20 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
-  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+  if (if_index >= n_iface || if_index < 0) {
     return HAL_ERR_INVALID_PARAMETER;
   }
   if (!pcap_out_handles[if_index]) {
     return HAL_ERR_IFACE_NOT_EXIST;
   }
-  uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
-  memcpy(eth_buffer, dst_mac, sizeof(macaddr_t));
-  memcpy(&eth_buffer[6], interface_mac[if_index], sizeof(macaddr_t));
+  uint8_t *eth_buffer = (uint8_t *)malloc(length + TRUNK_IP_OFFSET);
   // IPv4
-  eth_buffer[12] = 0x08;
-  eth_buffer[13] = 0x00;
-  memcpy(&eth_buffer[IP_OFFSET], buffer, length);
-  if (pcap_inject(pcap_out_handles[if_index], eth_buffer, length + IP_OFFSET) >=
+  int offset = ethernetHeader(eth_buffer, if_index, dst_mac, 0x0800);
+  memcpy(&eth_buffer[offset], buffer, length);
+  if (pcap_inject(pcap_out_handles[if_index], eth_buffer, length + offset) >=
       0) {
     free(eth_buffer);
+    HAL_StatsCountTx(if_index, length);
     return 0;
   } else {
     if (debugEnabled) {
@@ -345,4 +907,264 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
     return HAL_ERR_UNKNOWN;
   }
 }
-}
\ No newline at end of file
+
+int HAL_OffloadRoute(in_addr_t addr, uint32_t len, const in_addr_t *nexthops,
+                     const int *if_indices, int n) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (len > 32 || n < 0 || n > HAL_OFFLOAD_MAX_PATHS ||
+      (n > 0 && (!nexthops || !if_indices))) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  int res = offloadOpen();
+  if (res != 0) {
+    return res;
+  }
+  for (int i = 0; i < n; i++) {
+    if (if_indices[i] < 0 || if_indices[i] >= n_iface) {
+      return HAL_ERR_INVALID_PARAMETER;
+    }
+    if (offload_ifindex[if_indices[i]] == 0) {
+      return HAL_ERR_IFACE_NOT_EXIST;
+    }
+  }
+  if (offload_len + OFFLOAD_MAX_REQUEST > OFFLOAD_BATCH) {
+    res = HAL_OffloadFlush();
+    if (res < 0) {
+      return res;
+    }
+  }
+
+  struct nlmsghdr *h = (struct nlmsghdr *)&offload_buffer[offload_len];
+  memset(h, 0, OFFLOAD_MAX_REQUEST);
+  h->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+  h->nlmsg_type = n > 0 ? RTM_NEWROUTE : RTM_DELROUTE;
+  // no NLM_F_ACK: the kernel only answers failed requests
+  h->nlmsg_flags = NLM_F_REQUEST | (n > 0 ? NLM_F_CREATE | NLM_F_REPLACE : 0);
+  h->nlmsg_seq = ++offload_seq;
+  struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(h);
+  rtm->rtm_family = AF_INET;
+  rtm->rtm_dst_len = len;
+  rtm->rtm_table = RT_TABLE_MAIN;
+  // deletion matches the protocol, so routes of others are never removed
+  rtm->rtm_protocol = RTPROT_RIP;
+  rtm->rtm_type = RTN_UNICAST;
+  if (n == 0) {
+    rtm->rtm_scope = RT_SCOPE_NOWHERE;
+  } else if (n == 1 && nexthops[0] == 0) {
+    rtm->rtm_scope = RT_SCOPE_LINK;
+  } else {
+    rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+  }
+  offloadAttr(h, RTA_DST, &addr, sizeof(addr));
+  if (n == 1) {
+    if (nexthops[0]) {
+      offloadAttr(h, RTA_GATEWAY, &nexthops[0], sizeof(in_addr_t));
+    }
+    offloadAttr(h, RTA_OIF, &offload_ifindex[if_indices[0]], sizeof(int));
+  } else if (n > 1) {
+    // equal-cost paths, an rtnexthop with a gateway for each
+    struct rtattr *mp =
+        (struct rtattr *)((uint8_t *)h + NLMSG_ALIGN(h->nlmsg_len));
+    mp->rta_type = RTA_MULTIPATH;
+    uint8_t *p = (uint8_t *)RTA_DATA(mp);
+    for (int i = 0; i < n; i++) {
+      struct rtnexthop *nh = (struct rtnexthop *)p;
+      nh->rtnh_ifindex = offload_ifindex[if_indices[i]];
+      nh->rtnh_len = sizeof(struct rtnexthop);
+      if (nexthops[i]) {
+        struct rtattr *gw = RTNH_DATA(nh);
+        gw->rta_type = RTA_GATEWAY;
+        gw->rta_len = RTA_LENGTH(sizeof(in_addr_t));
+        memcpy(RTA_DATA(gw), &nexthops[i], sizeof(in_addr_t));
+        nh->rtnh_len += RTA_ALIGN(gw->rta_len);
+      }
+      p += RTNH_ALIGN(nh->rtnh_len);
+    }
+    mp->rta_len = p - (uint8_t *)mp;
+    h->nlmsg_len = NLMSG_ALIGN(h->nlmsg_len) + RTA_ALIGN(mp->rta_len);
+  }
+  offload_len += NLMSG_ALIGN(h->nlmsg_len);
+  return 0;
+}
+
+int HAL_OffloadFlush() {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (offload_len == 0) {
+    return 0;
+  }
+  struct sockaddr_nl kernel = {0};
+  kernel.nl_family = AF_NETLINK;
+  ssize_t sent = sendto(offload_fd, offload_buffer, offload_len, 0,
+                        (struct sockaddr *)&kernel, sizeof(kernel));
+  offload_len = 0;
+  if (sent < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_OffloadFlush: sendto failed with %s\n",
+              strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+  // rtnetlink handles the requests within sendto, so the errors are queued
+  return offloadErrors();
+}
+
+int HAL_OffloadClear() {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  int res = offloadOpen();
+  if (res == 0) {
+    res = HAL_OffloadFlush();
+  }
+  if (res < 0) {
+    return res;
+  }
+  struct {
+    struct nlmsghdr h;
+    struct rtmsg rtm;
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.h.nlmsg_len = sizeof(request);
+  request.h.nlmsg_type = RTM_GETROUTE;
+  request.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.h.nlmsg_seq = ++offload_seq;
+  request.rtm.rtm_family = AF_INET;
+  if (send(offload_fd, &request, sizeof(request), 0) < 0) {
+    return HAL_ERR_UNKNOWN;
+  }
+  // collect first, the dump must not interleave with our requests
+  std::vector<std::pair<in_addr_t, uint32_t>> routes;
+  uint8_t buffer[16384];
+  bool done = false;
+  while (!done) {
+    ssize_t n = recv(offload_fd, buffer, sizeof(buffer), 0);
+    if (n < 0) {
+      return HAL_ERR_UNKNOWN;
+    }
+    int len = n;
+    for (struct nlmsghdr *h = (struct nlmsghdr *)buffer; NLMSG_OK(h, len);
+         h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_type == NLMSG_DONE || h->nlmsg_type == NLMSG_ERROR) {
+        done = true;
+        break;
+      }
+      struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(h);
+      if (h->nlmsg_type != RTM_NEWROUTE || rtm->rtm_table != RT_TABLE_MAIN ||
+          rtm->rtm_protocol != RTPROT_RIP) {
+        continue;
+      }
+      in_addr_t dst = 0;
+      int attrs = RTM_PAYLOAD(h);
+      for (struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, attrs);
+           rta = RTA_NEXT(rta, attrs)) {
+        if (rta->rta_type == RTA_DST) {
+          memcpy(&dst, RTA_DATA(rta), sizeof(dst));
+        }
+      }
+      routes.push_back(std::make_pair(dst, (uint32_t)rtm->rtm_dst_len));
+    }
+  }
+  for (size_t i = 0; i < routes.size(); i++) {
+    HAL_OffloadRoute(routes[i].first, routes[i].second, NULL, NULL, 0);
+  }
+  res = HAL_OffloadFlush();
+  if (res < 0) {
+    return res;
+  }
+  return routes.size() - res;
+}
+
+int HAL_XdpAttach(int flags) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (xdp_routes_fd >= 0) {
+    return 0;
+  }
+  // the program forwards untagged frames between real interfaces
+  if (trunk_handle) {
+    return HAL_ERR_NOT_SUPPORTED;
+  }
+  int routes = bpfCreateMap(BPF_MAP_TYPE_LPM_TRIE, sizeof(XdpRouteKey),
+                            sizeof(XdpRoute), XDP_MAX_ROUTES, BPF_F_NO_PREALLOC);
+  int neighbors = bpfCreateMap(BPF_MAP_TYPE_HASH, sizeof(XdpNeighborKey),
+                               sizeof(XdpNeighbor), XDP_MAX_NEIGHBORS, 0);
+  if (routes < 0 || neighbors < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_XdpAttach: failed to create maps: %s\n",
+              strerror(errno));
+    }
+    close(routes);
+    close(neighbors);
+    return HAL_ERR_NOT_SUPPORTED;
+  }
+  static char log[65536];
+  int prog = xdpLoad(xdpAssemble(routes, neighbors), debugEnabled ? log : NULL,
+                     sizeof(log));
+  if (prog < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_XdpAttach: failed to load program: %s\n%s",
+              strerror(errno), log);
+    }
+    close(routes);
+    close(neighbors);
+    return HAL_ERR_NOT_SUPPORTED;
+  }
+  int attached = 0;
+  for (int i = 0; i < n_iface; i++) {
+    xdp_ifindex[i] = if_nametoindex(iface_names[i]);
+    if (xdp_ifindex[i] == 0) {
+      continue;
+    }
+    xdp_links[i] = xdpAttach(prog, xdp_ifindex[i], flags);
+    if (xdp_links[i] >= 0) {
+      attached++;
+    } else if (debugEnabled) {
+      fprintf(stderr, "HAL_XdpAttach: failed to attach to %s: %s\n",
+              iface_names[i], strerror(errno));
+    }
+  }
+  // the links hold the program
+  close(prog);
+  if (attached == 0) {
+    close(routes);
+    close(neighbors);
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  xdp_routes_fd = routes;
+  xdp_neighbors_fd = neighbors;
+  for (auto it = arp_table.begin(); it != arp_table.end(); it++) {
+    xdpLearn(it->first.first, it->first.second, it->second);
+  }
+  return 0;
+}
+
+int HAL_XdpUpdateRoute(in_addr_t addr, uint32_t len, in_addr_t nexthop,
+                       int if_index) {
+  if (!inited || xdp_routes_fd < 0) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (len > 32 || if_index >= n_iface) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  XdpRouteKey key = {len, addr};
+  if (if_index < 0) {
+    if (bpfDelete(xdp_routes_fd, &key) < 0 && errno != ENOENT) {
+      return HAL_ERR_UNKNOWN;
+    }
+    return 0;
+  }
+  XdpRoute value = {nexthop, (uint32_t)if_index};
+  if (bpfUpdate(xdp_routes_fd, &key, &value) < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_XdpUpdateRoute: %s\n", strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+  return 0;
+}
+}
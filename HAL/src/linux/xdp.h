@@ -0,0 +1,261 @@
+#ifndef __XDP_H__
+#define __XDP_H__
+
+// The XDP fast path of the Linux backend: the program is assembled here and
+// loaded with the bpf() syscall, so that neither clang nor libbpf is needed
+
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// key of the routes map, as BPF_MAP_TYPE_LPM_TRIE wants it
+struct XdpRouteKey {
+  uint32_t len;
+  in_addr_t addr;
+};
+
+struct XdpRoute {
+  in_addr_t nexthop; // 0 for direct routes, the destination is the next hop
+  uint32_t if_index;
+};
+
+struct XdpNeighborKey {
+  in_addr_t addr;
+  uint32_t if_index;
+};
+
+// everything needed to send to a neighbor, the program copies the first 12
+// bytes over the ethernet addresses
+struct XdpNeighbor {
+  uint8_t dst_mac[6];
+  uint8_t src_mac[6];
+  uint32_t ifindex; // kernel index of the interface
+};
+
+static_assert(sizeof(XdpNeighbor) == 16, "XdpNeighbor is copied by words");
+
+const uint32_t XDP_MAX_ROUTES = 1 << 20;
+const uint32_t XDP_MAX_NEIGHBORS = 4096;
+
+static inline long bpfCall(int cmd, union bpf_attr *attr) {
+  return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static inline int bpfCreateMap(uint32_t type, uint32_t key_size, uint32_t value_size,
+                        uint32_t max_entries, uint32_t flags) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = type;
+  attr.key_size = key_size;
+  attr.value_size = value_size;
+  attr.max_entries = max_entries;
+  attr.map_flags = flags;
+  return bpfCall(BPF_MAP_CREATE, &attr);
+}
+
+static inline int bpfUpdate(int fd, const void *key, const void *value) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = fd;
+  attr.key = (uint64_t)(uintptr_t)key;
+  attr.value = (uint64_t)(uintptr_t)value;
+  attr.flags = BPF_ANY;
+  return bpfCall(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static inline int bpfDelete(int fd, const void *key) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = fd;
+  attr.key = (uint64_t)(uintptr_t)key;
+  return bpfCall(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+// a small assembler, jumps name labels that are resolved by finish()
+class XdpAssembler {
+public:
+  enum { R0, R1, R2, R3, R4, R5, R6, R7, R8, R9, FP };
+
+  int label() {
+    labels.push_back(-1);
+    return labels.size() - 1;
+  }
+  void bind(int l) { labels[l] = insns.size(); }
+
+  void mov(int dst, int32_t imm) { emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm); }
+  void movReg(int dst, int src) { emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0); }
+  void add(int dst, int32_t imm) { emit(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm); }
+  // size is BPF_B, BPF_H, BPF_W or BPF_DW
+  void load(int size, int dst, int src, int16_t off) {
+    emit(BPF_LDX | BPF_MEM | size, dst, src, off, 0);
+  }
+  void store(int size, int dst, int16_t off, int src) {
+    emit(BPF_STX | BPF_MEM | size, dst, src, off, 0);
+  }
+  void storeImm(int size, int dst, int16_t off, int32_t imm) {
+    emit(BPF_ST | BPF_MEM | size, dst, 0, off, imm);
+  }
+  void loadMap(int dst, int fd) {
+    emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+    emit(0, 0, 0, 0, 0);
+  }
+  // op is BPF_JEQ, BPF_JGT, ...
+  void jump(int op, int dst, int32_t imm, int l) {
+    fixups.push_back(std::make_pair(insns.size(), l));
+    emit(BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+  }
+  void jumpReg(int op, int dst, int src, int l) {
+    fixups.push_back(std::make_pair(insns.size(), l));
+    emit(BPF_JMP | op | BPF_X, dst, src, 0, 0);
+  }
+  void call(int32_t helper) { emit(BPF_JMP | BPF_CALL, 0, 0, 0, helper); }
+  void exit() { emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0); }
+
+  const std::vector<struct bpf_insn> &finish() {
+    for (size_t i = 0; i < fixups.size(); i++) {
+      insns[fixups[i].first].off = labels[fixups[i].second] - fixups[i].first - 1;
+    }
+    return insns;
+  }
+
+private:
+  std::vector<struct bpf_insn> insns;
+  std::vector<int> labels;
+  std::vector<std::pair<size_t, int>> fixups;
+
+  void emit(uint8_t code, int dst, int src, int16_t off, int32_t imm) {
+    struct bpf_insn insn;
+    memset(&insn, 0, sizeof(insn));
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    insns.push_back(insn);
+  }
+};
+
+/**
+ * Assemble the forwarding program
+ * A packet is redirected only when it is a plain IPv4 packet (no options)
+ * with a TTL above 1 to a unicast address, has a route and the MAC address
+ * of the next hop is known. Everything else is passed up to the stack, where
+ * capture hands it to the router as before.
+ */
+static inline std::vector<struct bpf_insn> xdpAssemble(int routes_fd, int neighbors_fd) {
+  typedef XdpAssembler A;
+  A a;
+  int pass = a.label(), haveNexthop = a.label(), noCarry = a.label();
+  // r7: start of the packet, kept across helper calls
+  a.load(BPF_W, A::R7, A::R1, offsetof(struct xdp_md, data));
+  a.load(BPF_W, A::R3, A::R1, offsetof(struct xdp_md, data_end));
+  a.movReg(A::R2, A::R7);
+  a.add(A::R2, 14 + 20);
+  a.jumpReg(BPF_JGT, A::R2, A::R3, pass);
+  // ethertype, loaded in the byte order of the packet
+  a.load(BPF_H, A::R2, A::R7, 12);
+  a.jump(BPF_JNE, A::R2, htons(0x0800), pass);
+  a.load(BPF_B, A::R2, A::R7, 14);
+  a.jump(BPF_JNE, A::R2, 0x45, pass);
+  // TTL expiry is left to the router
+  a.load(BPF_B, A::R2, A::R7, 14 + 8);
+  a.jump(BPF_JLE, A::R2, 1, pass);
+  // multicast, e.g. RIP
+  a.load(BPF_B, A::R2, A::R7, 14 + 16);
+  a.jump(BPF_JGE, A::R2, 224, pass);
+
+  // longest prefix match, key {32, dst} at fp - 8
+  a.storeImm(BPF_W, A::FP, -8, 32);
+  a.load(BPF_W, A::R2, A::R7, 14 + 16);
+  a.store(BPF_W, A::FP, -4, A::R2);
+  a.loadMap(A::R1, routes_fd);
+  a.movReg(A::R2, A::FP);
+  a.add(A::R2, -8);
+  a.call(BPF_FUNC_map_lookup_elem);
+  a.jump(BPF_JEQ, A::R0, 0, pass);
+  a.load(BPF_W, A::R2, A::R0, offsetof(XdpRoute, nexthop));
+  a.load(BPF_W, A::R3, A::R0, offsetof(XdpRoute, if_index));
+  a.jump(BPF_JNE, A::R2, 0, haveNexthop);
+  a.load(BPF_W, A::R2, A::R7, 14 + 16);
+  a.bind(haveNexthop);
+
+  // neighbor, key {nexthop, if_index} at fp - 16
+  a.store(BPF_W, A::FP, -16, A::R2);
+  a.store(BPF_W, A::FP, -12, A::R3);
+  a.loadMap(A::R1, neighbors_fd);
+  a.movReg(A::R2, A::FP);
+  a.add(A::R2, -16);
+  a.call(BPF_FUNC_map_lookup_elem);
+  a.jump(BPF_JEQ, A::R0, 0, pass);
+
+  // ethernet addresses
+  for (int off = 0; off < 12; off += 4) {
+    a.load(BPF_W, A::R2, A::R0, off);
+    a.store(BPF_W, A::R7, off, A::R2);
+  }
+  // TTL, and the checksum updated as in ip_decrease_ttl() of Linux
+  a.load(BPF_B, A::R2, A::R7, 14 + 8);
+  a.add(A::R2, -1);
+  a.store(BPF_B, A::R7, 14 + 8, A::R2);
+  a.load(BPF_H, A::R2, A::R7, 14 + 10);
+  a.add(A::R2, htons(0x0100));
+  a.jump(BPF_JLT, A::R2, 0xffff, noCarry);
+  a.add(A::R2, 1);
+  a.bind(noCarry);
+  a.store(BPF_H, A::R7, 14 + 10, A::R2);
+
+  // returns XDP_REDIRECT
+  a.load(BPF_W, A::R1, A::R0, offsetof(XdpNeighbor, ifindex));
+  a.mov(A::R2, 0);
+  a.call(BPF_FUNC_redirect);
+  a.exit();
+
+  a.bind(pass);
+  a.mov(A::R0, XDP_PASS);
+  a.exit();
+  return a.finish();
+}
+
+/**
+ * Load the program, with the verifier log in log if it is given
+ * @return the program fd, -1 on error
+ */
+static inline int xdpLoad(const std::vector<struct bpf_insn> &insns, char *log, size_t log_size) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = (uint64_t)(uintptr_t)insns.data();
+  attr.insn_cnt = insns.size();
+  attr.license = (uint64_t)(uintptr_t) "GPL";
+  if (log) {
+    log[0] = 0;
+    attr.log_buf = (uint64_t)(uintptr_t)log;
+    attr.log_size = log_size;
+    attr.log_level = 1;
+  }
+  strncpy(attr.prog_name, "router_fwd", sizeof(attr.prog_name) - 1);
+  return bpfCall(BPF_PROG_LOAD, &attr);
+}
+
+/**
+ * Attach the program to an interface, it stays attached until the link fd
+ * is closed, at the latest when the process exits
+ * @return the link fd, -1 on error
+ */
+static inline int xdpAttach(int prog_fd, int ifindex, uint32_t flags) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd = prog_fd;
+  attr.link_create.target_ifindex = ifindex;
+  attr.link_create.attach_type = BPF_XDP;
+  attr.link_create.flags = flags;
+  return bpfCall(BPF_LINK_CREATE, &attr);
+}
+
+#endif
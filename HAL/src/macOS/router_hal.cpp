@@ -43,6 +43,18 @@ struct macaddr_wrap {
 std::map<std::pair<in_addr_t, int>, macaddr_wrap> arp_table;
 std::map<std::pair<in_addr_t, int>, uint64_t> arp_timer;
 
+int64_t pcap_stats_time = 0;
+
+// drops of the capture buffers, refreshed once per second
+static void updateKernelDrops() {
+  struct pcap_stat ps;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (pcap_in_handles[i] && pcap_stats(pcap_in_handles[i], &ps) == 0) {
+      HAL_StatsSetKernelDrops(i, (uint64_t)ps.ps_drop + ps.ps_ifdrop);
+    }
+  }
+}
+
 extern "C" {
 int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
   if (inited) {
@@ -126,7 +138,7 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
   char error_buffer[PCAP_ERRBUF_SIZE];
   for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
     pcap_in_handles[i] =
-        pcap_open_live(interfaces[i], BUFSIZ, 1, 1, error_buffer);
+        pcap_open_live(interfaces[i], 65536 + IP_OFFSET, 1, 1, error_buffer);
     if (pcap_in_handles[i]) {
       pcap_setnonblock(pcap_in_handles[i], 1, error_buffer);
       if (debugEnabled) {
@@ -142,7 +154,7 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
       }
     }
     pcap_out_handles[i] =
-        pcap_open_live(interfaces[i], BUFSIZ, 1, 0, error_buffer);
+        pcap_open_live(interfaces[i], 65536 + IP_OFFSET, 1, 0, error_buffer);
   }
 
   memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
@@ -268,6 +280,10 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
 
   int64_t begin = HAL_GetTicks();
   int64_t current_time = 0;
+  if (begin >= pcap_stats_time + 1000) {
+    updateKernelDrops();
+    pcap_stats_time = begin;
+  }
   // Round robin
   int current_port = 0;
   struct pcap_pkthdr hdr;
@@ -294,6 +310,7 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
       memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
       memcpy(src_mac, &packet[6], sizeof(macaddr_t));
       *if_index = current_port;
+      HAL_StatsCountRx(current_port, ip_len);
       return ip_len;
     } else if (packet && hdr.caplen >= IP_OFFSET && packet[12] == 0x08 &&
                packet[13] == 0x06) {
@@ -380,6 +397,7 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   if (pcap_inject(pcap_out_handles[if_index], eth_buffer, length + IP_OFFSET) >=
       0) {
     free(eth_buffer);
+    HAL_StatsCountTx(if_index, length);
     return 0;
   } else {
     if (debugEnabled) {
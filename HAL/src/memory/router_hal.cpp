@@ -0,0 +1,228 @@
+#include "router_hal.h"
+#include "router_hal_common.h"
+#include <stdio.h>
+
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utility>
+#include <vector>
+
+// packets are served from RAM and transmitted packets are counted,
+// and kept only if recording is enabled, so the router runs at memory speed
+
+bool inited = false;
+int debugEnabled = 0;
+in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
+macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
+
+// workaround for clang
+struct macaddr_wrap {
+  macaddr_t mac;
+};
+
+std::map<std::pair<in_addr_t, int>, macaddr_wrap> arp_table;
+
+struct memory_packet {
+  size_t offset; // in the arena it belongs to
+  size_t length;
+  int if_index;
+  macaddr_t src_mac;
+  macaddr_t dst_mac;
+};
+
+// input, all packets in one arena so that replay walks memory linearly
+std::vector<uint8_t> rx_arena;
+std::vector<memory_packet> rx_packets;
+size_t rx_next = 0;
+uint64_t rx_repeat = 0;
+
+// output
+int tx_record = 0;
+std::vector<uint8_t> tx_arena;
+std::vector<memory_packet> tx_packets;
+
+uint64_t rx_count = 0;
+uint64_t tx_count = 0;
+uint64_t tx_bytes = 0;
+
+extern "C" {
+int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  if (inited) {
+    return 0;
+  }
+  debugEnabled = debug;
+
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    // hard coded MAC
+    macaddr_t mac = {2, 3, 3, 0, 0, (uint8_t)i};
+    memcpy(interface_mac[i], mac, sizeof(macaddr_t));
+    memcpy(&arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)],
+           interface_mac[i], sizeof(macaddr_t));
+  }
+
+  memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
+
+  inited = true;
+  return 0;
+}
+
+uint64_t HAL_GetTicks() {
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
+}
+
+int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  if ((ip & 0xe0) == 0xe0) {
+    uint8_t multicasting_mac[6] = {0x01, 0, 0x5e, (uint8_t)((ip >> 8) & 0x7f), (uint8_t)(ip >> 16), (uint8_t)(ip >> 24)};
+    memcpy(o_mac, multicasting_mac, sizeof(macaddr_t));
+    return 0;
+  }
+
+  auto it = arp_table.find(std::pair<in_addr_t, int>(ip, if_index));
+  if (it != arp_table.end()) {
+    memcpy(o_mac, &it->second, sizeof(macaddr_t));
+    return 0;
+  }
+  // nobody answers ARP requests here, use HAL_MemoryAddArp instead
+  if (debugEnabled) {
+    struct in_addr addr;
+    addr.s_addr = ip;
+    fprintf(stderr, "HAL_ArpGetMacAddress: no MAC address for %s\n",
+            inet_ntoa(addr));
+  }
+  return HAL_ERR_IP_NOT_EXIST;
+}
+
+int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  memcpy(o_mac, interface_mac[if_index], sizeof(macaddr_t));
+  return 0;
+}
+
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (if_index == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  // never waits, the timeout is irrelevant
+  while (true) {
+    if (rx_next == rx_packets.size()) {
+      if (rx_repeat == 0 || rx_packets.empty()) {
+        return HAL_ERR_EOF;
+      }
+      rx_repeat--;
+      rx_next = 0;
+    }
+    const memory_packet &p = rx_packets[rx_next++];
+    if ((if_index_mask & (1 << p.if_index)) == 0) {
+      continue;
+    }
+    size_t real_length = length > p.length ? p.length : length;
+    memcpy(buffer, &rx_arena[p.offset], real_length);
+    memcpy(dst_mac, p.dst_mac, sizeof(macaddr_t));
+    memcpy(src_mac, p.src_mac, sizeof(macaddr_t));
+    *if_index = p.if_index;
+    rx_count++;
+    HAL_StatsCountRx(p.if_index, p.length);
+    return p.length;
+  }
+}
+
+int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                     macaddr_t dst_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  tx_count++;
+  tx_bytes += length;
+  HAL_StatsCountTx(if_index, length);
+  if (tx_record) {
+    memory_packet p;
+    p.offset = tx_arena.size();
+    p.length = length;
+    p.if_index = if_index;
+    memcpy(p.src_mac, interface_mac[if_index], sizeof(macaddr_t));
+    memcpy(p.dst_mac, dst_mac, sizeof(macaddr_t));
+    tx_arena.insert(tx_arena.end(), buffer, buffer + length);
+    tx_packets.push_back(p);
+  }
+  return 0;
+}
+
+int HAL_MemoryEnqueue(int if_index, const uint8_t *buffer, size_t length,
+                      const macaddr_t src_mac, const macaddr_t dst_mac) {
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || buffer == NULL) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  memory_packet p;
+  p.offset = rx_arena.size();
+  p.length = length;
+  p.if_index = if_index;
+  memcpy(p.src_mac, src_mac, sizeof(macaddr_t));
+  memcpy(p.dst_mac, dst_mac, sizeof(macaddr_t));
+  rx_arena.insert(rx_arena.end(), buffer, buffer + length);
+  rx_packets.push_back(p);
+  return 0;
+}
+
+void HAL_MemorySetRepeat(uint64_t times) {
+  rx_repeat = times;
+  rx_next = 0;
+}
+
+int HAL_MemoryAddArp(int if_index, in_addr_t ip, const macaddr_t mac) {
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  memcpy(&arp_table[std::pair<in_addr_t, int>(ip, if_index)], mac,
+         sizeof(macaddr_t));
+  return 0;
+}
+
+void HAL_MemorySetRecord(int record) { tx_record = record; }
+
+int HAL_MemoryGetSent(size_t index, uint8_t *buffer, size_t length,
+                      int *if_index, macaddr_t dst_mac) {
+  if (index >= tx_packets.size()) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  const memory_packet &p = tx_packets[index];
+  size_t real_length = length > p.length ? p.length : length;
+  memcpy(buffer, &tx_arena[p.offset], real_length);
+  memcpy(dst_mac, p.dst_mac, sizeof(macaddr_t));
+  *if_index = p.if_index;
+  return p.length;
+}
+
+void HAL_MemoryGetCounters(uint64_t *o_rx_packets, uint64_t *o_tx_packets,
+                           uint64_t *o_tx_bytes) {
+  *o_rx_packets = rx_count;
+  *o_tx_packets = tx_count;
+  *o_tx_bytes = tx_bytes;
+}
+}
@@ -0,0 +1,580 @@
+#include "router_hal.h"
+// HAL_GetInterfaceMtu is implemented here
+#define HAL_INTERFACE_MTU
+#include "router_hal_common.h"
+#include <stdio.h>
+
+#include <errno.h>
+#include <ifaddrs.h>
+#include <linux/if_packet.h>
+#include <map>
+#include <net/if.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+
+#ifndef HAL_PLATFORM_TESTING
+#include "../linux/platform/standard.h"
+#else
+#include "../linux/platform/testing.h"
+#endif
+#include "../linux/packet.h"
+
+// The Linux backend without libpcap: one raw AF_PACKET socket per interface,
+// whose filter (see ../linux/packet.h) passes only what the router handles
+// With PACKET_VNET_HDR, packets coalesced by GRO or left unsegmented by a
+// local sender (veth) arrive whole, up to 64 KiB, and are forwarded whole:
+// GSO segments them after the one lookup and one send of the router
+
+const int IP_OFFSET = 14;
+const size_t VNET_SIZE = sizeof(struct packet_vnet_hdr);
+const size_t FRAME_SIZE = VNET_SIZE + IP_OFFSET + 65536;
+
+bool inited = false;
+int debugEnabled = 0;
+in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
+macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
+
+int packet_fds[N_IFACE_ON_BOARD] = {-1, -1, -1, -1};
+bool vnet_enabled[N_IFACE_ON_BOARD];
+int interface_mtu[N_IFACE_ON_BOARD];
+uint64_t kernel_drops[N_IFACE_ON_BOARD];
+int64_t stats_time = 0;
+
+std::map<std::pair<in_addr_t, int>, macaddr_t> arp_table;
+std::map<std::pair<in_addr_t, int>, uint64_t> arp_timer;
+
+uint8_t frame[FRAME_SIZE];
+uint8_t segment[FRAME_SIZE];
+
+// GSO of the IPv4 packet received last, and the fields that recognize it
+// when the router forwards it: total length, id and addresses
+bool rx_offload = false;
+struct packet_vnet_hdr rx_vnet;
+uint8_t rx_key[12];
+
+// one frame, after a virtio_net_hdr when the socket expects one
+static int sendFrame(int if_index, const struct packet_vnet_hdr *vnet,
+                     const void *header, size_t header_len, const void *data,
+                     size_t length) {
+  struct packet_vnet_hdr none;
+  memset(&none, 0, sizeof(none));
+  struct iovec iov[3] = {{(void *)(vnet ? vnet : &none), VNET_SIZE},
+                         {(void *)header, header_len},
+                         {(void *)data, length}};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = vnet_enabled[if_index] ? iov : &iov[1];
+  msg.msg_iovlen = vnet_enabled[if_index] ? 3 : 2;
+  return sendmsg(packet_fds[if_index], &msg, 0);
+}
+
+static uint64_t csumAdd(uint64_t sum, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i + 1 < len; i += 2) {
+    sum += (data[i] << 8) | data[i + 1];
+  }
+  if (len & 1) {
+    sum += data[len - 1] << 8;
+  }
+  return sum;
+}
+
+static uint16_t csumFold(uint64_t sum) {
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return sum;
+}
+
+// pseudo header of TCP and UDP
+static uint64_t csumPseudo(const uint8_t *ip, size_t l4_len) {
+  return csumAdd(0, &ip[12], 8) + ip[9] + l4_len;
+}
+
+static void offloadKey(const uint8_t *ip, uint8_t key[12]) {
+  memcpy(key, &ip[2], 4);
+  memcpy(&key[4], &ip[12], 8);
+}
+
+// fill in a checksum left partial by a local sender (veth)
+static void completeChecksum(uint8_t *buffer, size_t length,
+                             const struct packet_vnet_hdr *hdr) {
+  size_t start = hdr->csum_start - IP_OFFSET;
+  size_t field = start + hdr->csum_offset;
+  if (start >= length || field + 2 > length) {
+    return;
+  }
+  uint16_t sum = ~csumFold(csumAdd(0, &buffer[start], length - start));
+  buffer[field] = sum >> 8;
+  buffer[field + 1] = sum;
+}
+
+// Only a super-packet keeps a partial checksum, for GSO to fill in: the router
+// may fragment or answer any other packet
+static void offloadReceived(const struct packet_vnet_hdr *hdr, uint8_t *ip,
+                            size_t ip_len) {
+  rx_offload = ip_len >= 20 && hdr->gso_type != VIRTIO_NET_HDR_GSO_NONE;
+  if (rx_offload) {
+    rx_vnet = *hdr;
+    offloadKey(ip, rx_key);
+  } else if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+    completeChecksum(ip, ip_len, hdr);
+  }
+}
+
+// header length of an unfragmented TCP or UDP packet, 0 for anything else
+static size_t transportHeader(const uint8_t *ip, size_t length) {
+  size_t ihl = (ip[0] & 0xf) * 4;
+  if ((ip[6] & 0x3f) != 0 || ip[7] != 0) {
+    return 0;
+  }
+  if (ip[9] == IPPROTO_TCP && length >= ihl + 20) {
+    return ihl + (ip[ihl + 12] >> 4) * 4;
+  } else if (ip[9] == IPPROTO_UDP && length >= ihl + 8) {
+    return ihl + 8;
+  }
+  return 0;
+}
+
+/**
+ * The virtio_net_hdr of a packet to send: the offloads of the packet received
+ * last carry over when this is that packet forwarded, and a TCP packet larger
+ * than the MTU is given GSO with segments that fit
+ * @return false when the packet can not leave as one frame
+ */
+static bool offloadHeader(int if_index, uint8_t *buffer, size_t length,
+                          struct packet_vnet_hdr *hdr) {
+  memset(hdr, 0, sizeof(*hdr));
+  if (length < 20) {
+    return true;
+  }
+  uint8_t key[12];
+  offloadKey(buffer, key);
+  if (rx_offload && memcmp(key, rx_key, sizeof(key)) == 0) {
+    *hdr = rx_vnet;
+    hdr->flags &= VIRTIO_NET_HDR_F_NEEDS_CSUM;
+  }
+  if (length <= (size_t)interface_mtu[if_index] &&
+      hdr->gso_type == VIRTIO_NET_HDR_GSO_NONE) {
+    return true;
+  }
+  size_t ihl = (buffer[0] & 0xf) * 4;
+  size_t hlen = transportHeader(buffer, length);
+  if (hlen == 0 || (hdr->gso_type == VIRTIO_NET_HDR_GSO_NONE &&
+                    buffer[9] != IPPROTO_TCP)) {
+    return false;
+  }
+  if (hdr->gso_type == VIRTIO_NET_HDR_GSO_NONE) {
+    hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+  }
+  // segments fit the egress MTU, even if the ingress one was larger
+  size_t mss = interface_mtu[if_index] - hlen;
+  if (hdr->gso_size == 0 || hdr->gso_size > mss) {
+    hdr->gso_size = mss;
+  }
+  hdr->hdr_len = IP_OFFSET + hlen;
+  if (!(hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+    // GSO fills in the checksums from the one of the pseudo header
+    hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr->csum_start = IP_OFFSET + ihl;
+    hdr->csum_offset = buffer[9] == IPPROTO_TCP ? 16 : 6;
+    uint16_t pseudo = csumFold(csumPseudo(buffer, length - ihl));
+    buffer[ihl + hdr->csum_offset] = pseudo >> 8;
+    buffer[ihl + hdr->csum_offset + 1] = pseudo;
+  }
+  return true;
+}
+
+// segment a TCP packet in software, as GSO would
+static int segmentTcp(int if_index, const uint8_t *header, uint8_t *buffer,
+                      size_t length, size_t mss) {
+  size_t ihl = (buffer[0] & 0xf) * 4;
+  size_t hlen = transportHeader(buffer, length);
+  if (hlen == 0 || buffer[9] != IPPROTO_TCP || mss == 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  uint16_t id = (buffer[4] << 8) | buffer[5];
+  uint32_t seq;
+  memcpy(&seq, &buffer[ihl + 4], sizeof(seq));
+  seq = ntohl(seq);
+  uint8_t flags = buffer[ihl + 13];
+  for (size_t off = hlen, k = 0; off < length; off += mss, k++) {
+    size_t n = length - off < mss ? length - off : mss;
+    size_t len = hlen + n;
+    memcpy(segment, buffer, hlen);
+    memcpy(&segment[hlen], &buffer[off], n);
+    segment[2] = len >> 8;
+    segment[3] = len;
+    segment[4] = (id + k) >> 8;
+    segment[5] = id + k;
+    segment[10] = segment[11] = 0;
+    uint16_t sum = ~csumFold(csumAdd(0, segment, ihl));
+    segment[10] = sum >> 8;
+    segment[11] = sum;
+    uint32_t s = htonl(seq + (off - hlen));
+    memcpy(&segment[ihl + 4], &s, sizeof(s));
+    // FIN and PSH on the last segment, CWR on the first
+    segment[ihl + 13] = flags & ~(off + n < length ? 0x09 : 0) & ~(k > 0 ? 0x80 : 0);
+    segment[ihl + 16] = segment[ihl + 17] = 0;
+    sum = ~csumFold(csumAdd(csumPseudo(segment, len - ihl), &segment[ihl], len - ihl));
+    segment[ihl + 16] = sum >> 8;
+    segment[ihl + 17] = sum;
+    if (sendFrame(if_index, NULL, header, IP_OFFSET, segment, len) < 0) {
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_SendIPPacket: sendmsg failed with %s\n",
+                strerror(errno));
+      }
+      return HAL_ERR_UNKNOWN;
+    }
+    HAL_StatsCountTx(if_index, len);
+  }
+  return 0;
+}
+
+static void sendArp(int if_index, const uint8_t *dst_mac, uint8_t opcode,
+                    const uint8_t *target_mac, in_addr_t target_ip) {
+  uint8_t buffer[64] = {0};
+  memcpy(buffer, dst_mac, sizeof(macaddr_t));
+  memcpy(&buffer[6], interface_mac[if_index], sizeof(macaddr_t));
+  // ARP
+  buffer[12] = 0x08;
+  buffer[13] = 0x06;
+  // hardware type
+  buffer[15] = 0x01;
+  // protocol type
+  buffer[16] = 0x08;
+  // hardware size
+  buffer[18] = 0x06;
+  // protocol size
+  buffer[19] = 0x04;
+  // opcode
+  buffer[21] = opcode;
+  // sender
+  memcpy(&buffer[22], interface_mac[if_index], sizeof(macaddr_t));
+  memcpy(&buffer[28], &interface_addrs[if_index], sizeof(in_addr_t));
+  // target
+  memcpy(&buffer[32], target_mac, sizeof(macaddr_t));
+  memcpy(&buffer[38], &target_ip, sizeof(in_addr_t));
+  sendFrame(if_index, NULL, buffer, IP_OFFSET, &buffer[IP_OFFSET],
+            sizeof(buffer) - IP_OFFSET);
+}
+
+// learn from and answer an ARP packet
+static void handleArp(int port, const uint8_t *packet) {
+  macaddr_t mac;
+  memcpy(mac, &packet[22], sizeof(macaddr_t));
+  in_addr_t ip;
+  memcpy(&ip, &packet[28], sizeof(in_addr_t));
+  memcpy(arp_table[std::pair<in_addr_t, int>(ip, port)], mac,
+         sizeof(macaddr_t));
+  if (debugEnabled) {
+    fprintf(stderr, "HAL_ReceiveIPPacket: learned MAC address of %s\n",
+            inet_ntoa(in_addr{ip}));
+  }
+  in_addr_t dst_ip;
+  memcpy(&dst_ip, &packet[38], sizeof(in_addr_t));
+  // ask me: reply
+  if (dst_ip == interface_addrs[port] && packet[21] == 0x01) {
+    sendArp(port, &packet[6], 0x02, &packet[22], ip);
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_ReceiveIPPacket: replied ARP to %s\n",
+              inet_ntoa(in_addr{ip}));
+    }
+  }
+}
+
+// drops of the sockets, refreshed once per second; reading them resets them
+static void updateKernelDrops() {
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    struct tpacket_stats st;
+    socklen_t len = sizeof(st);
+    if (packet_fds[i] >= 0 &&
+        getsockopt(packet_fds[i], SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+      kernel_drops[i] += st.tp_drops;
+      HAL_StatsSetKernelDrops(i, kernel_drops[i]);
+    }
+  }
+}
+
+extern "C" {
+int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  if (inited) {
+    return 0;
+  }
+  debugEnabled = debug;
+
+  // find matching interfaces and get their MAC address
+  struct ifaddrs *ifaddr, *ifa;
+  if (getifaddrs(&ifaddr) < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_Init: getifaddrs failed with %s\n", strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+
+  for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr == NULL)
+      continue;
+    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+      if (ifa->ifa_addr->sa_family == AF_PACKET &&
+          strcmp(ifa->ifa_name, interfaces[i]) == 0) {
+        // found
+        memcpy(interface_mac[i],
+               ((struct sockaddr_ll *)ifa->ifa_addr)->sll_addr,
+               sizeof(macaddr_t));
+        memcpy(arp_table[std::pair<in_addr_t, int>(if_addrs[i], i)],
+               interface_mac[i], sizeof(macaddr_t));
+        if (debugEnabled) {
+          fprintf(stderr, "HAL_Init: found MAC addr of interface %s\n",
+                  interfaces[i]);
+        }
+        break;
+      }
+    }
+  }
+  freeifaddrs(ifaddr);
+
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    packet_fds[i] = packetOpen(interfaces[i], interface_mac[i], SOCK_NONBLOCK);
+    interface_mtu[i] = 1500;
+    if (packet_fds[i] >= 0) {
+      vnet_enabled[i] = packetEnableVnet(packet_fds[i]);
+      HAL_RxPolicySocket(packet_fds[i]);
+      interface_mtu[i] = packetMtu(packet_fds[i], interfaces[i]);
+    }
+    if (debugEnabled) {
+      if (packet_fds[i] >= 0) {
+        fprintf(stderr, "HAL_Init: packet socket enabled for %s%s\n",
+                interfaces[i], vnet_enabled[i] ? ", with GSO" : "");
+      } else {
+        fprintf(stderr,
+                "HAL_Init: packet socket disabled for %s, either the interface "
+                "does not exist or permission is denied\n",
+                interfaces[i]);
+      }
+    }
+  }
+
+  memcpy(interface_addrs, if_addrs, sizeof(interface_addrs));
+
+  inited = true;
+  // send igmp to join RIP multicast group
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (packet_fds[i] >= 0) {
+      HAL_JoinIGMPGroup(i, if_addrs[i]);
+      if (debugEnabled) {
+        fprintf(stderr, "HAL_Init: Joining RIP multicast group 224.0.0.9 for %s\n",
+                interfaces[i]);
+      }
+    }
+  }
+  return 0;
+}
+
+uint64_t HAL_GetTicks() {
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  // millisecond
+  return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
+}
+
+int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  // handle multicast
+  if ((ip & 0xe0) == 0xe0) {
+    uint8_t multicasting_mac[6] = {0x01, 0, 0x5e, (uint8_t)((ip >> 8) & 0x7f), (uint8_t)(ip >> 16), (uint8_t)(ip >> 24)};
+    memcpy(o_mac, multicasting_mac, sizeof(macaddr_t));
+    return 0;
+  }
+
+  // lookup arp table
+  auto it = arp_table.find(std::pair<in_addr_t, int>(ip, if_index));
+  if (it != arp_table.end()) {
+    memcpy(o_mac, it->second, sizeof(macaddr_t));
+    return 0;
+  } else if (packet_fds[if_index] >= 0 &&
+             arp_timer[std::pair<in_addr_t, int>(ip, if_index)] + 1000 <
+                 HAL_GetTicks()) {
+    // not found, send arp request
+    // rate limit arp request by 1 req/s
+    arp_timer[std::pair<in_addr_t, int>(ip, if_index)] = HAL_GetTicks();
+    if (debugEnabled) {
+      fprintf(
+          stderr,
+          "HAL_ArpGetMacAddress: asking for ip address %s with arp request\n",
+          inet_ntoa(in_addr{ip}));
+    }
+    static const uint8_t broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    static const uint8_t unknown[6] = {0};
+    sendArp(if_index, broadcast, 0x01, unknown, ip);
+  }
+  return HAL_ERR_IP_NOT_EXIST;
+}
+
+int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  memcpy(o_mac, interface_mac[if_index], sizeof(macaddr_t));
+  return 0;
+}
+
+int HAL_GetInterfaceMtu(int if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  return interface_mtu[if_index];
+}
+
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (if_index == NULL) || (buffer == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  struct pollfd fds[N_IFACE_ON_BOARD];
+  int ports[N_IFACE_ON_BOARD];
+  int n = 0;
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    if (packet_fds[i] >= 0 && (if_index_mask & (1 << i))) {
+      fds[n].fd = packet_fds[i];
+      fds[n].events = POLLIN;
+      ports[n++] = i;
+    }
+  }
+  if (n == 0) {
+    if (debugEnabled) {
+      fprintf(stderr,
+              "HAL_ReceiveIPPacket: no viable interfaces open for capture\n");
+    }
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  int64_t begin = HAL_GetTicks();
+  if (begin >= stats_time + 1000) {
+    updateKernelDrops();
+    stats_time = begin;
+  }
+  // Round robin, starting after the interface of the last packet
+  static int next = 0;
+  while (true) {
+    bool idle = true;
+    for (int k = 0; k < n; k++) {
+      int j = (next + k) % n;
+      int port = ports[j];
+      ssize_t len = recv(fds[j].fd, frame, sizeof(frame), 0);
+      size_t vnet = vnet_enabled[port] ? VNET_SIZE : 0;
+      if (len < (ssize_t)vnet) {
+        continue;
+      }
+      idle = false;
+      uint8_t *eth = &frame[vnet];
+      len -= vnet;
+      // the filter passes IPv4 and ARP only
+      if (len >= IP_OFFSET && eth[12] == 0x08 && eth[13] == 0x00) {
+        // IPv4
+        size_t ip_len = len - IP_OFFSET;
+        size_t real_length = length > ip_len ? ip_len : length;
+        memcpy(buffer, &eth[IP_OFFSET], real_length);
+        memcpy(dst_mac, &eth[0], sizeof(macaddr_t));
+        memcpy(src_mac, &eth[6], sizeof(macaddr_t));
+        if (vnet && real_length == ip_len) {
+          offloadReceived((struct packet_vnet_hdr *)frame, buffer, ip_len);
+        }
+        *if_index = port;
+        next = (j + 1) % n;
+        HAL_StatsCountRx(port, ip_len);
+        HAL_RxPolicyPacket();
+        return ip_len;
+      } else if (len >= 42) {
+        // ARP
+        handleArp(port, eth);
+      }
+    }
+    if (!idle) {
+      continue;
+    }
+
+    int64_t wait = -1;
+    if (timeout != -1) {
+      wait = begin + timeout - (int64_t)HAL_GetTicks();
+      if (wait <= 0) {
+        return 0;
+      }
+    }
+    // while spinning, the sockets are read again without a wait
+    int64_t spin = HAL_RxPolicyWait(wait);
+    if (spin != 0 && poll(fds, n, spin) == 0 && spin == wait) {
+      return 0;
+    }
+  }
+}
+
+int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                     macaddr_t dst_mac) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (packet_fds[if_index] < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  uint8_t header[IP_OFFSET];
+  memcpy(header, dst_mac, sizeof(macaddr_t));
+  memcpy(&header[6], interface_mac[if_index], sizeof(macaddr_t));
+  // IPv4
+  header[12] = 0x08;
+  header[13] = 0x00;
+  struct packet_vnet_hdr vnet;
+  if (!offloadHeader(if_index, buffer, length, &vnet)) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_SendIPPacket: %zu bytes exceed the MTU of %s\n",
+              length, interfaces[if_index]);
+    }
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (vnet.gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+    if (!vnet_enabled[if_index] ||
+        sendFrame(if_index, &vnet, header, sizeof(header), buffer, length) < 0) {
+      // no GSO on this socket, or not for this packet
+      return segmentTcp(if_index, header, buffer, length, vnet.gso_size);
+    }
+    HAL_StatsCountTx(if_index, length);
+    return 0;
+  }
+  // header and packet gathered, without copying the packet
+  if (sendFrame(if_index, &vnet, header, sizeof(header), buffer, length) < 0) {
+    if (debugEnabled) {
+      fprintf(stderr, "HAL_SendIPPacket: sendmsg failed with %s\n",
+              strerror(errno));
+    }
+    return HAL_ERR_UNKNOWN;
+  }
+  HAL_StatsCountTx(if_index, length);
+  return 0;
+}
+}
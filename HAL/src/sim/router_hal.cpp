@@ -0,0 +1,321 @@
+#include "router_hal.h"
+// HAL_SetLinkCallback is implemented here
+#define HAL_LINK_EVENTS
+#include "router_hal_common.h"
+#include <stdio.h>
+
+#include <queue>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+// many routers in one process, joined by point-to-point virtual links
+// all calls act on the router chosen by HAL_SimSelect,
+// and time only moves when HAL_SimSetTicks is called
+
+struct sim_packet {
+  uint64_t time; // when it arrives
+  uint64_t seq; // keeps packets arriving at the same time in order
+  int if_index;
+  macaddr_t src_mac;
+  macaddr_t dst_mac;
+  std::vector<uint8_t> data;
+};
+
+struct sim_packet_later {
+  bool operator()(const sim_packet &a, const sim_packet &b) const {
+    return a.time > b.time || (a.time == b.time && a.seq > b.seq);
+  }
+};
+
+struct sim_router {
+  bool inited;
+  int debugEnabled;
+  in_addr_t interface_addrs[N_IFACE_ON_BOARD];
+  macaddr_t interface_mac[N_IFACE_ON_BOARD];
+  int link[N_IFACE_ON_BOARD]; // -1 if not connected
+  std::priority_queue<sim_packet, std::vector<sim_packet>, sim_packet_later> rx_queue;
+  // link changes not yet told to the callback, as (if_index, up)
+  std::vector<std::pair<int, int>> link_events;
+  uint64_t rx_count;
+  uint64_t tx_count;
+};
+
+struct sim_link {
+  int router[2];
+  int if_index[2];
+  uint64_t latency;
+  double loss;
+  bool up;
+};
+
+std::vector<sim_router> routers;
+std::vector<sim_link> links;
+sim_router *current = NULL;
+uint64_t ticks = 0;
+uint64_t next_seq = 0;
+// shared by the routers, which all run the same code
+HAL_LinkCallback link_callback = NULL;
+// xorshift, independent from rand() used by the routers
+uint64_t rng_state = 88172645463325252ull;
+
+static double nextRandom() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// the router and interface at the other end of the link of if_index
+static bool peerOf(const sim_router &r, int if_index, int *peer, int *peer_if) {
+  int l = r.link[if_index];
+  if (l < 0) {
+    return false;
+  }
+  const sim_link &link = links[l];
+  int side = &routers[link.router[0]] == &r && link.if_index[0] == if_index ? 1 : 0;
+  *peer = link.router[side];
+  *peer_if = link.if_index[side];
+  return true;
+}
+
+extern "C" {
+int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
+  if (!current) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  if (current->inited) {
+    return 0;
+  }
+  current->debugEnabled = debug;
+  memcpy(current->interface_addrs, if_addrs, sizeof(current->interface_addrs));
+  current->inited = true;
+  return 0;
+}
+
+uint64_t HAL_GetTicks() { return ticks; }
+
+int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
+  if (!current || !current->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  if ((ip & 0xe0) == 0xe0) {
+    uint8_t multicasting_mac[6] = {0x01, 0, 0x5e, (uint8_t)((ip >> 8) & 0x7f), (uint8_t)(ip >> 16), (uint8_t)(ip >> 24)};
+    memcpy(o_mac, multicasting_mac, sizeof(macaddr_t));
+    return 0;
+  }
+
+  // links are point-to-point, the only neighbor is the peer
+  int peer, peer_if;
+  if (peerOf(*current, if_index, &peer, &peer_if) &&
+      routers[peer].interface_addrs[peer_if] == ip) {
+    memcpy(o_mac, routers[peer].interface_mac[peer_if], sizeof(macaddr_t));
+    return 0;
+  }
+  return HAL_ERR_IP_NOT_EXIST;
+}
+
+int HAL_GetInterfaceMacAddress(int if_index, macaddr_t o_mac) {
+  if (!current || !current->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+
+  memcpy(o_mac, current->interface_mac[if_index], sizeof(macaddr_t));
+  return 0;
+}
+
+int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
+                        macaddr_t src_mac, macaddr_t dst_mac, int64_t timeout,
+                        int *if_index) {
+  if (!current || !current->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if ((if_index_mask & ((1 << N_IFACE_ON_BOARD) - 1)) == 0 ||
+      (timeout < 0 && timeout != -1) || (if_index == NULL)) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+
+  // the callback may send, which never queues link events
+  std::vector<std::pair<int, int>> events;
+  events.swap(current->link_events);
+  for (size_t i = 0; i < events.size(); i++) {
+    link_callback(events[i].first, events[i].second);
+  }
+
+  // virtual time doesn't pass while waiting, so never wait
+  while (!current->rx_queue.empty() && current->rx_queue.top().time <= ticks) {
+    const sim_packet &p = current->rx_queue.top();
+    if ((if_index_mask & (1 << p.if_index)) == 0) {
+      current->rx_queue.pop();
+      continue;
+    }
+    size_t real_length = length > p.data.size() ? p.data.size() : length;
+    memcpy(buffer, p.data.data(), real_length);
+    memcpy(dst_mac, p.dst_mac, sizeof(macaddr_t));
+    memcpy(src_mac, p.src_mac, sizeof(macaddr_t));
+    *if_index = p.if_index;
+    int res = p.data.size();
+    current->rx_queue.pop();
+    current->rx_count++;
+    HAL_StatsCountRx(*if_index, res);
+    return res;
+  }
+  return 0;
+}
+
+int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
+                     macaddr_t dst_mac) {
+  if (!current || !current->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  current->tx_count++;
+  HAL_StatsCountTx(if_index, length);
+  int peer, peer_if;
+  if (!peerOf(*current, if_index, &peer, &peer_if)) {
+    return 0;
+  }
+  const sim_link &link = links[current->link[if_index]];
+  if (!link.up || (link.loss > 0 && nextRandom() < link.loss)) {
+    return 0;
+  }
+  sim_packet p;
+  p.time = ticks + link.latency;
+  p.seq = next_seq++;
+  p.if_index = peer_if;
+  memcpy(p.src_mac, current->interface_mac[if_index], sizeof(macaddr_t));
+  memcpy(p.dst_mac, dst_mac, sizeof(macaddr_t));
+  p.data.assign(buffer, buffer + length);
+  routers[peer].rx_queue.push(p);
+  return 0;
+}
+
+int HAL_SetLinkCallback(HAL_LinkCallback callback) {
+  if (!current || !current->inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  link_callback = callback;
+  if (!callback) {
+    for (size_t i = 0; i < routers.size(); i++) {
+      routers[i].link_events.clear();
+    }
+  }
+  return 0;
+}
+
+int HAL_SimCreateRouter() {
+  sim_router r;
+  r.inited = false;
+  r.debugEnabled = 0;
+  int id = routers.size();
+  for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
+    r.interface_addrs[i] = 0;
+    macaddr_t mac = {2, 0x53, (uint8_t)(id >> 16), (uint8_t)(id >> 8),
+                     (uint8_t)id, (uint8_t)i};
+    memcpy(r.interface_mac[i], mac, sizeof(macaddr_t));
+    r.link[i] = -1;
+  }
+  r.rx_count = r.tx_count = 0;
+  routers.push_back(r);
+  // push_back may have moved the routers
+  current = NULL;
+  return id;
+}
+
+int HAL_SimSelect(int router) {
+  if (router < 0 || router >= (int)routers.size()) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  current = &routers[router];
+  return 0;
+}
+
+int HAL_SimConnect(int router1, int if_index1, int router2, int if_index2,
+                   uint64_t latency, double loss) {
+  int ends[2][2] = {{router1, if_index1}, {router2, if_index2}};
+  for (int i = 0; i < 2; i++) {
+    if (ends[i][0] < 0 || ends[i][0] >= (int)routers.size() ||
+        ends[i][1] < 0 || ends[i][1] >= N_IFACE_ON_BOARD ||
+        routers[ends[i][0]].link[ends[i][1]] >= 0) {
+      return HAL_ERR_INVALID_PARAMETER;
+    }
+  }
+  if (router1 == router2 && if_index1 == if_index2) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  sim_link link;
+  for (int i = 0; i < 2; i++) {
+    link.router[i] = ends[i][0];
+    link.if_index[i] = ends[i][1];
+  }
+  link.latency = latency;
+  link.loss = loss;
+  link.up = true;
+  int id = links.size();
+  links.push_back(link);
+  routers[router1].link[if_index1] = id;
+  routers[router2].link[if_index2] = id;
+  return id;
+}
+
+int HAL_SimSetLinkUp(int link, int up) {
+  if (link < 0 || link >= (int)links.size()) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  sim_link &l = links[link];
+  if (l.up == (up != 0)) {
+    return 0;
+  }
+  l.up = up != 0;
+  for (int i = 0; i < 2 && link_callback; i++) {
+    routers[l.router[i]].link_events.push_back(
+        std::make_pair(l.if_index[i], l.up ? 1 : 0));
+  }
+  return 0;
+}
+
+int HAL_SimSetLinkLoss(int link, double loss) {
+  if (link < 0 || link >= (int)links.size() || loss < 0 || loss > 1) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  links[link].loss = loss;
+  return 0;
+}
+
+void HAL_SimSetTicks(uint64_t now) { ticks = now; }
+
+uint64_t HAL_SimNextArrival(int router) {
+  if (router < 0 || router >= (int)routers.size()) {
+    return UINT64_MAX;
+  }
+  // link events are due now
+  if (!routers[router].link_events.empty()) {
+    return ticks;
+  }
+  if (routers[router].rx_queue.empty()) {
+    return UINT64_MAX;
+  }
+  return routers[router].rx_queue.top().time;
+}
+
+void HAL_SimGetCounters(int router, uint64_t *o_rx_packets,
+                        uint64_t *o_tx_packets) {
+  *o_rx_packets = *o_tx_packets = 0;
+  if (router < 0 || router >= (int)routers.size()) {
+    return;
+  }
+  *o_rx_packets = routers[router].rx_count;
+  *o_tx_packets = routers[router].tx_count;
+}
+}
@@ -1,27 +1,149 @@
 #include "router_hal.h"
+#include "router_hal_common.h"
 #include <stdio.h>
 
 #include <map>
 #include <pcap.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 #include <utility>
 
 const int IP_OFFSET = 18; // 6 + 6 + 4 + 2
 
 bool inited = false;
-bool outputInited = false;
 int debugEnabled = 0;
 in_addr_t interface_addrs[N_IFACE_ON_BOARD] = {0};
 macaddr_t interface_mac[N_IFACE_ON_BOARD] = {0};
 
 // input
+// a regular file on stdin is mapped and parsed in place,
+// anything else (e.g. a pipe) is read through libpcap
 pcap_t *pcap_handle;
+const uint8_t *map_base = NULL;
+size_t map_size = 0;
+size_t map_offset = 0;
+bool map_swapped = false; // written on a host of the other byte order
+bool map_nsec = false; // timestamps in nanoseconds instead of microseconds
+
+// timestamp of the last packet read, in microseconds
+uint64_t packet_time = 0;
+
+// output, pcap records are built in place in a large buffer
+// and written to stdout when it is full, at EOF and at exit
+const size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+uint8_t *output_buffer = NULL;
+size_t output_used = 0;
+
+static uint32_t mapRead32(size_t offset) {
+  uint32_t value;
+  memcpy(&value, map_base + offset, sizeof(value));
+  return map_swapped ? __builtin_bswap32(value) : value;
+}
+
+// map stdin if it is a regular file with a pcap header of Ethernet
+static bool mapInput() {
+  struct stat st;
+  if (fstat(STDIN_FILENO, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size < 24) {
+    return false;
+  }
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+  map_base = (const uint8_t *)base;
+  map_size = st.st_size;
+  uint32_t magic;
+  memcpy(&magic, map_base, sizeof(magic));
+  map_swapped = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+  map_nsec = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+  if ((magic != 0xa1b2c3d4 && magic != 0xa1b23c4d && !map_swapped) ||
+      mapRead32(20) != DLT_EN10MB) {
+    munmap(base, map_size);
+    map_base = NULL;
+    return false;
+  }
+  madvise(base, map_size, MADV_SEQUENTIAL);
+  map_offset = 24;
+  return true;
+}
+
+/**
+ * Read the next frame, which stays valid until the next call
+ * @return 1 on success, 0 to retry, PCAP_ERROR_BREAK at the end
+ */
+static int readFrame(const uint8_t **packet, uint32_t *caplen) {
+  if (!map_base) {
+    struct pcap_pkthdr *hdr;
+    int res = pcap_next_ex(pcap_handle, &hdr, packet);
+    if (res == 1) {
+      *caplen = hdr->caplen;
+      packet_time = (uint64_t)hdr->ts.tv_sec * 1000000 + hdr->ts.tv_usec;
+    }
+    return res;
+  }
+  // a truncated last record is treated as the end
+  if (map_offset + 16 > map_size) {
+    return PCAP_ERROR_BREAK;
+  }
+  uint32_t len = mapRead32(map_offset + 8);
+  if (len > map_size - map_offset - 16) {
+    return PCAP_ERROR_BREAK;
+  }
+  uint32_t frac = mapRead32(map_offset + 4);
+  packet_time = (uint64_t)mapRead32(map_offset) * 1000000 +
+                (map_nsec ? frac / 1000 : frac);
+  *packet = map_base + map_offset + 16;
+  *caplen = len;
+  map_offset += 16 + len;
+  return 1;
+}
 
-// output
-pcap_t *pcap_out_handle;
-pcap_dumper_t *pcap_dumper;
+static void flushOutput() {
+  if (output_used > 0) {
+    fwrite(output_buffer, 1, output_used, stdout);
+    output_used = 0;
+  }
+  fflush(stdout);
+}
+
+/**
+ * Append a pcap record of caplen bytes to the output
+ * @return where the frame should be written
+ */
+static uint8_t *outputRecord(size_t caplen) {
+  if (!output_buffer) {
+    output_buffer = (uint8_t *)malloc(OUTPUT_BUFFER_SIZE);
+    // global header, as written by pcap_dump_open
+    uint32_t header[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 0x40000, DLT_EN10MB};
+    memcpy(output_buffer, header, sizeof(header));
+    output_used = sizeof(header);
+    atexit(flushOutput);
+  }
+  if (output_used + 16 + caplen > OUTPUT_BUFFER_SIZE) {
+    flushOutput();
+  }
+  uint32_t record[4];
+#ifdef HAL_STDIO_VIRTUAL_CLOCK
+  uint64_t now = packet_time;
+#else
+  struct timespec tp = {0};
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  uint64_t now = (uint64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+#endif
+  record[0] = now / 1000000;
+  record[1] = now % 1000000;
+  record[2] = record[3] = caplen;
+  // an IP packet with its Ethernet header always fits after a flush
+  memcpy(output_buffer + output_used, record, sizeof(record));
+  uint8_t *frame = output_buffer + output_used + 16;
+  output_used += 16 + caplen;
+  return frame;
+}
 
 // workaround for clang
 struct macaddr_wrap {
@@ -48,8 +170,10 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
   char error_buffer[PCAP_ERRBUF_SIZE];
 
   // input
-  pcap_handle = pcap_open_offline("-", error_buffer);
-  if (!pcap_handle) {
+  if (!mapInput()) {
+    pcap_handle = pcap_open_offline("-", error_buffer);
+  }
+  if (!map_base && !pcap_handle) {
     if (debugEnabled) {
       fprintf(stderr, "pcap_open_offline failed with %s", error_buffer);
     }
@@ -63,9 +187,14 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
 }
 
 uint64_t HAL_GetTicks() {
+#ifdef HAL_STDIO_VIRTUAL_CLOCK
+  // time of the capture, so replay is deterministic and as fast as possible
+  return packet_time / 1000;
+#else
   struct timespec tp = {0};
   clock_gettime(CLOCK_MONOTONIC, &tp);
   return (uint64_t)tp.tv_sec * 1000 + (uint64_t)tp.tv_nsec / 1000000;
+#endif
 }
 
 int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
@@ -128,21 +257,7 @@ int HAL_ArpGetMacAddress(int if_index, in_addr_t ip, macaddr_t o_mac) {
     // target
     memcpy(&buffer[42], &ip, sizeof(in_addr_t));
 
-    struct pcap_pkthdr header;
-    header.caplen = header.len = sizeof(buffer);
-
-    struct timespec tp = {0};
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    header.ts.tv_sec = tp.tv_sec;
-    header.ts.tv_usec = tp.tv_nsec / 1000;
-
-    if (!outputInited) {
-      // output
-      pcap_out_handle = pcap_open_dead(DLT_EN10MB, 0x40000);
-      pcap_dumper = pcap_dump_open(pcap_out_handle, "-");
-      outputInited = true;
-    }
-    pcap_dump((u_char *)pcap_dumper, &header, buffer);
+    memcpy(outputRecord(sizeof(buffer)), buffer, sizeof(buffer));
   }
   return HAL_ERR_IP_NOT_EXIST;
 }
@@ -173,11 +288,12 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
   int64_t begin = HAL_GetTicks();
   int64_t current_time = 0;
 
-  struct pcap_pkthdr *hdr;
+  uint32_t caplen;
   const u_char *packet;
   do {
-    int res = pcap_next_ex(pcap_handle, &hdr, &packet);
+    int res = readFrame(&packet, &caplen);
     if (res == PCAP_ERROR_BREAK) {
+      flushOutput();
       return HAL_ERR_EOF;
     } else if (res != 1) {
       // retry
@@ -185,19 +301,20 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
     }
 
     // check 802.1Q
-    if (packet && hdr->caplen >= IP_OFFSET && packet[12] == 0x81 &&
+    if (packet && caplen >= IP_OFFSET && packet[12] == 0x81 &&
         packet[13] == 0x00 && packet[14] == 0x00 && packet[15] >= 0 &&
         packet[15] < N_IFACE_ON_BOARD) {
       int current_port = packet[15];
       if (packet[16] == 0x08 && packet[17] == 0x00) {
         // IPv4
         // assuming len == caplen
-        size_t ip_len = hdr->caplen - IP_OFFSET;
+        size_t ip_len = caplen - IP_OFFSET;
         size_t real_length = length > ip_len ? ip_len : length;
         memcpy(buffer, &packet[IP_OFFSET], real_length);
         memcpy(dst_mac, &packet[0], sizeof(macaddr_t));
         memcpy(src_mac, &packet[6], sizeof(macaddr_t));
         *if_index = current_port;
+        HAL_StatsCountRx(current_port, ip_len);
         return ip_len;
       } else if (packet[16] == 0x08 && packet[17] == 0x06) {
         // ARP
@@ -251,21 +368,7 @@ int HAL_ReceiveIPPacket(int if_index_mask, uint8_t *buffer, size_t length,
           memcpy(&buffer[36], &packet[22], sizeof(macaddr_t));
           memcpy(&buffer[42], &packet[28], sizeof(in_addr_t));
 
-          struct pcap_pkthdr header;
-          header.caplen = header.len = sizeof(buffer);
-
-          struct timespec tp = {0};
-          clock_gettime(CLOCK_MONOTONIC, &tp);
-          header.ts.tv_sec = tp.tv_sec;
-          header.ts.tv_usec = tp.tv_nsec / 1000;
-
-          if (!outputInited) {
-            // output
-            pcap_out_handle = pcap_open_dead(DLT_EN10MB, 0x40000);
-            pcap_dumper = pcap_dump_open(pcap_out_handle, "-");
-            outputInited = true;
-          }
-          pcap_dump((u_char *)pcap_dumper, &header, buffer);
+          memcpy(outputRecord(sizeof(buffer)), buffer, sizeof(buffer));
 
           if (debugEnabled) {
             struct in_addr addr;
@@ -291,7 +394,7 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
     return HAL_ERR_INVALID_PARAMETER;
   }
-  uint8_t *eth_buffer = (uint8_t *)malloc(length + IP_OFFSET);
+  uint8_t *eth_buffer = outputRecord(length + IP_OFFSET);
   memcpy(eth_buffer, dst_mac, sizeof(macaddr_t));
   memcpy(&eth_buffer[6], interface_mac[if_index], sizeof(macaddr_t));
   // VLAN
@@ -303,22 +406,7 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   eth_buffer[16] = 0x08;
   eth_buffer[17] = 0x00;
   memcpy(&eth_buffer[IP_OFFSET], buffer, length);
-  struct pcap_pkthdr header;
-  header.caplen = header.len = length + IP_OFFSET;
-
-  struct timespec tp = {0};
-  clock_gettime(CLOCK_MONOTONIC, &tp);
-  header.ts.tv_sec = tp.tv_sec;
-  header.ts.tv_usec = tp.tv_nsec / 1000;
-
-  if (!outputInited) {
-    // output
-    pcap_out_handle = pcap_open_dead(DLT_EN10MB, 0x40000);
-    pcap_dumper = pcap_dump_open(pcap_out_handle, "-");
-    outputInited = true;
-  }
-  pcap_dump((u_char *)pcap_dumper, &header, eth_buffer);
-  free(eth_buffer);
+  HAL_StatsCountTx(if_index, length);
   return 0;
 }
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "router_hal.h"
+#include "router_stats.h"
 #include "xaxidma.h"
 #include "xaxiethernet.h"
 #include "xil_printf.h"
@@ -41,7 +42,7 @@ struct EthernetFrame {
   u16 vlanEtherType;
   u16 vlanID;
   u16 etherType;
-  u8 data[1500];
+  u8 data[HAL_MAX_MTU];
 };
 
 struct EthernetFrame rxBuffers[BD_COUNT] __attribute__((section(".physical")));
@@ -149,7 +150,8 @@ int HAL_Init(int debug, in_addr_t if_addrs[N_IFACE_ON_BOARD]) {
     xil_printf("HAL_Init: Enable Ethernet MAC\r\n");
   }
   XAxiEthernet_SetOptions(&axiEthernet, XAE_RECEIVER_ENABLE_OPTION |
-                                            XAE_TRANSMITTER_ENABLE_OPTION | XAE_VLAN_OPTION);
+                                            XAE_TRANSMITTER_ENABLE_OPTION | XAE_VLAN_OPTION |
+                                            XAE_JUMBO_OPTION);
   XAxiEthernet_SetMacAddress(&axiEthernet, interface_mac);
   XAxiEthernet_Start(&axiEthernet);
 
@@ -418,7 +420,7 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   if (!inited) {
     return HAL_ERR_CALLED_BEFORE_INIT;
   }
-  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0 || length > HAL_MAX_MTU) {
     return HAL_ERR_INVALID_PARAMETER;
   }
   XAxiDma_Bd *bd;
@@ -448,3 +450,36 @@ int HAL_SendIPPacket(int if_index, uint8_t *buffer, size_t length,
   XAxiDma_BdRingToHw(txRing, 1, bd);
   return 0;
 }
+
+// the MAC takes jumbo frames, the DMA buffers hold HAL_MAX_MTU
+int HAL_GetInterfaceMtu(int if_index) {
+  if (!inited) {
+    return HAL_ERR_CALLED_BEFORE_INIT;
+  }
+  if (if_index >= N_IFACE_ON_BOARD || if_index < 0) {
+    return HAL_ERR_IFACE_NOT_EXIST;
+  }
+  return HAL_MAX_MTU;
+}
+
+// HAL_ReceiveIPPacket polls the DMA rings, it never sleeps
+int HAL_SetReceivePolicy(int policy, int spin_us) {
+  if (policy < HAL_RX_BLOCK || policy > HAL_RX_ADAPTIVE || spin_us < 0) {
+    return HAL_ERR_INVALID_PARAMETER;
+  }
+  return 0;
+}
+
+// the PHYs are not watched
+int HAL_SetLinkCallback(HAL_LinkCallback callback) {
+  return HAL_ERR_NOT_SUPPORTED;
+}
+
+// no file system to share a stats page through
+int HAL_StatsOpen(const char *path) { return HAL_ERR_NOT_SUPPORTED; }
+
+const HAL_StatsPage *HAL_GetStats() { return NULL; }
+
+void HAL_StatsCountDrop(int reason) {}
+
+HAL_Histogram *HAL_StatsHistogram(int index, const char *name) { return NULL; }
@@ -0,0 +1,150 @@
+#include "router.h"
+#include "router_hal.h"
+#include "timing.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+// Forwarding benchmark of the boilerplate router against the MEMORY backend
+// build with `make BACKEND=MEMORY bench`
+// usage: ./bench [conf] [distinct packets] [total packets]
+
+extern int routerInit();
+extern int routerPoll();
+extern void bulk_load(const RoutingTableEntry* entries, size_t count);
+extern uint16_t ComputeChecksum(uint8_t *packet, size_t halfWords, size_t checkum_index);
+extern uint32_t masks[33];
+extern void printTiming(FILE *fp);
+extern const char *snapshotFile;
+extern const char *statsFile;
+extern const char *controlFile;
+
+// packets come in on interface 0 and leave through this neighbor on interface 1
+const int IN_IF = 0;
+const int OUT_IF = 1;
+const in_addr_t SRC_HOST = 0x6404a8c0; // 192.168.4.100
+const in_addr_t NEXTHOP = 0x0105a8c0; // 192.168.5.1
+const macaddr_t SRC_MAC = {2, 0, 0, 0, 0, 1};
+const macaddr_t NEXTHOP_MAC = {2, 0, 0, 0, 0, 2};
+const int PACKET_SIZE = 64;
+
+uint64_t nowNs() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+// parse 'route a.b.c.d/len ...;' lines of a BIRD static protocol config
+std::vector<RoutingTableEntry> loadConf(const char *path) {
+  std::vector<RoutingTableEntry> routes;
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    perror(path);
+    exit(1);
+  }
+  char line[256];
+  uint64_t now = HAL_GetTicks();
+  while (fgets(line, sizeof(line), fp)) {
+    unsigned a, b, c, d, len;
+    if (sscanf(line, " route %u.%u.%u.%u/%u", &a, &b, &c, &d, &len) != 5 ||
+        len == 0 || len > 32) {
+      continue;
+    }
+    RoutingTableEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.addr = (a | (b << 8) | (c << 16) | (d << 24)) & masks[len];
+    entry.len = len;
+    entry.if_index = OUT_IF;
+    entry.nexthop = NEXTHOP;
+    entry.metric = 2;
+    entry.timestamp = now;
+    routes.push_back(entry);
+  }
+  fclose(fp);
+  return routes;
+}
+
+// a UDP packet from SRC_HOST to dst
+void makePacket(uint8_t *packet, in_addr_t dst) {
+  memset(packet, 0, PACKET_SIZE);
+  packet[0] = 0x45;
+  packet[2] = 0;
+  packet[3] = PACKET_SIZE;
+  packet[8] = 64; // ttl
+  packet[9] = 0x11; // UDP
+  memcpy(packet + 12, &SRC_HOST, sizeof(in_addr_t));
+  memcpy(packet + 16, &dst, sizeof(in_addr_t));
+  packet[20] = 0x30; // src port 12345
+  packet[21] = 0x39;
+  packet[22] = 0x00; // dst port 9
+  packet[23] = 0x09;
+  packet[25] = PACKET_SIZE - 20;
+  *((uint16_t *)(packet + 10)) = ComputeChecksum(packet, 10, 5);
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : "../../Setup/conf-part9.conf";
+  int distinct = argc > 2 ? atoi(argv[2]) : 4096;
+  uint64_t total = argc > 3 ? strtoull(argv[3], NULL, 10) : 10000000;
+  if (argc > 4 || (argc > 1 && argv[1][0] == '-') || distinct <= 0 || total < (uint64_t)distinct) {
+    fprintf(stderr, "usage: %s [conf] [distinct packets] [total packets]\n", argv[0]);
+    return 1;
+  }
+
+  // no warm restart from, nor files over those of, a router run from here
+  snapshotFile = NULL;
+  statsFile = NULL;
+  controlFile = NULL;
+  int res = routerInit();
+  if (res < 0) {
+    printf("routerInit failed: %d\n", res);
+    return 1;
+  }
+  HAL_MemoryAddArp(OUT_IF, NEXTHOP, NEXTHOP_MAC);
+  std::vector<RoutingTableEntry> routes = loadConf(path);
+  if (routes.empty()) {
+    printf("%s: no routes\n", path);
+    return 1;
+  }
+  bulk_load(routes.data(), routes.size());
+
+  // destinations are random hosts of random routes
+  macaddr_t if_mac;
+  HAL_GetInterfaceMacAddress(IN_IF, if_mac);
+  uint8_t packet[PACKET_SIZE];
+  srand(1);
+  for (int i = 0; i < distinct; i++) {
+    const RoutingTableEntry &e = routes[rand() % routes.size()];
+    uint32_t r = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    makePacket(packet, e.addr | (r & ~masks[e.len]));
+    HAL_MemoryEnqueue(IN_IF, packet, PACKET_SIZE, SRC_MAC, if_mac);
+  }
+  HAL_MemorySetRepeat(total / distinct - 1);
+
+  uint64_t beginNs = nowNs(), beginCycles = readCycles();
+  while ((res = routerPoll()) != HAL_ERR_EOF) {
+    if (res < 0) {
+      printf("routerPoll failed: %d\n", res);
+      return 1;
+    }
+  }
+  uint64_t elapsedNs = nowNs() - beginNs;
+  uint64_t elapsedCycles = readCycles() - beginCycles;
+
+  uint64_t rx, tx, txBytes;
+  HAL_MemoryGetCounters(&rx, &tx, &txBytes);
+  printf("%s: %zu routes, %d distinct packets\n", path, routes.size(), distinct);
+  printf("%llu packets received, %llu sent in %.1f ms\n",
+          (unsigned long long)rx, (unsigned long long)tx, elapsedNs / 1e6);
+  printf("%.3f Mpps, %.1f ns/packet, %.1f cycles/packet\n",
+          rx * 1e3 / elapsedNs, (double)elapsedNs / rx, (double)elapsedCycles / rx);
+  if (stageHist[STAGE_RECEIVE]->count == 0) {
+    printf("per stage timing n/a, build with -DROUTER_PROFILE\n");
+    return 0;
+  }
+  printTiming(stdout);
+  return 0;
+}
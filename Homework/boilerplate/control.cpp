@@ -0,0 +1,344 @@
+#include "router.h"
+#include "router_hal.h"
+#include "router_stats.h"
+#include <algorithm>
+#include <errno.h>
+#include <map>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+extern std::vector<RoutingTableEntry> RoutingTable;
+extern std::vector<FibEntry> Fib;
+extern uint32_t routeGeneration;
+extern uint32_t masks[33];
+extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
+extern void routeCacheCounters(uint64_t *hits, uint64_t *misses, uint64_t *stale,
+                               uint64_t *queryNs, uint64_t *savedNs);
+
+/**
+ * Control socket, a Unix stream socket polled by the main loop
+ * A client sends one command per line, each reply ends with a line of ".".
+ * Everything is non-blocking: output that the client doesn't take stays
+ * queued, and a dump formats at most CONTROL_DUMP_BATCH routes per poll
+ * from a copy of the RIB taken when the command arrived.
+ */
+const int CONTROL_MAX_CLIENTS = 4;
+const size_t CONTROL_DUMP_BATCH = 128;
+// a client that queues more than this without reading is dropped
+const size_t CONTROL_MAX_PENDING = 1 << 20;
+// a dump formats its next batch only once the output is below this
+const size_t CONTROL_DUMP_LOW = 16 << 10;
+// input buffered for a client, what is beyond stays in the socket
+const size_t CONTROL_MAX_INPUT = 4096;
+
+struct ControlClient {
+  int fd;
+  std::string in;
+  std::string out;
+  std::vector<RoutingTableEntry> dump;
+  size_t dumpNext;
+  // the client shut down its side, it is closed once all output is sent
+  bool eof;
+};
+
+int controlFd = -1;
+std::vector<ControlClient> controlClients;
+
+static void appendf(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void appendf(std::string &out, const char *fmt, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  if (n > 0)
+    out.append(line, n < (int)sizeof(line) ? n : sizeof(line) - 1);
+}
+
+static std::string ip(uint32_t addr) {
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", addr & 0xff, (addr >> 8) & 0xff,
+           (addr >> 16) & 0xff, addr >> 24);
+  return buffer;
+}
+
+static bool parseIp(const char *s, uint32_t *addr) {
+  unsigned a, b, c, d;
+  char tail;
+  if (sscanf(s, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 || a > 255 || b > 255 ||
+      c > 255 || d > 255)
+    return false;
+  *addr = a | (b << 8) | (c << 16) | (d << 24);
+  return true;
+}
+
+static void appendRoute(std::string &out, const RoutingTableEntry &e, uint64_t now) {
+  appendf(out, "%s/%u via %s if %u metric %u age %llus%s\n", ip(e.addr).c_str(), e.len,
+          e.nexthop ? ip(e.nexthop).c_str() : "direct", e.if_index, e.metric,
+          (unsigned long long)((now - e.timestamp) / 1000), e.stale ? " stale" : "");
+}
+
+static void commandSummary(std::string &out) {
+  uint32_t prefixes = 0, reachable = 0, learnt = 0, stale = 0;
+  uint32_t lengths[33] = {0};
+  for (size_t i = 0; i < RoutingTable.size(); i++) {
+    const RoutingTableEntry &e = RoutingTable[i];
+    if (i == 0 || e.addr != RoutingTable[i - 1].addr || e.len != RoutingTable[i - 1].len) {
+      prefixes++;
+      lengths[e.len]++;
+    }
+    reachable += e.metric < 16;
+    learnt += e.nexthop != 0;
+    stale += e.stale != 0;
+  }
+  appendf(out, "%zu routes, %u prefixes, %u reachable, %u learnt, %u stale\n",
+          RoutingTable.size(), prefixes, reachable, learnt, stale);
+  appendf(out, "%zu FIB entries, generation %u\n", Fib.size(), routeGeneration);
+  for (int len = 32; len >= 0; len--)
+    if (lengths[len])
+      appendf(out, "/%d: %u prefixes\n", len, lengths[len]);
+}
+
+static void commandRoute(std::string &out, const char *arg, uint64_t now) {
+  char addr[32];
+  unsigned len = 32;
+  uint32_t a;
+  if (sscanf(arg, "%31[0-9.]/%u", addr, &len) < 1 || len > 32 || !parseIp(addr, &a)) {
+    out += "usage: route a.b.c.d[/len]\n";
+    return;
+  }
+  a &= masks[len];
+  int found = 0;
+  for (size_t i = 0; i < RoutingTable.size(); i++) {
+    const RoutingTableEntry &e = RoutingTable[i];
+    if (e.addr == a && e.len == len) {
+      appendRoute(out, e, now);
+      found++;
+    }
+  }
+  if (!found)
+    out += "not found\n";
+}
+
+static void commandLookup(std::string &out, const char *arg, uint64_t now) {
+  uint32_t addr, nexthop, if_index;
+  if (!parseIp(arg, &addr)) {
+    out += "usage: lookup a.b.c.d\n";
+    return;
+  }
+  if (!query(addr, &nexthop, &if_index)) {
+    out += "no route\n";
+    return;
+  }
+  appendf(out, "%s via %s if %u\n", ip(addr).c_str(),
+          nexthop ? ip(nexthop).c_str() : "direct", if_index);
+  // the paths of the longest matching prefix, for context
+  int best = -1;
+  for (size_t i = 0; i < RoutingTable.size(); i++) {
+    const RoutingTableEntry &e = RoutingTable[i];
+    if (e.metric < 16 && (addr & masks[e.len]) == e.addr && (int)e.len > best)
+      best = e.len;
+  }
+  for (size_t i = 0; best >= 0 && i < RoutingTable.size(); i++) {
+    const RoutingTableEntry &e = RoutingTable[i];
+    if ((int)e.len == best && (addr & masks[best]) == e.addr)
+      appendRoute(out, e, now);
+  }
+}
+
+static void commandNeighbors(std::string &out, uint64_t now) {
+  // (nexthop, if_index) -> (routes, last heard)
+  std::map<std::pair<uint32_t, uint32_t>, std::pair<uint32_t, uint64_t>> neighbors;
+  for (size_t i = 0; i < RoutingTable.size(); i++) {
+    const RoutingTableEntry &e = RoutingTable[i];
+    if (e.nexthop == 0)
+      continue;
+    std::pair<uint32_t, uint64_t> &n = neighbors[std::make_pair(e.nexthop, e.if_index)];
+    n.first++;
+    if (e.timestamp > n.second)
+      n.second = e.timestamp;
+  }
+  for (auto it = neighbors.begin(); it != neighbors.end(); it++)
+    appendf(out, "%s if %u: %u routes, heard %llus ago\n", ip(it->first.first).c_str(),
+            it->first.second, it->second.first,
+            (unsigned long long)((now - it->second.second) / 1000));
+  if (neighbors.empty())
+    out += "no neighbors\n";
+}
+
+static void commandCounters(std::string &out) {
+  static const char *dropNames[HAL_N_DROP] = {"truncated", "checksum", "no route", "no arp",
+                                              "ttl", "too big"};
+  uint64_t hits, misses, stale, queryNs, savedNs;
+  routeCacheCounters(&hits, &misses, &stale, &queryNs, &savedNs);
+  appendf(out, "route cache: hits %llu, misses %llu, stale %llu, hit rate %.1f%%, "
+          "query %llu ns, saved %llu us\n",
+          (unsigned long long)hits, (unsigned long long)misses, (unsigned long long)stale,
+          hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+          (unsigned long long)queryNs, (unsigned long long)(savedNs / 1000));
+  const HAL_StatsPage *stats = HAL_GetStats();
+  if (!stats) {
+    out += "HAL counters not supported\n";
+    return;
+  }
+  HAL_StatsSlot total;
+  HAL_StatsSum(stats, &total);
+  for (int i = 0; i < HAL_InterfaceCount(); i++) {
+    const HAL_IfaceCounters &c = total.iface[i];
+    appendf(out, "if %d: rx %llu packets %llu bytes, tx %llu packets %llu bytes, kernel drops %llu\n",
+            i, (unsigned long long)c.rx_packets, (unsigned long long)c.rx_bytes,
+            (unsigned long long)c.tx_packets, (unsigned long long)c.tx_bytes,
+            (unsigned long long)stats->kernel_drops[i]);
+  }
+  for (int i = 0; i < HAL_N_DROP; i++)
+    appendf(out, "drop %s: %llu\n", dropNames[i], (unsigned long long)total.drops[i]);
+}
+
+static void runCommand(ControlClient &client, const std::string &line) {
+  std::string &out = client.out;
+  uint64_t now = HAL_GetTicks();
+  size_t space = line.find(' ');
+  std::string command = line.substr(0, space);
+  const char *arg = space == std::string::npos ? "" : line.c_str() + space + 1;
+  if (command == "summary") {
+    commandSummary(out);
+  } else if (command == "route") {
+    commandRoute(out, arg, now);
+  } else if (command == "lookup") {
+    commandLookup(out, arg, now);
+  } else if (command == "neighbors") {
+    commandNeighbors(out, now);
+  } else if (command == "counters") {
+    commandCounters(out);
+  } else if (command == "dump") {
+    // the reply is streamed by controlPoll, the terminator comes after it
+    if (!RoutingTable.empty()) {
+      client.dump = RoutingTable;
+      client.dumpNext = 0;
+      return;
+    }
+  } else if (!command.empty()) {
+    out += "commands: summary, route a.b.c.d[/len], lookup a.b.c.d, neighbors, counters, dump\n";
+  }
+  out += ".\n";
+}
+
+/**
+ * Listen on the Unix socket path, replacing a stale one
+ * @return 0 on success, -1 on error
+ */
+int controlOpen(const char *path) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, CONTROL_MAX_CLIENTS) < 0) {
+    close(fd);
+    return -1;
+  }
+  controlFd = fd;
+  return 0;
+}
+
+/**
+ * Accept clients, answer complete commands and send what the clients take
+ * Never blocks
+ * @return whether some output is still queued, the caller should poll again soon
+ */
+bool controlPoll() {
+  if (controlFd < 0)
+    return false;
+  if ((int)controlClients.size() < CONTROL_MAX_CLIENTS) {
+    int fd = accept4(controlFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd >= 0) {
+      ControlClient client;
+      client.fd = fd;
+      client.dumpNext = 0;
+      client.eof = false;
+      controlClients.push_back(client);
+    }
+  }
+  bool busy = false;
+  for (size_t i = 0; i < controlClients.size();) {
+    ControlClient &c = controlClients[i];
+    bool closed = false;
+    char buffer[1024];
+    ssize_t n;
+    // no more than CONTROL_MAX_INPUT is taken, the rest waits in the socket
+    while (!c.eof && c.in.size() < CONTROL_MAX_INPUT) {
+      n = read(c.fd, buffer, std::min(sizeof(buffer), CONTROL_MAX_INPUT - c.in.size()));
+      if (n > 0) {
+        c.in.append(buffer, n);
+        continue;
+      }
+      if (n == 0) {
+        // e.g. `echo dump | nc -NU router.ctl`, the replies are still wanted
+        c.eof = true;
+        if (!c.in.empty() && c.in[c.in.size() - 1] != '\n')
+          c.in += '\n';
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        closed = true;
+      }
+      break;
+    }
+    // the socket may hold more commands
+    bool more = !c.eof && c.in.size() >= CONTROL_MAX_INPUT;
+    if (c.in.size() >= CONTROL_MAX_INPUT && c.in.find('\n') == std::string::npos)
+      closed = true;
+    // one command at a time, so that replies never interleave
+    size_t eol;
+    while (c.dump.empty() && (eol = c.in.find('\n')) != std::string::npos) {
+      std::string line = c.in.substr(0, eol);
+      if (!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+      c.in.erase(0, eol + 1);
+      runCommand(c, line);
+    }
+    // a slow reader gets the dump at its own pace
+    if (!c.dump.empty() && c.out.size() < CONTROL_DUMP_LOW) {
+      uint64_t now = HAL_GetTicks();
+      size_t end = std::min(c.dump.size(), c.dumpNext + CONTROL_DUMP_BATCH);
+      for (; c.dumpNext < end; c.dumpNext++)
+        appendRoute(c.out, c.dump[c.dumpNext], now);
+      if (c.dumpNext == c.dump.size()) {
+        c.out += ".\n";
+        std::vector<RoutingTableEntry>().swap(c.dump);
+      }
+    }
+    while (!c.out.empty()) {
+      n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+      if (n <= 0) {
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+          closed = true;
+        break;
+      }
+      c.out.erase(0, n);
+    }
+    if (c.out.size() > CONTROL_MAX_PENDING)
+      closed = true;
+    if (c.eof && c.out.empty() && c.dump.empty() && c.in.find('\n') == std::string::npos)
+      closed = true;
+    if (closed) {
+      close(c.fd);
+      controlClients.erase(controlClients.begin() + i);
+      continue;
+    }
+    busy |= !c.out.empty() || !c.dump.empty() || more;
+    i++;
+  }
+  return busy;
+}
@@ -0,0 +1,188 @@
+#include "router.h"
+#include "router_hal.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+extern uint16_t ComputeChecksum(uint8_t *packet, size_t halfWords, size_t checkum_index);
+extern void onNeighborDown(uint32_t nexthop, uint32_t if_index, const std::vector<std::pair<uint32_t, uint32_t>>& prefixes);
+extern std::vector<RoutingTableEntry> RoutingTable;
+extern std::vector<in_addr_t> ifAddrs;
+extern std::vector<uint32_t> ripIfaces;
+
+/**
+ * Fast neighbor liveness detection, in the spirit of BFD (RFC 5880)
+ * Every helloInterval ms each RIP interface multicasts a hello listing the
+ * neighbors heard on it. A neighbor is up once it lists us back, and down
+ * when HELLO_DETECT_MULT of its own intervals pass without a hello from it,
+ * or when its hellos stop listing us. RIP alone notices a dead neighbor only
+ * after TIMEOUT_SEC, and link events miss a failure behind a switch or of
+ * the neighbor's process.
+ *
+ * Hello, the UDP payload, sent with TTL 255 to 224.0.0.9 port HELLO_PORT:
+ * version (1), detect multiplier, interval in ms (2 bytes, big endian),
+ * count, 3 reserved bytes, then count addresses of neighbors heard, at most
+ * HELLO_MAX_NEIGHBORS on an interface; more are ignored
+ */
+#define HELLO_VERSION 1
+#define HELLO_HEADER 8
+
+// ms between hellos, at most 65535 as hellos carry it in 16 bits, 0 for none at all
+uint32_t helloInterval = 0;
+// when the next hellos are sent
+uint64_t hello_time = 0;
+std::vector<HelloNeighbor> helloNeighbors;
+// hello packets, so that sim reports RIP packets apart from them
+uint64_t hellosSent = 0, hellosReceived = 0;
+
+/**
+ * Index the reachable paths of the routing table through nb, when it comes up
+ * From then on helloLearn keeps the index up to date
+ */
+static void indexNeighbor(HelloNeighbor& nb){
+  for(size_t i = 0; i < RoutingTable.size(); i++){
+    const RoutingTableEntry& e = RoutingTable[i];
+    if(e.nexthop == nb.addr && e.if_index == nb.if_index && e.metric < 16)
+      nb.prefixes.insert(std::make_pair(e.addr, e.len));
+  }
+}
+
+/**
+ * Session to the i-th neighbor is down: forget it, and withdraw its paths
+ */
+static void neighborDown(size_t i, const char* why){
+  HelloNeighbor nb = HelloNeighbor();
+  std::swap(nb, helloNeighbors[i]);
+  helloNeighbors.erase(helloNeighbors.begin() + i);
+  if(!nb.up)
+    return;
+  LOG(INFO, "neighbor %u.%u.%u.%u on interface %u down, %s, %zu prefixes to withdraw",
+      nb.addr & 0xff, (nb.addr >> 8) & 0xff, (nb.addr >> 16) & 0xff, nb.addr >> 24,
+      nb.if_index, why, nb.prefixes.size());
+  std::vector<std::pair<uint32_t, uint32_t>> prefixes(nb.prefixes.begin(), nb.prefixes.end());
+  onNeighborDown(nb.addr, nb.if_index, prefixes);
+}
+
+static void sendHello(uint32_t if_index){
+  uint8_t hello[20 + 8 + HELLO_HEADER + 4 * HELLO_MAX_NEIGHBORS];
+  uint8_t count = 0;
+  uint8_t* payload = hello + 28;
+  for(size_t i = 0; i < helloNeighbors.size() && count < HELLO_MAX_NEIGHBORS; i++)
+    if(helloNeighbors[i].if_index == if_index)
+      memcpy(payload + HELLO_HEADER + 4 * count++, &helloNeighbors[i].addr, 4);
+  uint16_t length = 28 + HELLO_HEADER + 4 * count;
+  memset(hello, 0, 28 + HELLO_HEADER);
+  // IP, TTL 255 so that the receiver knows it comes from a neighbor
+  hello[0] = 0x45;
+  hello[2] = length >> 8;
+  hello[3] = length;
+  hello[8] = 255;
+  hello[9] = 0x11;
+  memcpy(hello + 12, &ifAddrs[if_index], 4);
+  in_addr_t group = MULTICAST_ADDR;
+  memcpy(hello + 16, &group, 4);
+  *((uint16_t*)(hello + 10)) = ComputeChecksum(hello, 10, 5);
+  // UDP without checksum
+  hello[20] = hello[22] = HELLO_PORT >> 8;
+  hello[21] = hello[23] = HELLO_PORT & 0xff;
+  hello[24] = (length - 20) >> 8;
+  hello[25] = length - 20;
+  payload[0] = HELLO_VERSION;
+  payload[1] = HELLO_DETECT_MULT;
+  payload[2] = helloInterval >> 8;
+  payload[3] = helloInterval;
+  payload[4] = count;
+  macaddr_t mac;
+  if(HAL_ArpGetMacAddress(if_index, MULTICAST_ADDR, mac) == 0 && HAL_SendIPPacket(if_index, hello, length, mac) == 0)
+    hellosSent++;
+}
+
+/**
+ * Send the hellos that are due and time out silent neighbors
+ * @return when it should be called again, UINT64_MAX if hellos are off
+ */
+uint64_t helloPoll(uint64_t time){
+  if(helloInterval == 0)
+    return UINT64_MAX;
+  for(size_t i = helloNeighbors.size(); i-- > 0; )
+    if(time > helloNeighbors[i].lastSeen + helloNeighbors[i].detectMs)
+      neighborDown(i, "timed out");
+  if(time >= hello_time){
+    for(size_t k = 0; k < ripIfaces.size(); k++)
+      sendHello(ripIfaces[k]);
+    hello_time = time + helloInterval;
+  }
+  uint64_t next = hello_time;
+  for(size_t i = 0; i < helloNeighbors.size(); i++)
+    next = std::min(next, helloNeighbors[i].lastSeen + helloNeighbors[i].detectMs + 1);
+  return next;
+}
+
+/**
+ * Handle packet if it is a hello, from if_index
+ * @return whether it was one, so that nothing else looks at it
+ */
+bool helloReceive(const uint8_t* packet, uint32_t len, uint32_t if_index){
+  uint32_t headerLength = (packet[0] & 0xf) << 2;
+  if(packet[9] != 0x11 || len < headerLength + 8 + HELLO_HEADER
+      || packet[headerLength + 2] != (HELLO_PORT >> 8) || packet[headerLength + 3] != (HELLO_PORT & 0xff))
+    return false;
+  hellosReceived++;
+  const uint8_t* payload = packet + headerLength + 8;
+  uint8_t count = payload[4];
+  uint32_t interval = (payload[2] << 8) | payload[3];
+  in_addr_t src_addr;
+  memcpy(&src_addr, packet + 12, 4);
+  // only from a neighbor that runs hellos too, and never our own
+  if(helloInterval == 0 || packet[8] != 255 || payload[0] != HELLO_VERSION || interval == 0
+      || len < headerLength + 8 + HELLO_HEADER + 4 * count || src_addr == ifAddrs[if_index])
+    return true;
+  bool listed = false;
+  for(uint8_t i = 0; i < count; i++)
+    listed |= memcmp(payload + HELLO_HEADER + 4 * i, &ifAddrs[if_index], 4) == 0;
+  size_t i = 0, onIface = 0;
+  for(; i < helloNeighbors.size() && (helloNeighbors[i].addr != src_addr || helloNeighbors[i].if_index != if_index); i++)
+    onIface += helloNeighbors[i].if_index == if_index;
+  if(i == helloNeighbors.size()){
+    // no more than sendHello lists: one that is not listed would never come
+    // up, and one that drops out of the list would go down
+    if(onIface >= HELLO_MAX_NEIGHBORS){
+      LOG_RATE(1000, WARN, "more than %d hello neighbors on interface %u", HELLO_MAX_NEIGHBORS, if_index);
+      return true;
+    }
+    HelloNeighbor nb = HelloNeighbor();
+    nb.addr = src_addr;
+    nb.if_index = if_index;
+    nb.up = false;
+    helloNeighbors.push_back(nb);
+  }
+  HelloNeighbor& nb = helloNeighbors[i];
+  nb.lastSeen = HAL_GetTicks();
+  nb.detectMs = (payload[1] ? payload[1] : HELLO_DETECT_MULT) * interval;
+  if(listed && !nb.up){
+    nb.up = true;
+    indexNeighbor(nb);
+    LOG(INFO, "neighbor %u.%u.%u.%u on interface %u up",
+        src_addr & 0xff, (src_addr >> 8) & 0xff, (src_addr >> 16) & 0xff, src_addr >> 24, if_index);
+  }else if(!listed && nb.up){
+    // it restarted, or lost our hellos
+    neighborDown(i, "no longer hears us");
+  }
+  return true;
+}
+
+/**
+ * Add the prefixes of a RIP response from nexthop to the index of its neighbor
+ */
+void helloLearn(uint32_t nexthop, uint32_t if_index, const RoutingTableEntry* entries, int n){
+  for(size_t i = 0; i < helloNeighbors.size(); i++){
+    HelloNeighbor& nb = helloNeighbors[i];
+    if(nb.addr != nexthop || nb.if_index != if_index || !nb.up)
+      continue;
+    for(int j = 0; j < n; j++)
+      if(entries[j].metric < 16)
+        nb.prefixes.insert(std::make_pair(entries[j].addr, entries[j].len));
+    return;
+  }
+}
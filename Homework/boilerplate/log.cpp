@@ -0,0 +1 @@
+../lookup/log.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../lookup/log.h
\ No newline at end of file
@@ -1,15 +1,25 @@
 #include "rip.h"
 #include "router.h"
 #include "router_hal.h"
+#include "router_stats.h"
+#include "timing.h"
+#ifdef ROUTER_BACKEND_LINUX
+#include <linux/if_link.h>
+#endif
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
 #include <vector>
 #include <ctime>
 
 extern bool validateIPChecksum(uint8_t *packet, size_t len);
 extern void update(bool insert, const RoutingTableEntry& entry);
+extern void bulk_load(const RoutingTableEntry* entries, size_t count);
 extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
 extern bool forward(uint8_t *packet, size_t len);
 extern bool disassemble(const uint8_t *packet, uint32_t len, RipPacket *output);
@@ -18,20 +28,26 @@ extern uint16_t ComputeChecksum(uint8_t *packet, size_t halfWords, size_t checku
 extern std::vector<RoutingTableEntry> RoutingTable;
 extern bool hasUpdate;
 extern void printTable();
-
-uint32_t countTrailingingOnes(uint32_t val){
-  uint32_t ans = 0;
-  while(val){
-    val >>= 1;
-    ans++;
-  }
-  return ans;
-}
+extern uint32_t masks[33];
+extern void fibSet(uint32_t addr, uint32_t len, const RoutingTableEntry* paths, int n);
+extern bool routeCacheLookup(uint32_t addr, uint32_t *nexthop, uint32_t *if_index, macaddr_t mac);
+extern int routeCacheQuery(uint32_t addr, uint32_t hash, uint32_t *nexthop, uint32_t *if_index);
+extern void routeCacheInsert(uint32_t addr, uint32_t nexthop, uint32_t if_index, const macaddr_t mac);
+extern void printRouteCacheStats();
+extern int saveSnapshot(const char* path);
+extern int loadSnapshot(const char* path);
+extern int controlOpen(const char* path);
+extern bool controlPoll();
+extern void (*fibNotify)(uint32_t addr, uint32_t len, const FibEntry* paths, int n);
+extern uint32_t helloInterval;
+extern uint64_t helloPoll(uint64_t time);
+extern bool helloReceive(const uint8_t* packet, uint32_t len, uint32_t if_index);
+extern void helloLearn(uint32_t nexthop, uint32_t if_index, const RoutingTableEntry* entries, int n);
 
 void convertRoutingEntryToRipEntry(const RoutingTableEntry& rte, RipEntry& re){
   re.addr = rte.addr;
   // RipEntry.mask is store in big endian
-  re.mask = 0xffffffff >> (32 - rte.len);
+  re.mask = masks[rte.len];
   re.nexthop = rte.nexthop;
   // RipEntry.metric is stored in big endian
   // while RoutingTableEntry.metric is stored in little endian
@@ -40,7 +56,8 @@ void convertRoutingEntryToRipEntry(const RoutingTableEntry& rte, RipEntry& re){
 
 void convertRipEntryToRoutingEntry(const RipEntry& re, RoutingTableEntry& rte, uint32_t if_index, uint32_t src_addr){
   rte.addr = re.addr;
-  rte.len = countTrailingingOnes(re.mask);
+  // the mask is contiguous, checked by disassemble
+  rte.len = __builtin_popcount(re.mask);
   rte.if_index = if_index;
   rte.nexthop = src_addr;
   // RipEntry.metric is stored in big endian
@@ -48,6 +65,28 @@ void convertRipEntryToRoutingEntry(const RipEntry& re, RoutingTableEntry& rte, u
   rte.metric = re.metric >> 24;
   rte.timestamp = HAL_GetTicks();
   rte.change_flag = 1;
+  rte.stale = 0;
+}
+
+/**
+ * Hash of the 5-tuple of an IP packet, so that packets of a flow take the same path
+ * Ports are only used for unfragmented TCP and UDP
+ */
+uint32_t flowHash(const uint8_t* packet){
+  uint32_t h = *(const uint32_t*)(packet + 12) * 0x9e3779b1u;
+  h ^= *(const uint32_t*)(packet + 16) * 0x85ebca6bu;
+  uint8_t protocol = packet[9];
+  h ^= protocol;
+  bool fragment = (packet[6] & 0x3f) != 0 || packet[7] != 0;
+  if((protocol == 6 || protocol == 17) && !fragment)
+    h ^= *(const uint32_t*)(packet + ((packet[0] & 0xf) << 2)) * 0xc2b2ae35u;
+  // finalizer of murmur3, so that every input bit affects the low bits
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
 }
 
 void writeHalf(uint8_t* dst, uint16_t val){
@@ -55,8 +94,9 @@ void writeHalf(uint8_t* dst, uint16_t val){
   *(dst+1) = uint8_t(val & 0xff);
 }
 
-uint8_t packet[2048];
-uint8_t output[2048];
+// the largest IPv4 packet: GRO and GSO super-packets are forwarded whole
+uint8_t packet[65536];
+uint8_t output[65536];
 // 0: 192.168.3.2 R1
 // 1: 192.168.4.1 R2
 // 2: 10.0.2.1 unused
@@ -75,6 +115,72 @@ bool enables[N_IFACE_ON_BOARD] = {true, true, false, false};
 // 3: 0.0.0.0 none
 in_addr_t neighbors[N_IFACE_ON_BOARD] = {0x0103a8c0, 0x0204a8c0, 0x0, 0x0};
 
+// the interfaces in use, from the arrays above or from the file given by -i,
+// dense and indexed by if_index
+std::vector<in_addr_t> ifAddrs;
+// the interfaces RIP updates are sent to
+std::vector<uint32_t> ripIfaces;
+// ifAddrs sorted, to find the packets for the router
+std::vector<in_addr_t> localAddrs;
+// the MTU of each interface, at most HAL_MAX_MTU
+std::vector<uint32_t> ifMtu;
+// a file with a line "NAME A.B.C.D [passive] [mtu N]" per interface, NULL for the arrays above
+const char *ifaceFile = NULL;
+
+bool isLocalAddr(in_addr_t addr){
+  return std::binary_search(localAddrs.begin(), localAddrs.end(), addr);
+}
+
+/**
+ * Read the interfaces from ifaceFile, names go to HAL_InitInterfaces
+ * A passive interface gets no RIP updates, like enables[i] = false
+ * Without "mtu N", the MTU comes from HAL_GetInterfaceMtu
+ * @return 0 on success, -1 if the file cannot be read or has a bad line
+ */
+int loadInterfaces(std::vector<std::string>& names){
+  FILE *fp = fopen(ifaceFile, "r");
+  if(!fp)
+    return -1;
+  char line[256];
+  int res = 0, lineno = 0;
+  while(fgets(line, sizeof(line), fp)){
+    lineno++;
+    char name[64], addr[64], flag[64];
+    int pos = 0, n = 0;
+    if(line[0] == '#' || sscanf(line, "%63s", name) != 1)
+      continue;
+    in_addr_t a;
+    bool passive = false, bad = false;
+    uint32_t mtu = 0;
+    if(sscanf(line, "%63s %63s%n", name, addr, &pos) < 2 || inet_pton(AF_INET, addr, &a) != 1
+        || ifAddrs.size() >= HAL_MAX_IFACES)
+      bad = true;
+    for(const char *p = line + pos; !bad && sscanf(p, "%63s%n", flag, &n) == 1; p += n){
+      if(strcmp(flag, "passive") == 0){
+        passive = true;
+      }else if(strcmp(flag, "mtu") == 0 && sscanf(p + n, "%u%n", &mtu, &pos) == 1
+          && mtu >= 68 && mtu <= HAL_MAX_MTU){
+        n += pos;
+      }else{
+        bad = true;
+      }
+    }
+    if(bad){
+      // not the line itself, the log formats %s after line is gone
+      LOG(WARN, "bad interface line %d of %s", lineno, ifaceFile);
+      res = -1;
+      break;
+    }
+    if(!passive)
+      ripIfaces.push_back(ifAddrs.size());
+    names.push_back(name);
+    ifAddrs.push_back(a);
+    ifMtu.push_back(mtu);
+  }
+  fclose(fp);
+  return ifAddrs.empty() ? -1 : res;
+}
+
 void confIPHeader(uint32_t src_addr, uint32_t dst_addr, uint8_t ttl, uint32_t rip_len, bool isRequest = false){
   // Version = 4(IP), IHL = 5
   output[0] = 0x45;
@@ -108,9 +214,17 @@ void confIPHeader(uint32_t src_addr, uint32_t dst_addr, uint8_t ttl, uint32_t ri
   *((uint16_t*)(output + 10)) = ComputeChecksum(output, 10, 5); 
 }
 
-uint32_t confICMP(uint32_t src_addr, uint32_t dst_addr, uint8_t ttl, uint8_t ICMP_type, uint8_t ICMP_code){
+/**
+ * An ICMP error about datagram, mtu is the next-hop MTU of Fragmentation Needed (RFC 1191)
+ * datagram must not be in output
+ */
+uint32_t confICMP(uint32_t src_addr, uint32_t dst_addr, uint8_t ttl, uint8_t ICMP_type, uint8_t ICMP_code,
+                  const uint8_t* datagram = packet, uint16_t mtu = 0){
   // Version = 4(IP), IHL = 5
   output[0] = 0x45;
+  output[1] = 0;
+  // id, flags and fragment offset
+  output[4] = output[5] = output[6] = output[7] = 0;
   // ttl is not fixed
   output[8] = ttl;
   // src addr
@@ -122,20 +236,67 @@ uint32_t confICMP(uint32_t src_addr, uint32_t dst_addr, uint8_t ttl, uint8_t ICM
   // ICMP header
   output[20] = ICMP_type; // type
   output[21] = ICMP_code; // code
-  output[24] = output[25] = output[26] = output[27] = 0; // unused
-  // total length, IP header = 20B, ICMP header = 8 + (20 + <= 64)
-  uint16_t inputDatagramLength = (((uint16_t)packet[2]) << 8) + packet[3] - 20;
+  output[24] = output[25] = 0; // unused
+  writeHalf(output + 26, mtu); // unused but in Fragmentation Needed
+  // total length, IP header = 20B, ICMP header = 8 + (IP header of datagram + <= 64)
+  uint16_t headerLength = (datagram[0] & 0xf) << 2;
+  uint16_t inputDatagramLength = (((uint16_t)datagram[2]) << 8) + datagram[3] - headerLength;
   if(inputDatagramLength > 64)
     inputDatagramLength = 64;
-  memcpy(output + 28, packet, inputDatagramLength);
-  memset(output + 28 + inputDatagramLength, 0, inputDatagramLength % 2); // pad to complete half words
+  uint16_t quoted = headerLength + inputDatagramLength;
+  memcpy(output + 28, datagram, quoted);
+  memset(output + 28 + quoted, 0, quoted % 2); // pad to complete half words
   // checksum for ICMP header
-  *((uint16_t*)(output + 22)) = ComputeChecksum(output + 20, (8 + 20 + inputDatagramLength + 1) >> 1, 1);
+  *((uint16_t*)(output + 22)) = ComputeChecksum(output + 20, (8 + quoted + 1) >> 1, 1);
   // compute IP packet length
-  writeHalf(output + 2, 20 + 8 + inputDatagramLength + 20);
+  writeHalf(output + 2, 20 + 8 + quoted);
   // checksum for IP header
   *((uint16_t*)(output + 10)) = ComputeChecksum(output, 10, 5); 
-  return inputDatagramLength + 20 + 8 + 20;
+  return 20 + 8 + quoted;
+}
+
+/**
+ * Send datagram, larger than the MTU of if_index, in fragments, ref. RFC791 3.2
+ * Options without the copied flag stay in the first fragment
+ */
+void sendFragments(uint8_t* datagram, uint32_t len, uint32_t if_index, macaddr_t dst_mac){
+  static uint8_t fragment[HAL_MAX_MTU];
+  uint32_t headerLength = (datagram[0] & 0xf) << 2;
+  // the header of the other fragments
+  uint8_t header[60];
+  uint32_t laterLength = 20;
+  memcpy(header, datagram, 20);
+  for(uint32_t i = 20; i < headerLength && datagram[i] != 0;){ // up to End of Option List
+    uint32_t optionLength = datagram[i] == 1 ? 1 : datagram[i + 1]; // No Operation is a byte
+    if(optionLength == 0 || i + optionLength > headerLength)
+      break;
+    if(datagram[i] & 0x80){
+      memcpy(header + laterLength, datagram + i, optionLength);
+      laterLength += optionLength;
+    }
+    i += optionLength;
+  }
+  while(laterLength & 3)
+    header[laterLength++] = 0;
+  header[0] = 0x40 | (laterLength >> 2);
+  // the datagram may be a fragment itself
+  uint32_t offset = (((datagram[6] & 0x1f) << 8) | datagram[7]) << 3;
+  bool more = datagram[6] & 0x20;
+  for(uint32_t pos = headerLength; pos < len; ){
+    const uint8_t* head = pos == headerLength ? datagram : header;
+    uint32_t h = pos == headerLength ? headerLength : laterLength;
+    uint32_t n = len - pos;
+    if(h + n > ifMtu[if_index])
+      n = (ifMtu[if_index] - h) & ~7u;
+    memcpy(fragment, head, h);
+    memcpy(fragment + h, datagram + pos, n);
+    writeHalf(fragment + 2, h + n);
+    // More Fragments and the offset in 8 bytes
+    writeHalf(fragment + 6, (pos + n < len || more ? 0x2000 : 0) | ((offset + pos - headerLength) >> 3));
+    *((uint16_t*)(fragment + 10)) = ComputeChecksum(fragment, h >> 1, 5);
+    HAL_SendIPPacket(if_index, fragment, h + n, dst_mac);
+    pos += n;
+  }
 }
 
 void sendRequest(uint32_t src_addr, uint32_t dst_addr, macaddr_t dst_mac, uint32_t if_index, uint8_t ttl){
@@ -150,26 +311,61 @@ void sendRequest(uint32_t src_addr, uint32_t dst_addr, macaddr_t dst_mac, uint32
   uint32_t rip_len = assemble(&req, output + 20 + 8);
   confIPHeader(src_addr, dst_addr, ttl, rip_len, true);
   HAL_SendIPPacket(if_index, output, rip_len + 20 + 8, dst_mac);
-  printf("request sent\n");
+  LOG(INFO, "request sent");
+}
+
+/**
+ * Paths of the same prefix are adjacent in RoutingTable
+ * Return the index right after the group starting at first
+ */
+size_t groupEnd(size_t first){
+  size_t last = first + 1;
+  while(last < RoutingTable.size() && RoutingTable[last].addr == RoutingTable[first].addr
+      && RoutingTable[last].len == RoutingTable[first].len)
+    last++;
+  return last;
+}
+
+/**
+ * Whether any path of the group [first, last) is learnt from if_index
+ */
+bool learntFrom(size_t first, size_t last, uint32_t if_index){
+  for(size_t i = first; i < last; i++)
+    if(RoutingTable[i].if_index == if_index)
+      return true;
+  return false;
+}
+
+/**
+ * Whether the group [first, last) may be advertised
+ * Routes restored from a snapshot are not, until RIP confirms one of their paths
+ */
+bool advertised(size_t first, size_t last){
+  for(size_t i = first; i < last; i++)
+    if(!RoutingTable[i].stale)
+      return true;
+  return false;
 }
 
 /**
  * Send the whole RoutingTable
- * Split horizon is used
+ * Split horizon is used, a prefix with equal-cost paths is sent once
+ * and only to interfaces none of its paths is learnt from
  */
 void sendWholeTable(uint32_t src_addr, uint32_t dst_addr, macaddr_t src_mac, uint32_t if_index, uint8_t ttl){
   // only need to respond to whole table requests in the lab
   RipPacket resp;
-  auto it = RoutingTable.begin();
-  while(it != RoutingTable.end()){
+  size_t first = 0, last;
+  while(first < RoutingTable.size()){
   int pos = 0;
-  for(; pos < RIP_MAX_ENTRY && it != RoutingTable.end(); it++){
-    if(it->if_index != if_index) // split horizon
-      convertRoutingEntryToRipEntry(*it, resp.entries[pos++]);
+  for(; pos < RIP_MAX_ENTRY && first < RoutingTable.size(); first = last){
+    last = groupEnd(first);
+    if(advertised(first, last) && !learntFrom(first, last, if_index)) // split horizon
+      convertRoutingEntryToRipEntry(RoutingTable[first], resp.entries[pos++]);
   }
   // no entry is left after performing split horizon, no need to send
   if(pos == 0){
-    printf("nothing to send after split horizon");
+    LOG(DEBUG, "nothing to send after split horizon");
     return;
   }
   resp.numEntries = pos;
@@ -181,40 +377,56 @@ void sendWholeTable(uint32_t src_addr, uint32_t dst_addr, macaddr_t src_mac, uin
   // send it back
   HAL_SendIPPacket(if_index, output, rip_len + 20 + 8, src_mac);
   }
-  printf("whole table sent\n");
+  LOG(DEBUG, "whole table sent");
 }
 
 /**
- * For every entry in RoutingTable, this function checks:
- * -if the entry's deletion timer is due, remove it from table
- * -otherwise, if the entry times out, change its metric to 16 and mark it as changed
+ * For every prefix in RoutingTable, this function checks each of its paths:
+ * -if the path's deletion timer is due, remove it from table
+ * -otherwise, if the path times out, remove it if an equal-cost path is still alive,
+ *  or change its metric to 16 and mark it as changed
+ * The order of RoutingTable is kept, so paths of a prefix stay adjacent
  */
 void refreshRoutingTable(){
   uint64_t currentTime = HAL_GetTicks();
-  int total = RoutingTable.size();
-  int iter = 0;
-  while(iter < total){
-    if(RoutingTable[iter].nexthop == 0){ // direct network, should never be deleted or timed out
-      iter++;
+  size_t total = RoutingTable.size();
+  size_t first = 0, last, kept = 0;
+  for(; first < total; first = last){
+    last = groupEnd(first);
+    size_t groupBegin = kept;
+    if(RoutingTable[first].nexthop == 0){ // direct network, should never be deleted or timed out
+      RoutingTable[kept++] = RoutingTable[first];
       continue;
     }
-    // deletion
-    if(currentTime - RoutingTable[iter].timestamp > DELETION_SEC * 1000){
-      RoutingTable[iter] = RoutingTable[total - 1];
-      total--;
-      // iter is unchanged, since element at iter is a new one
-      continue;
-    }
-    // timeout
-    if(currentTime - RoutingTable[iter].timestamp > TIMEOUT_SEC * 1000){
-      RoutingTable[iter].metric = 16;
-      RoutingTable[iter].change_flag = 1;
+    int alive = 0;
+    for(size_t i = first; i < last; i++)
+      if(RoutingTable[i].metric < 16 && currentTime - RoutingTable[i].timestamp <= TIMEOUT_SEC * 1000)
+        alive++;
+    bool changed = false;
+    for(size_t i = first; i < last; i++){
+      RoutingTableEntry entry = RoutingTable[i];
+      // deletion
+      if(currentTime - entry.timestamp > DELETION_SEC * 1000){
+        changed = true;
+        continue;
+      }
+      // timeout
+      if(entry.metric < 16 && currentTime - entry.timestamp > TIMEOUT_SEC * 1000){
+        changed = true;
+        // the prefix is still reachable through the other paths
+        if(alive > 0)
+          continue;
+        entry.metric = 16;
+        entry.change_flag = 1;
+      }
+      RoutingTable[kept++] = entry;
     }
-    iter++;
+    if(changed)
+      fibSet(RoutingTable[groupBegin].addr, RoutingTable[groupBegin].len,
+             &RoutingTable[groupBegin], kept - groupBegin);
   }
   // remove deleted entries
-  for(int i = RoutingTable.size(); i > total; i--)
-    RoutingTable.pop_back();
+  RoutingTable.resize(kept);
 }
 
 /**
@@ -228,18 +440,23 @@ void clearChangeFlag(){
 
 /**
  * Send all entries marked as changed in a triggered update
+ * A prefix is changed if any of its paths is
  * If at least one entry is marked as changed, send packet and return true
  * else return false
  * Note: this function doesn't change the content of RoutingTable
  */
 bool sendUpdated(uint32_t src_addr, uint32_t dst_addr, macaddr_t src_mac, uint32_t if_index, uint8_t ttl){
   RipPacket resp;
-  auto it = RoutingTable.begin();
-  while(it != RoutingTable.end()){
+  size_t first = 0, last;
+  while(first < RoutingTable.size()){
   int pos = 0;
-  for(; pos < RIP_MAX_ENTRY && it != RoutingTable.end(); it++){
-    if(it->change_flag && it->if_index != if_index)
-      convertRoutingEntryToRipEntry(*it, resp.entries[pos++]);
+  for(; pos < RIP_MAX_ENTRY && first < RoutingTable.size(); first = last){
+    last = groupEnd(first);
+    bool changed = false;
+    for(size_t i = first; i < last; i++)
+      changed |= RoutingTable[i].change_flag != 0;
+    if(changed && advertised(first, last) && !learntFrom(first, last, if_index))
+      convertRoutingEntryToRipEntry(RoutingTable[first], resp.entries[pos++]);
   }
   if(pos == 0)
     return false;
@@ -252,16 +469,372 @@ bool sendUpdated(uint32_t src_addr, uint32_t dst_addr, macaddr_t src_mac, uint32
   // send it back
   HAL_SendIPPacket(if_index, output, rip_len + 20 + 8, src_mac);
   }
-  printf("updated sent\n");
+  LOG(DEBUG, "updated sent");
   return true;
 }
 
-int main(int argc, char *argv[]) {
+uint64_t last_time = 0;
+// the next interface in ripIfaces to get the periodic update
+size_t update_cursor = 0;
+// timer for triggered update
+uint64_t triggered_update = 0;
+// timer for refreshing table
+uint64_t refresh_time = 0;
+// timer for writing snapshot
+uint64_t snapshot_time = 0;
+// where the routing table is saved, NULL for no snapshot at all
+const char *snapshotFile = SNAPSHOT_FILE;
+// where the HAL counters are published, NULL to keep them in memory
+const char *statsFile = STATS_FILE;
+// where the control socket listens, NULL for none
+const char *controlFile = CONTROL_FILE;
+// mirror the FIB into the kernel, which then forwards transit packets, Linux only
+bool fibOffload = false;
+// mirror the FIB into an XDP program that forwards what it can, Linux only
+bool xdpFastPath = false;
+// XDP_FLAGS_SKB_MODE and the like, 0 lets the kernel choose
+int xdpFlags = 0;
+// how HAL_ReceiveIPPacket waits for packets, see HAL_SetReceivePolicy
+int rxPolicy = HAL_RX_BLOCK;
+int rxSpinUs = HAL_RX_SPIN_US;
+
+const char *stageNames[N_STAGE] = {"receive", "checksum", "dst_is_me", "query", "arp", "forward", "send"};
+HAL_Histogram *stageHist[N_STAGE];
+// stand-ins when the HAL has no stats page
+HAL_Histogram localStageHist[N_STAGE];
+// cycles and nanoseconds at timingInit, to find the rate of readCycles
+uint64_t timingCycles = 0, timingNs = 0;
+// set by SIGUSR1, the histograms are printed by the next routerPoll
+volatile sig_atomic_t timingDump = 0;
+
+uint64_t monotonicNs() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+/**
+ * Attach the stage histograms to the stats page
+ * Call it after HAL_StatsOpen, which moves the page
+ */
+void timingInit() {
+  for (int i = 0; i < N_STAGE; i++) {
+    stageHist[i] = HAL_StatsHistogram(i, stageNames[i]);
+    if (!stageHist[i])
+      stageHist[i] = &localStageHist[i];
+  }
+  timingCycles = readCycles();
+  timingNs = monotonicNs();
+}
+
+/**
+ * Measure the rate of readCycles since timingInit, so that readers can convert
+ * the histograms to time
+ */
+void timingCalibrate() {
+  uint64_t ns = monotonicNs() - timingNs;
+  if (ns == 0)
+    return;
+  uint64_t hz = (uint64_t)((double)(readCycles() - timingCycles) * 1e9 / ns);
+  for (int i = 0; i < N_STAGE; i++)
+    stageHist[i]->unit_hz = hz;
+}
+
+/**
+ * Print packets, average and percentiles of every stage in nanoseconds
+ */
+void printTiming(FILE *fp) {
+  timingCalibrate();
+  fprintf(fp, "%-10s %12s %10s %10s %10s %10s %10s\n", "stage", "packets",
+          "avg ns", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+  for (int i = 0; i < N_STAGE; i++) {
+    const HAL_Histogram *h = stageHist[i];
+    double ns = h->unit_hz ? 1e9 / h->unit_hz : 1;
+    fprintf(fp, "%-10s %12llu %10.1f %10.0f %10.0f %10.0f %10.0f\n", stageNames[i],
+            (unsigned long long)h->count, h->count ? h->sum * ns / h->count : 0,
+            HAL_HistogramPercentile(h, 0.5) * ns, HAL_HistogramPercentile(h, 0.99) * ns,
+            HAL_HistogramPercentile(h, 0.999) * ns, h->max * ns);
+  }
+}
+
+void onTimingSignal(int) {
+  timingDump = 1;
+}
+
+/**
+ * Send the changed routes to every RIP interface, then start the cool down
+ */
+void sendTriggeredUpdate(uint64_t time){
+  macaddr_t mac_addr;
+  for(size_t k = 0; k < ripIfaces.size(); k++){
+    uint32_t i = ripIfaces[k];
+    if(HAL_ArpGetMacAddress(i, MULTICAST_ADDR, mac_addr) == 0){
+      sendUpdated(ifAddrs[i], MULTICAST_ADDR, mac_addr, i, 1);
+    }
+  }
+  clearChangeFlag();
+  triggered_update = time + TRIGGERED_CD * 1000;
+}
+
+/**
+ * The route to the network of interface i
+ */
+RoutingTableEntry directRoute(uint32_t i, uint64_t time){
+  RoutingTableEntry entry = {
+      .addr = ifAddrs[i] & 0xffffff, // big endian, only keep the lower 24 bits
+      .len = 24,        // small endian
+      .if_index = i,    // small endian
+      .nexthop = 0,     // big endian, means direct
+      .metric = 1,      // need only 1 hop for direct connected networks
+      .timestamp = time,
+      .change_flag = 0, // TODO: should the flag be 1?
+      .stale = 0
+      //.learnt_from_if = N_IFACE_ON_BOARD // learnt from no one
+  };
+  return entry;
+}
+
+/**
+ * HAL_SetLinkCallback, the link of if_index went down or came back up
+ * Down: a path through if_index is removed if its prefix has another one,
+ * otherwise poisoned and left to the deletion timer as if it had timed out;
+ * the direct network is poisoned until the link is back, a neighbor on the
+ * same network may replace it meanwhile
+ * Up: the direct network is restored, inserted again if it was replaced,
+ * and the neighbors are asked for their tables
+ * Either way the neighbors hear of it in a triggered update at once,
+ * instead of TIMEOUT_SEC later
+ */
+void onLinkChange(int if_index, int up){
+  if(if_index < 0 || (size_t)if_index >= ifAddrs.size())
+    return;
+  LOG(INFO, "link of interface %d %s", if_index, up ? "up" : "down");
+  uint64_t time = HAL_GetTicks();
+  size_t total = RoutingTable.size();
+  size_t first = 0, last, kept = 0;
+  bool direct = false;
+  for(; first < total; first = last){
+    last = groupEnd(first);
+    size_t groupBegin = kept;
+    int others = 0;
+    for(size_t i = first; i < last; i++)
+      if(RoutingTable[i].if_index != (uint32_t)if_index && RoutingTable[i].metric < 16)
+        others++;
+    bool changed = false;
+    for(size_t i = first; i < last; i++){
+      RoutingTableEntry entry = RoutingTable[i];
+      if(entry.if_index == (uint32_t)if_index && entry.nexthop == 0){
+        // direct network
+        direct = true;
+        uint32_t metric = up ? 1 : 16;
+        if(entry.metric != metric){
+          entry.metric = metric;
+          entry.timestamp = time;
+          entry.change_flag = 1;
+          changed = true;
+        }
+      }else if(entry.if_index == (uint32_t)if_index && !up && entry.metric < 16){
+        changed = true;
+        if(others > 0)
+          continue;
+        entry.metric = 16;
+        entry.change_flag = 1;
+        // the deletion timer starts now
+        entry.timestamp = time - TIMEOUT_SEC * 1000;
+      }
+      RoutingTable[kept++] = entry;
+    }
+    if(changed){
+      fibSet(RoutingTable[groupBegin].addr, RoutingTable[groupBegin].len,
+             &RoutingTable[groupBegin], kept - groupBegin);
+      hasUpdate = true;
+    }
+  }
+  RoutingTable.resize(kept);
+  if(up && !direct){
+    RoutingTableEntry entry = directRoute(if_index, time);
+    entry.change_flag = 1;
+    update(true, entry);
+    hasUpdate = true;
+  }
+  // back up: the neighbors on if_index, down: the others, for new paths
+  for(size_t k = 0; k < ripIfaces.size(); k++){
+    uint32_t i = ripIfaces[k];
+    macaddr_t mac_addr;
+    if((i == (uint32_t)if_index) == (up != 0) && HAL_ArpGetMacAddress(i, MULTICAST_ADDR, mac_addr) == 0)
+      sendRequest(ifAddrs[i], MULTICAST_ADDR, mac_addr, i, 1);
+  }
+  // a failover should not wait for the cool down
+  if(hasUpdate)
+    sendTriggeredUpdate(time);
+}
+
+/**
+ * The hello session to nexthop on if_index went down, see hello.cpp
+ * Its paths are withdrawn as those of a link that went down, but they are
+ * found through prefixes, the ones learnt from it, with a binary search each
+ * instead of a scan of RoutingTable
+ */
+void onNeighborDown(uint32_t nexthop, uint32_t if_index, const std::vector<std::pair<uint32_t, uint32_t>>& prefixes){
+  uint64_t time = HAL_GetTicks();
+  for(size_t k = 0; k < prefixes.size(); k++){
+    RoutingTableEntry key;
+    key.addr = prefixes[k].first;
+    key.len = prefixes[k].second;
+    size_t first = std::lower_bound(RoutingTable.begin(), RoutingTable.end(), key,
+        [](const RoutingTableEntry& a, const RoutingTableEntry& b){
+          return a.addr < b.addr || (a.addr == b.addr && a.len < b.len);
+        }) - RoutingTable.begin();
+    if(first == RoutingTable.size() || RoutingTable[first].addr != key.addr || RoutingTable[first].len != key.len)
+      continue;
+    size_t last = groupEnd(first);
+    size_t path = last;
+    int others = 0;
+    for(size_t i = first; i < last; i++){
+      if(RoutingTable[i].nexthop == nexthop && RoutingTable[i].if_index == if_index && RoutingTable[i].metric < 16)
+        path = i;
+      else if(RoutingTable[i].metric < 16)
+        others++;
+    }
+    if(path == last)
+      continue;
+    if(others > 0){
+      RoutingTable.erase(RoutingTable.begin() + path);
+      last--;
+    }else{
+      RoutingTable[path].metric = 16;
+      RoutingTable[path].change_flag = 1;
+      // the deletion timer starts now
+      RoutingTable[path].timestamp = time - TIMEOUT_SEC * 1000;
+    }
+    fibSet(key.addr, key.len, &RoutingTable[first], last - first);
+    hasUpdate = true;
+  }
+  // the other neighbors may know other paths
+  for(size_t k = 0; k < ripIfaces.size(); k++){
+    uint32_t i = ripIfaces[k];
+    macaddr_t mac_addr;
+    if(HAL_ArpGetMacAddress(i, MULTICAST_ADDR, mac_addr) == 0)
+      sendRequest(ifAddrs[i], MULTICAST_ADDR, mac_addr, i, 1);
+  }
+  if(hasUpdate)
+    sendTriggeredUpdate(time);
+}
+
+#ifdef ROUTER_BACKEND_LINUX
+/**
+ * Queue a FIB change for the kernel, sent by the next routerPoll
+ * Direct networks are left to the kernel, which has them from the interface addresses
+ */
+void offloadRoute(uint32_t addr, uint32_t len, const FibEntry* paths, int n) {
+  in_addr_t nexthops[ECMP_MAX_PATHS];
+  int if_indices[ECMP_MAX_PATHS];
+  for (int i = 0; i < n; i++) {
+    if (paths[i].nexthop == 0)
+      return;
+    nexthops[i] = paths[i].nexthop;
+    if_indices[i] = paths[i].if_index;
+  }
+  int res = HAL_OffloadRoute(addr, len, nexthops, if_indices, n);
+  if (res != 0)
+    LOG_RATE(1000, WARN, "failed to offload %u.%u.%u.%u/%u: %d", addr & 0xff, (addr >> 8) & 0xff,
+             (addr >> 16) & 0xff, addr >> 24, len, res);
+}
+
+/**
+ * Give a FIB change to the XDP program, direct routes included
+ * It takes the first of equal-cost paths, other flows are not spread
+ */
+void xdpRoute(uint32_t addr, uint32_t len, const FibEntry* paths, int n) {
+  int res = HAL_XdpUpdateRoute(addr, len, n ? paths[0].nexthop : 0, n ? paths[0].if_index : -1);
+  if (res != 0)
+    LOG_RATE(1000, WARN, "failed to give %u.%u.%u.%u/%u to XDP: %d", addr & 0xff, (addr >> 8) & 0xff,
+             (addr >> 16) & 0xff, addr >> 24, len, res);
+}
+
+// fibNotify, for whichever of the above is on
+void mirrorRoute(uint32_t addr, uint32_t len, const FibEntry* paths, int n) {
+  if (fibOffload)
+    offloadRoute(addr, len, paths, n);
+  if (xdpFastPath)
+    xdpRoute(addr, len, paths, n);
+}
+#endif
+
+/**
+ * Initialize HAL and the routing table, and ask the neighbors for their tables
+ * @return 0 on success, the error of HAL_Init otherwise
+ */
+int routerInit() {
   // 0a.
-  int res = HAL_Init(1, addrs);
+  if (statsFile && HAL_StatsOpen(statsFile) != 0)
+    LOG(WARN, "failed to open stats file %s", statsFile);
+  ifAddrs.clear();
+  ripIfaces.clear();
+  ifMtu.clear();
+  // before HAL_Init, which sets up the sockets for it
+  HAL_SetReceivePolicy(rxPolicy, rxSpinUs);
+  int res;
+  if (ifaceFile) {
+    std::vector<std::string> names;
+    if (loadInterfaces(names) != 0) {
+      LOG(WARN, "failed to read interfaces from %s", ifaceFile);
+      return HAL_ERR_INVALID_PARAMETER;
+    }
+    std::vector<const char *> namePtrs;
+    for (size_t i = 0; i < names.size(); i++)
+      namePtrs.push_back(names[i].c_str());
+    res = HAL_InitInterfaces(1, ifAddrs.size(), namePtrs.data(), ifAddrs.data());
+  } else {
+    for (uint32_t i = 0; i < N_IFACE_ON_BOARD; i++) {
+      ifAddrs.push_back(addrs[i]);
+      ifMtu.push_back(0);
+      if (enables[i])
+        ripIfaces.push_back(i);
+    }
+    res = HAL_Init(1, addrs);
+  }
   if (res < 0) {
     return res;
   }
+  for (uint32_t i = 0; i < ifMtu.size(); i++) {
+    int mtu = HAL_GetInterfaceMtu(i);
+    if (ifMtu[i] == 0)
+      ifMtu[i] = mtu >= 68 ? std::min(mtu, HAL_MAX_MTU) : 1500;
+  }
+  localAddrs = ifAddrs;
+  std::sort(localAddrs.begin(), localAddrs.end());
+  timingInit();
+#ifdef ROUTER_BACKEND_LINUX
+  // before any route is added, so that the whole FIB is mirrored
+  if (fibOffload) {
+    int removed = HAL_OffloadClear();
+    if (removed >= 0) {
+      LOG(INFO, "FIB offload on, %d routes of the last run removed", removed);
+    } else {
+      LOG(WARN, "FIB offload unavailable: %d", removed);
+      fibOffload = false;
+    }
+  }
+  if (xdpFastPath) {
+    int res = HAL_XdpAttach(xdpFlags);
+    if (res == 0) {
+      LOG(INFO, "XDP fast path on");
+    } else {
+      LOG(WARN, "XDP fast path unavailable: %d", res);
+      xdpFastPath = false;
+    }
+  }
+  if (fibOffload || xdpFastPath)
+    fibNotify = mirrorRoute;
+#else
+  fibOffload = false;
+  xdpFastPath = false;
+#endif
+#ifdef ROUTER_PROFILE
+  // kill -USR1 prints the stage histograms
+  signal(SIGUSR1, onTimingSignal);
+#endif
   
   srand(time(0));
 
@@ -271,31 +844,34 @@ int main(int argc, char *argv[]) {
   // 192.168.4.0/24 if 1
   // 10.0.2.0/24 if 2
   // 10.0.3.0/24 if 3
-  for (uint32_t i = 0; i < N_IFACE_ON_BOARD; i++) {
-    RoutingTableEntry entry = {
-        .addr = addrs[i] & 0xffffff, // big endian, only keep the lower 24 bits
-        .len = 24,        // small endian
-        .if_index = i,    // small endian
-        .nexthop = 0,     // big endian, means direct
-        .metric = 1,      // need only 1 hop for direct connected networks
-        .timestamp = HAL_GetTicks(), // init time
-        .change_flag = 0  // TODO: should the flag be 1?
-        //.learnt_from_if = N_IFACE_ON_BOARD // learnt from no one
-    };
-    update(true, entry);
-  }
+  // one update() each unless there are BULK_LOAD_MIN interfaces or more
+  std::vector<RoutingTableEntry> direct(ifAddrs.size());
+  for (uint32_t i = 0; i < ifAddrs.size(); i++)
+    direct[i] = directRoute(i, HAL_GetTicks());
+  bulk_load(direct.data(), direct.size());
+
+  // 0c. Warm restart, forward with the routes of the last run until RIP catches up
+  int restored = snapshotFile ? loadSnapshot(snapshotFile) : -1;
+  if(restored >= 0)
+    LOG(INFO, "%d routes restored from %s", restored, snapshotFile);
   
+  if (controlFile && controlOpen(controlFile) != 0)
+    LOG(WARN, "failed to open control socket %s", controlFile);
+
+  // routes through an interface are withdrawn as soon as its link goes down
+  if (HAL_SetLinkCallback(onLinkChange) == 0)
+    LOG(INFO, "link state monitoring on");
+
   // init output buffer
   memset(output, 0, sizeof(output));
   
-  for(int i = 0; i < N_IFACE_ON_BOARD; i++){
-    if(!enables[i])
-      continue;
+  for(size_t k = 0; k < ripIfaces.size(); k++){
+    uint32_t i = ripIfaces[k];
     macaddr_t mac_addr;
     if(HAL_ArpGetMacAddress(i, MULTICAST_ADDR, mac_addr) == 0)
-      sendRequest(addrs[i], MULTICAST_ADDR, mac_addr, i, 1);
+      sendRequest(ifAddrs[i], MULTICAST_ADDR, mac_addr, i, 1);
     else
-      printf("get multicast address error when sending request\n");
+      LOG(WARN, "get multicast address error when sending request");
   }
   
   // for debug
@@ -309,176 +885,309 @@ int main(int argc, char *argv[]) {
     //printf("ICMP debug\n");
   }
   
-  uint64_t last_time = 0;
-  // timer for triggered update
-  uint64_t triggered_update = 0;
-  // timer for refreshing table
-  uint64_t refresh_time = 0;
-  while (1) {
-    uint64_t time = HAL_GetTicks();
-    // bool surpressTriggeredUpdate = false;
-    if (time > last_time + MULTICAST_SEC * 1000) {
-      // What to do?
-      // send complete routing table to every interface
-      // ref. RFC2453 3.8
-      macaddr_t mac_addr;
-      for(int i = 0; i < N_IFACE_ON_BOARD; i++){
-        if(!enables[i])
-          continue;
-        if(HAL_ArpGetMacAddress(i, MULTICAST_ADDR, mac_addr) == 0)
-          sendWholeTable(addrs[i], MULTICAST_ADDR, mac_addr, i, 1);
-        else
-          printf("get multicast address error\n");
-      }
-      printTable();
-      clearChangeFlag();
-      printf("%ds Timer\n", MULTICAST_SEC);
-      last_time = time;
-      // supress triggered update for 1 - 5 seconds
-      // triggered_update = last_time + TRIGGERED_CD * 1000;
-    }
-    
-    if(time > refresh_time + REFRESH_SEC * 1000){
-      refreshRoutingTable();
-      refresh_time += REFRESH_SEC * 1000;
-    }
-    
-    // send triggered update, when cool down is ready and no multicast is pending in 3 seconds
-    // only triggered update is restricted by such kind of cool down
-    // reception of IP packet is not influenced
-    if(time > triggered_update && hasUpdate){ //&& time < last_time + 27 * 1000){
+  snapshot_time = HAL_GetTicks();
+  return 0;
+}
+
+/**
+ * Run the timers, then receive and handle at most one packet
+ * @return what HAL_ReceiveIPPacket returned: the length of the packet handled,
+ * 0 on timeout, or an error such as HAL_ERR_EOF
+ */
+int routerPoll() {
+  uint64_t time = HAL_GetTicks();
+  if (timingDump) {
+    timingDump = 0;
+    printTiming(stderr);
+  }
+  // bool surpressTriggeredUpdate = false;
+  // send complete routing table to every interface
+  // ref. RFC2453 3.8
+  // the interfaces take turns, so their updates are spread over the interval
+  // instead of all leaving at once
+  size_t turns = std::max<size_t>(ripIfaces.size(), 1);
+  if (time > last_time + MULTICAST_SEC * 1000 / turns) {
+    if (update_cursor < ripIfaces.size()) {
+      uint32_t i = ripIfaces[update_cursor];
       macaddr_t mac_addr;
-      for(int i = 0; i < N_IFACE_ON_BOARD; i++){
-        if(enables[i] && HAL_ArpGetMacAddress(i, MULTICAST_ADDR, mac_addr) == 0){
-          sendUpdated(addrs[i], MULTICAST_ADDR, mac_addr, i, 1);
-        }
-      }
-      clearChangeFlag();
-      triggered_update = time + TRIGGERED_CD * 1000;
+      if(HAL_ArpGetMacAddress(i, MULTICAST_ADDR, mac_addr) == 0)
+        sendWholeTable(ifAddrs[i], MULTICAST_ADDR, mac_addr, i, 1);
+      else
+        LOG(WARN, "get multicast address error");
     }
-    
-
-    int mask = (1 << N_IFACE_ON_BOARD) - 1;
-    macaddr_t src_mac;
-    macaddr_t dst_mac;
-    int if_index;
-    res = HAL_ReceiveIPPacket(mask, packet, sizeof(packet), src_mac, dst_mac,
-                              1000, &if_index);
-    if (res == HAL_ERR_EOF) {
-      break;
-    } else if (res < 0) {
-      return res;
-    } else if (res == 0) {
-      // Timeout
-      continue;
-    } else if (res > sizeof(packet)) {
-      // packet is truncated, ignore it
-      continue;
+    last_time = time;
+    // change flags are left to the triggered update, as the interfaces that
+    // had their turn before a change have not seen it
+    if (++update_cursor >= turns) {
+      // every interface has had the whole table
+      update_cursor = 0;
+      printTable();
+      printRouteCacheStats();
+      timingCalibrate();
+      LOG(DEBUG, "%ds Timer", MULTICAST_SEC);
     }
+    // supress triggered update for 1 - 5 seconds
+    // triggered_update = last_time + TRIGGERED_CD * 1000;
+  }
+  
+  // hellos and the liveness of neighbors, at a finer grain than the rest
+  uint64_t helloDue = helloPoll(time);
 
-    // 1. validate
-    if (!validateIPChecksum(packet, res)) {
-      printf("Invalid IP Checksum\n");
-      continue;
-    }
-    in_addr_t src_addr = *((uint32_t*)(packet + 12)), 
-      dst_addr = *((uint32_t*)(packet + 16));
-    // extract src_addr and dst_addr from packet
-    // big endian
-
-    // 2. check whether dst is me
-    bool dst_is_me = false;
-    bool is_multicast = false;
-    for (int i = 0; i < N_IFACE_ON_BOARD; i++) {
-      if (memcmp(&dst_addr, &addrs[i], sizeof(in_addr_t)) == 0) {
-        dst_is_me = true;
-        break;
+  if(time > refresh_time + REFRESH_SEC * 1000){
+    refreshRoutingTable();
+    refresh_time += REFRESH_SEC * 1000;
+  }
+
+  if(snapshotFile && time > snapshot_time + SNAPSHOT_SEC * 1000){
+    saveSnapshot(snapshotFile);
+    snapshot_time = time;
+  }
+  
+  // send triggered update, when cool down is ready and no multicast is pending in 3 seconds
+  // only triggered update is restricted by such kind of cool down
+  // reception of IP packet is not influenced
+  if(time > triggered_update && hasUpdate){ //&& time < last_time + 27 * 1000){
+    sendTriggeredUpdate(time);
+  }
+  
+
+#ifdef ROUTER_BACKEND_LINUX
+  // routes changed since the last poll reach the kernel in one batch
+  if (fibOffload) {
+    int failed = HAL_OffloadFlush();
+    if (failed != 0)
+      LOG_RATE(1000, WARN, "kernel rejected %d offloaded routes", failed);
+  }
+#endif
+
+  // don't wait for packets while a control client has output queued
+  bool controlBusy = controlPoll();
+  // nor past the next turn of the periodic update
+  int64_t wait = controlBusy ? 0 : 1000;
+  uint64_t turn = last_time + MULTICAST_SEC * 1000 / turns;
+  if (turn < time + wait)
+    wait = turn > time ? turn - time : 0;
+  if (helloDue < time + wait)
+    wait = helloDue > time ? helloDue - time : 0;
+
+  macaddr_t src_mac;
+  macaddr_t dst_mac;
+  int if_index;
+  TIMING_START();
+#ifdef ROUTER_BACKEND_AFXDP
+  // the packet stays in the frame it was received in, forwarding rewrites and
+  // sends that frame
+  int mask = (1 << N_IFACE_ON_BOARD) - 1;
+  uint8_t *packet;
+  int res = HAL_AfxdpReceiveInPlace(mask, &packet, src_mac, dst_mac,
+                            wait, &if_index);
+#else
+  int res = HAL_ReceiveIPPacketAny(packet, sizeof(packet), src_mac, dst_mac,
+                            wait, &if_index);
+#endif
+  if (res <= 0) {
+    // error or timeout
+    return res;
+  } else if (res > sizeof(::packet)) {
+    // packet is truncated, ignore it
+    HAL_StatsCountDrop(HAL_DROP_TRUNCATED);
+    return res;
+  }
+  TIMING_MARK(STAGE_RECEIVE);
+
+  // 1. validate
+  if (!validateIPChecksum(packet, res)) {
+    HAL_StatsCountDrop(HAL_DROP_CHECKSUM);
+    LOG_RATE(1000, WARN, "Invalid IP Checksum");
+    return res;
+  }
+  TIMING_MARK(STAGE_CHECKSUM);
+  in_addr_t src_addr = *((uint32_t*)(packet + 12)), 
+    dst_addr = *((uint32_t*)(packet + 16));
+  // extract src_addr and dst_addr from packet
+  // big endian
+
+  // 2. check whether dst is me
+  bool dst_is_me = isLocalAddr(dst_addr);
+  bool is_multicast = false;
+  
+  if(dst_addr == MULTICAST_ADDR) { // 224.0.0.9. multicast
+    dst_is_me = true;
+    is_multicast = true;
+  }
+  TIMING_MARK(STAGE_DST_IS_ME);
+  
+  if (dst_is_me && helloReceive(packet, res, if_index)) {
+    // 3a.0 a hello, see hello.cpp
+  } else if (dst_is_me) {
+    // 3a.1
+    RipPacket rip;
+    // check and validate
+    if (disassemble(packet, res, &rip)) {
+      if (rip.command == 1) { // command type is REQUEST
+        // 3a.3 request, ref. RFC2453 3.9.1
+        // send only to the requester
+        sendWholeTable(is_multicast ? ifAddrs[if_index] : dst_addr, src_addr, src_mac, if_index, 1);
+      } else { // command type is RESPONSE
+        // 3a.2 response, ref. RFC2453 3.9.2
+        // not from RIP port(in UDP header)
+        if(packet[20] != 0x02 || packet[21] != 0x08)
+          return res;
+        // ignore packets from the router itself
+        if(isLocalAddr(src_addr))
+          return res;
+        // update begin
+        RoutingTableEntry rte[RIP_MAX_ENTRY];
+        for(int i = 0; i < rip.numEntries; i++){
+          // update metric
+          if(rip.entries[i].metric >> 24 < 16)
+            rip.entries[i].metric += 1 << 24;
+          convertRipEntryToRoutingEntry(rip.entries[i], rte[i], if_index, src_addr);
+        }
+        // at most RIP_MAX_ENTRY entries, below BULK_LOAD_MIN: one update() each,
+        // which is what a response of mostly refreshed routes needs
+        bulk_load(rte, rip.numEntries);
+        // so that the paths through src_addr are found when its hellos stop
+        helloLearn(src_addr, if_index, rte, rip.numEntries);
+        // update routing table
+        // new metric = ?
+        // update metric, if_index, nexthop
+        // what is missing from RoutingTableEntry?
+        // triggered updates? ref. RFC2453 3.10.1
       }
     }
-    
-    if(dst_addr == MULTICAST_ADDR) { // 224.0.0.9. multicast
-      dst_is_me = true;
-      is_multicast = true;
-    }
-    
-    if (dst_is_me) {
-      // 3a.1
-      RipPacket rip;
-      // check and validate
-      if (disassemble(packet, res, &rip)) {
-        if (rip.command == 1) { // command type is REQUEST
-          // 3a.3 request, ref. RFC2453 3.9.1
-          // send only to the requester
-          sendWholeTable(is_multicast ? addrs[if_index] : dst_addr, src_addr, src_mac, if_index, 1);
-        } else { // command type is RESPONSE
-          // 3a.2 response, ref. RFC2453 3.9.2
-          // not from RIP port(in UDP header)
-          if(packet[20] != 0x02 || packet[21] != 0x08)
-            continue;
-          // ignore packets from the router itself
-          for(int i = 0; i < N_IFACE_ON_BOARD; i++)
-            if(memcmp(addrs + i, packet + 12, sizeof(uint32_t)) == 0)
-              continue;
-          // update begin
-          RoutingTableEntry rte;
-          for(int i = 0; i < rip.numEntries; i++){
-            // update metric
-            if(rip.entries[i].metric >> 24 < 16)
-              rip.entries[i].metric += 1 << 24;
-            convertRipEntryToRoutingEntry(rip.entries[i], rte, if_index, src_addr);
-            update(true, rte);
-          }
-          // update routing table
-          // new metric = ?
-          // update metric, if_index, nexthop
-          // what is missing from RoutingTableEntry?
-          // triggered updates? ref. RFC2453 3.10.1
-        }
+  } else if (fibOffload) {
+    // 3b.0 the kernel forwards it, capture only gave us a copy
+  } else {
+    // 3b.1 dst is not me
+    // forward
+    // beware of endianness
+    uint32_t nexthop, dest_if;
+    macaddr_t dest_mac;
+    // hot destinations are resolved by the cache without query() and ARP
+    bool cached = routeCacheLookup(dst_addr, &nexthop, &dest_if, dest_mac);
+    // equal-cost paths are chosen per flow, they are never cached
+    int paths = cached ? 1 : routeCacheQuery(dst_addr, flowHash(packet), &nexthop, &dest_if);
+    TIMING_MARK(STAGE_QUERY);
+    if (paths > 0) {
+      // found
+      // direct routing
+      if (nexthop == 0) {
+        nexthop = dst_addr;
       }
-    } else {
-      // 3b.1 dst is not me
-      // forward
-      // beware of endianness
-      uint32_t nexthop, dest_if;
-      if (query(dst_addr, &nexthop, &dest_if)) {
+      if (cached || HAL_ArpGetMacAddress(dest_if, nexthop, dest_mac) == 0) {
         // found
-        macaddr_t dest_mac;
-        // direct routing
-        if (nexthop == 0) {
-          nexthop = dst_addr;
+        if (!cached && paths == 1)
+          routeCacheInsert(dst_addr, nexthop, dest_if, dest_mac);
+        if (!cached)
+          TIMING_MARK(STAGE_ARP);
+#ifdef ROUTER_BACKEND_AFXDP
+        uint8_t *out = packet;
+#else
+        uint8_t *out = output;
+        memcpy(output, packet, res);
+#endif
+        // update ttl and checksum
+        forward(out, res);
+        TIMING_MARK(STAGE_FORWARD);
+        // if ttl > 0
+        // a packet larger than the MTU it came in on was coalesced by GRO/GSO, the HAL segments it
+        if(out[8] != 0x0 && (res <= ifMtu[dest_if] || res > ifMtu[if_index])){
+          HAL_SendIPPacket(dest_if, out, res, dest_mac);
+          TIMING_MARK(STAGE_SEND);
+        }
+        else if(out[8] != 0x0 && (out[6] & 0x40)){
+          // DF: ICMP Fragmentation Needed
+          // type = 0x3(Destination unreachable), code = 0x4(fragmentation needed and DF set)
+          HAL_SendIPPacket(if_index, output, confICMP(ifAddrs[if_index], src_addr, 64, 0x3, 0x4, packet, ifMtu[dest_if]),
+            src_mac);
+          HAL_StatsCountDrop(HAL_DROP_TOO_BIG);
+          LOG_RATE(1000, WARN, "fragmentation needed for %x", dst_addr);
         }
-        if (HAL_ArpGetMacAddress(dest_if, nexthop, dest_mac) == 0) {
-          // found
-          memcpy(output, packet, res);
-          // update ttl and checksum
-          forward(output, res);
-          // if ttl > 0
-          if(output[8] != 0x0)
-            HAL_SendIPPacket(dest_if, output, res, dest_mac);
-          else{
-            // ICMP Time Exceeded
-            // type = 11(Time Exceeded), code = 0x0(ttl exceeded)
-            // HAL_SendIPPacket(if_index, output, confICMP(addrs[if_index], src_addr, 64, 0xb, 0x0),
-            //  dst_mac);
-            // send a RIP packet after an ICMP packet can lead to error due to none-zero fields in output buffer
-            // memset(output, 0, sizeof(output));
-            printf("ttl exceeded\n");
-          }
-        } else {
-          // not found
-          // you can drop it
-          printf("ARP not found for nexthop %x\n", nexthop);
+        else if(out[8] != 0x0){
+          sendFragments(out, res, dest_if, dest_mac);
+          TIMING_MARK(STAGE_SEND);
+        }
+        else{
+          // ICMP Time Exceeded
+          // type = 11(Time Exceeded), code = 0x0(ttl exceeded)
+          // HAL_SendIPPacket(if_index, output, confICMP(addrs[if_index], src_addr, 64, 0xb, 0x0),
+          //  dst_mac);
+          // send a RIP packet after an ICMP packet can lead to error due to none-zero fields in output buffer
+          // memset(output, 0, sizeof(output));
+          HAL_StatsCountDrop(HAL_DROP_TTL);
+          LOG_RATE(1000, WARN, "ttl exceeded");
         }
       } else {
         // not found
-        // optionally you can send ICMP Host Unreachable
-        // type = 0x3(Destination unreachable), code = 0x1(host unreachable)
-        //  HAL_SendIPPacket(if_index, output, confICMP(addrs[if_index], src_addr, 64, 0x3, 0x1),
-        //  dst_mac);
-        // memset(output, 0, sizeof(output));
-        printf("IP not found for %x\n", src_addr);
+        // you can drop it
+        HAL_StatsCountDrop(HAL_DROP_NO_ARP);
+        LOG_RATE(1000, WARN, "ARP not found for nexthop %x", nexthop);
       }
+    } else {
+      // not found
+      // optionally you can send ICMP Host Unreachable
+      // type = 0x3(Destination unreachable), code = 0x1(host unreachable)
+      //  HAL_SendIPPacket(if_index, output, confICMP(addrs[if_index], src_addr, 64, 0x3, 0x1),
+      //  dst_mac);
+      // memset(output, 0, sizeof(output));
+      HAL_StatsCountDrop(HAL_DROP_NO_ROUTE);
+      LOG_RATE(1000, WARN, "IP not found for %x", dst_addr);
+    }
+  }
+  return res;
+}
+
+#ifndef ROUTER_LIBRARY
+int main(int argc, char *argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "i:oxXp:b:")) != -1) {
+    if (opt == 'i') {
+      ifaceFile = optarg;
+    } else if (opt == 'o') {
+      fibOffload = true;
+    } else if (opt == 'x' || opt == 'X') {
+      xdpFastPath = true;
+#ifdef ROUTER_BACKEND_LINUX
+      xdpFlags = opt == 'X' ? XDP_FLAGS_SKB_MODE : 0;
+#endif
+    } else if (opt == 'p' && strncmp(optarg, "block", 5) == 0) {
+      rxPolicy = HAL_RX_BLOCK;
+    } else if (opt == 'p' && strncmp(optarg, "busy", 4) == 0) {
+      rxPolicy = HAL_RX_BUSY;
+      if (optarg[4] == ':')
+        rxSpinUs = atoi(optarg + 5);
+    } else if (opt == 'p' && strncmp(optarg, "adaptive", 8) == 0) {
+      rxPolicy = HAL_RX_ADAPTIVE;
+      if (optarg[8] == ':')
+        rxSpinUs = atoi(optarg + 9);
+    } else if (opt == 'b' && atoi(optarg) >= 1 && atoi(optarg) <= 65535) {
+      // hellos carry it in 16 bits
+      helloInterval = atoi(optarg);
+    } else {
+      fprintf(stderr, "usage: %s [-i FILE] [-o] [-x | -X] [-p POLICY] [-b MS]\n", argv[0]);
+      fprintf(stderr, "  -i  interfaces from FILE, a line \"NAME A.B.C.D [passive] [mtu N]\" for each\n");
+      fprintf(stderr, "  -o  offload routes to the kernel routing table (Linux)\n");
+      fprintf(stderr, "  -x  forward in an XDP program where possible (Linux)\n");
+      fprintf(stderr, "  -X  as -x, in generic mode that works on any interface\n");
+      fprintf(stderr, "  -p  wait for packets by block (default), busy[:US] or adaptive[:US],\n");
+      fprintf(stderr, "      which spins US microseconds (%d) after traffic\n", HAL_RX_SPIN_US);
+      fprintf(stderr, "  -b  send hellos every MS (1-65535) milliseconds, a neighbor silent for %d of them is down\n", HELLO_DETECT_MULT);
+      return 1;
+    }
+  }
+  int res = routerInit();
+  if (res < 0) {
+    return res;
+  }
+  while (1) {
+    res = routerPoll();
+    if (res == HAL_ERR_EOF) {
+      break;
+    } else if (res < 0) {
+      return res;
     }
   }
   return 0;
 }
+#endif
@@ -0,0 +1,501 @@
+#include "router.h"
+#include "router_hal.h"
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// Convergence simulator: many boilerplate routers in one process, joined by
+// the virtual links of the SIM backend and driven by its virtual clock
+// build with `make BACKEND=SIM sim`
+// usage: ./sim [-t line|ring|grid] [-n routers] [-l latency ms] [-p loss]
+//              [-d duration ms] [-f time:link]... [-F time:link]... [-u time:link]...
+//              [-a router:link]... [-b hello ms] [-s seed] [-v]
+// -f takes a link down, the routers at both ends are told, -F drops all of its
+// packets instead, which only hellos (-b) or RIP timeouts notice
+// -a puts a spare interface of router on the network of link, as a third
+// router on that LAN which stays reachable when the link fails at both ends
+
+extern int routerInit();
+extern int routerPoll();
+extern std::vector<RoutingTableEntry> RoutingTable;
+extern std::vector<FibEntry> Fib;
+extern uint32_t fibBegin[34];
+extern bool hasUpdate;
+extern uint32_t routeGeneration;
+extern in_addr_t addrs[N_IFACE_ON_BOARD];
+extern bool enables[N_IFACE_ON_BOARD];
+extern std::vector<in_addr_t> ifAddrs;
+extern std::vector<uint32_t> ripIfaces;
+extern std::vector<in_addr_t> localAddrs;
+extern std::vector<uint32_t> ifMtu;
+extern uint64_t last_time;
+extern size_t update_cursor;
+extern uint64_t triggered_update;
+extern uint64_t refresh_time;
+extern uint64_t snapshot_time;
+extern const char *snapshotFile;
+extern const char *statsFile;
+extern const char *controlFile;
+extern uint32_t helloInterval;
+extern uint64_t hello_time;
+extern std::vector<HelloNeighbor> helloNeighbors;
+extern uint64_t hellosSent, hellosReceived;
+
+// granularity of the router timers, packets are handled as soon as they arrive
+const uint64_t TICK_MS = 100;
+
+/**
+ * Everything a boilerplate router keeps in globals
+ * Any new per-router global of the boilerplate must be added here,
+ * the destination cache is left out as a generation change invalidates it
+ */
+struct RouterContext {
+  std::vector<RoutingTableEntry> rib;
+  std::vector<FibEntry> fib;
+  uint32_t fibBegin[34];
+  bool hasUpdate;
+  in_addr_t addrs[N_IFACE_ON_BOARD];
+  bool enables[N_IFACE_ON_BOARD];
+  std::vector<in_addr_t> ifAddrs;
+  std::vector<uint32_t> ripIfaces;
+  std::vector<in_addr_t> localAddrs;
+  std::vector<uint32_t> ifMtu;
+  uint64_t last_time;
+  size_t update_cursor;
+  uint64_t triggered_update;
+  uint64_t refresh_time;
+  uint64_t snapshot_time;
+  uint64_t hello_time;
+  std::vector<HelloNeighbor> helloNeighbors;
+  // statistics
+  uint64_t cpuNs;
+  uint64_t lastChange;
+};
+
+struct LinkEvent {
+  uint64_t time;
+  int link;
+  bool up;
+  // packets are lost, but the link stays up
+  bool silent;
+};
+
+std::vector<RouterContext> contexts;
+int currentRouter = -1;
+// generations are unique across routers, so no cached route outlives a switch
+uint32_t nextGeneration = 1;
+
+void saveContext(RouterContext &c) {
+  c.rib.swap(RoutingTable);
+  c.fib.swap(Fib);
+  memcpy(c.fibBegin, fibBegin, sizeof(c.fibBegin));
+  c.hasUpdate = hasUpdate;
+  memcpy(c.addrs, addrs, sizeof(c.addrs));
+  memcpy(c.enables, enables, sizeof(c.enables));
+  c.ifAddrs.swap(ifAddrs);
+  c.ripIfaces.swap(ripIfaces);
+  c.localAddrs.swap(localAddrs);
+  c.ifMtu.swap(ifMtu);
+  c.last_time = last_time;
+  c.update_cursor = update_cursor;
+  c.triggered_update = triggered_update;
+  c.refresh_time = refresh_time;
+  c.snapshot_time = snapshot_time;
+  c.hello_time = hello_time;
+  c.helloNeighbors.swap(helloNeighbors);
+}
+
+void loadContext(RouterContext &c) {
+  RoutingTable.swap(c.rib);
+  Fib.swap(c.fib);
+  memcpy(fibBegin, c.fibBegin, sizeof(c.fibBegin));
+  hasUpdate = c.hasUpdate;
+  memcpy(addrs, c.addrs, sizeof(c.addrs));
+  memcpy(enables, c.enables, sizeof(c.enables));
+  ifAddrs.swap(c.ifAddrs);
+  ripIfaces.swap(c.ripIfaces);
+  localAddrs.swap(c.localAddrs);
+  ifMtu.swap(c.ifMtu);
+  last_time = c.last_time;
+  update_cursor = c.update_cursor;
+  triggered_update = c.triggered_update;
+  refresh_time = c.refresh_time;
+  snapshot_time = c.snapshot_time;
+  hello_time = c.hello_time;
+  helloNeighbors.swap(c.helloNeighbors);
+  routeGeneration = nextGeneration;
+}
+
+void switchTo(int router) {
+  if (router == currentRouter) {
+    return;
+  }
+  if (currentRouter >= 0) {
+    saveContext(contexts[currentRouter]);
+  }
+  loadContext(contexts[router]);
+  HAL_SimSelect(router);
+  currentRouter = router;
+}
+
+uint64_t cpuNs() {
+  struct timespec tp;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+// 10.x.y.host, where x.y is the link number
+in_addr_t linkAddr(int link, int host) {
+  return 0x0a | ((link >> 8) & 0xff) << 8 | (link & 0xff) << 16 | host << 24;
+}
+
+// 100.(64 + 16 * if_index + router / 256).(router % 256).1 for unconnected interfaces
+in_addr_t stubAddr(int router, int if_index) {
+  return 100 | (64 + 16 * if_index + (router >> 8)) << 8 | (router & 0xff) << 16 | 1 << 24;
+}
+
+/**
+ * Connect two routers, giving both interfaces an address in a fresh /24
+ */
+int connectRouters(std::vector<RouterContext> &cs, int r1, int if1, int r2, int if2,
+                   uint64_t latency, double loss) {
+  int link = HAL_SimConnect(r1, if1, r2, if2, latency, loss);
+  if (link < 0) {
+    fprintf(stderr, "cannot connect %d.%d and %d.%d\n", r1, if1, r2, if2);
+    exit(1);
+  }
+  cs[r1].addrs[if1] = linkAddr(link, 1);
+  cs[r1].enables[if1] = true;
+  cs[r2].addrs[if2] = linkAddr(link, 2);
+  cs[r2].enables[if2] = true;
+  return link;
+}
+
+// the link of a linkAddr(), -1 for a stub address
+int addrLink(in_addr_t addr) {
+  return (addr & 0xff) == 0x0a ? (int)((addr >> 16 & 0xff) | (addr >> 8 & 0xff) << 8) : -1;
+}
+
+int buildTopology(const char *topology, int n, uint64_t latency, double loss) {
+  int links = 0;
+  if (strcmp(topology, "line") == 0 || strcmp(topology, "ring") == 0) {
+    // if 0 to the previous router, if 1 to the next
+    for (int i = 0; i + 1 < n; i++, links++) {
+      connectRouters(contexts, i, 1, i + 1, 0, latency, loss);
+    }
+    if (strcmp(topology, "ring") == 0 && n > 2) {
+      connectRouters(contexts, n - 1, 1, 0, 0, latency, loss);
+      links++;
+    }
+  } else if (strcmp(topology, "grid") == 0) {
+    // if 0/1 to the left/right, if 2/3 to the up/down
+    int width = (int)ceil(sqrt((double)n));
+    for (int i = 0; i < n; i++) {
+      if ((i + 1) % width != 0 && i + 1 < n) {
+        connectRouters(contexts, i, 1, i + 1, 0, latency, loss);
+        links++;
+      }
+      if (i + width < n) {
+        connectRouters(contexts, i, 3, i + width, 2, latency, loss);
+        links++;
+      }
+    }
+  } else {
+    fprintf(stderr, "unknown topology %s\n", topology);
+    exit(1);
+  }
+  return links;
+}
+
+bool parseEvent(const char *arg, bool up, bool silent, std::vector<LinkEvent> &events) {
+  LinkEvent e;
+  unsigned long long time;
+  if (sscanf(arg, "%llu:%d", &time, &e.link) != 2) {
+    return false;
+  }
+  e.time = time;
+  e.up = up;
+  e.silent = silent;
+  events.push_back(e);
+  return true;
+}
+
+// tx packets were sent in the phase, hellos of them
+void printPhase(uint64_t start, uint64_t change, uint64_t tx, uint64_t hellos) {
+  printf("%8llu ms: converged %llu ms after, %llu RIP packets sent",
+          (unsigned long long)start, (unsigned long long)(change - start),
+          (unsigned long long)(tx - hellos));
+  if (helloInterval > 0) {
+    printf(", %llu hellos", (unsigned long long)hellos);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *topology = "ring";
+  int n = 16;
+  uint64_t latency = 5;
+  double loss = 0;
+  uint64_t duration = 120000;
+  unsigned seed = 1;
+  bool verbose = false;
+  std::vector<LinkEvent> events;
+  std::vector<std::pair<int, int>> attached;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:l:p:d:f:F:u:a:b:s:v")) != -1) {
+    switch (opt) {
+    case 't':
+      topology = optarg;
+      break;
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 'l':
+      latency = strtoull(optarg, NULL, 10);
+      break;
+    case 'p':
+      loss = atof(optarg);
+      break;
+    case 'd':
+      duration = strtoull(optarg, NULL, 10);
+      break;
+    case 'f':
+    case 'F':
+    case 'u':
+      if (!parseEvent(optarg, opt == 'u', opt == 'F', events)) {
+        fprintf(stderr, "bad event %s, expecting time:link\n", optarg);
+        return 1;
+      }
+      break;
+    case 'a': {
+      int router, link;
+      if (sscanf(optarg, "%d:%d", &router, &link) != 2) {
+        fprintf(stderr, "bad attachment %s, expecting router:link\n", optarg);
+        return 1;
+      }
+      attached.push_back(std::make_pair(router, link));
+      break;
+    }
+    case 'b':
+      if (atoi(optarg) < 1 || atoi(optarg) > 65535) {
+        fprintf(stderr, "bad hello interval %s, expecting 1 to 65535 ms\n", optarg);
+        return 1;
+      }
+      helloInterval = atoi(optarg);
+      break;
+    case 's':
+      seed = atoi(optarg);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-t line|ring|grid] [-n routers] [-l latency ms] "
+              "[-p loss] [-d duration ms] [-f time:link]... [-F time:link]... "
+              "[-u time:link]... [-a router:link]... [-b hello ms] [-s seed] [-v]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (n < 2 || n > 4096) {
+    fprintf(stderr, "between 2 and 4096 routers are supported\n");
+    return 1;
+  }
+  std::sort(events.begin(), events.end(),
+            [](const LinkEvent &a, const LinkEvent &b) { return a.time < b.time; });
+
+  // routers share the process, they must not share snapshot, stats or control files
+  snapshotFile = NULL;
+  statsFile = NULL;
+  controlFile = NULL;
+  contexts.resize(n);
+  for (int i = 0; i < n; i++) {
+    HAL_SimCreateRouter();
+    RouterContext &c = contexts[i];
+    memset(c.fibBegin, 0, sizeof(c.fibBegin));
+    c.hasUpdate = false;
+    for (int j = 0; j < N_IFACE_ON_BOARD; j++) {
+      c.addrs[j] = stubAddr(i, j);
+      c.enables[j] = false;
+    }
+    c.last_time = c.triggered_update = c.refresh_time = c.snapshot_time = c.hello_time = 0;
+    c.update_cursor = 0;
+    c.cpuNs = c.lastChange = 0;
+  }
+  int links = buildTopology(topology, n, latency, loss);
+  for (size_t i = 0; i < events.size(); i++) {
+    if (events[i].link < 0 || events[i].link >= links) {
+      fprintf(stderr, "no link %d, there are %d\n", events[i].link, links);
+      return 1;
+    }
+  }
+  // every interface has its own network, either a link or a stub
+  size_t networks = links + (n * N_IFACE_ON_BOARD - 2 * links);
+  // the network of a link that is down is withdrawn by both ends,
+  // unless a third router is attached to it
+  std::vector<bool> linkUp(links, true), linkShared(links, false);
+  for (size_t i = 0; i < attached.size(); i++) {
+    int router = attached[i].first, link = attached[i].second;
+    int j = 0;
+    while (router >= 0 && router < n && j < N_IFACE_ON_BOARD && contexts[router].enables[j]) {
+      j++;
+    }
+    if (router < 0 || router >= n || link < 0 || link >= links || j == N_IFACE_ON_BOARD) {
+      fprintf(stderr, "cannot attach router %d to link %d\n", router, link);
+      return 1;
+    }
+    // host 3 and up, the ends of the link are 1 and 2
+    contexts[router].addrs[j] = linkAddr(link, 3 + i);
+    networks -= 1;
+    linkShared[link] = true;
+  }
+
+  HAL_SimSetTicks(0);
+  for (int i = 0; i < n; i++) {
+    switchTo(i);
+    uint64_t begin = cpuNs();
+    int res = routerInit();
+    contexts[i].cpuNs += cpuNs() - begin;
+    if (res < 0) {
+      printf("routerInit of router %d failed: %d\n", i, res);
+      return 1;
+    }
+  }
+  // routerInit seeds rand() with the time, reseed for triggered update jitter
+  srand(seed);
+
+  printf("%s of %d routers, %d links, %zu networks, latency %llu ms, loss %.3f\n",
+          topology, n, links, networks, (unsigned long long)latency, loss);
+  size_t nextEvent = 0;
+  // hellos are counted apart, so that RIP packets compare with and without -b
+  uint64_t phaseStart = 0, phaseChange = 0, phaseTx = 0, phaseHellos = 0;
+  uint64_t now = 0, nextTick = 0;
+  while (now <= duration) {
+    HAL_SimSetTicks(now);
+    bool tick = now >= nextTick;
+    if (tick) {
+      nextTick = now + TICK_MS;
+    }
+    uint64_t next = nextTick;
+    for (int i = 0; i < n; i++) {
+      if (!tick && HAL_SimNextArrival(i) > now) {
+        continue;
+      }
+      switchTo(i);
+      uint32_t before = routeGeneration;
+      uint64_t begin = cpuNs();
+      // run the timers, then drain what has arrived
+      int res;
+      while ((res = routerPoll()) > 0)
+        ;
+      contexts[i].cpuNs += cpuNs() - begin;
+      if (res < 0) {
+        printf("router %d failed: %d\n", i, res);
+        return 1;
+      }
+      if (routeGeneration != before) {
+        contexts[i].lastChange = now;
+        phaseChange = now;
+      }
+      nextGeneration = routeGeneration + 1;
+    }
+    for (int i = 0; i < n; i++) {
+      next = std::min(next, HAL_SimNextArrival(i));
+    }
+    // a link event ends the current phase
+    while (nextEvent < events.size() && events[nextEvent].time <= next) {
+      const LinkEvent &e = events[nextEvent++];
+      uint64_t tx = 0;
+      for (int i = 0; i < n; i++) {
+        uint64_t rx, sent;
+        HAL_SimGetCounters(i, &rx, &sent);
+        tx += sent;
+      }
+      printPhase(phaseStart, phaseChange, tx - phaseTx, hellosSent - phaseHellos);
+      printf("%8llu ms: link %d %s\n", (unsigned long long)e.time,
+              e.link, e.up ? "up" : e.silent ? "silently down" : "down");
+      // both ends still advertise the network of a silent link
+      HAL_SimSetLinkLoss(e.link, e.silent ? 1 : loss);
+      if (!e.silent) {
+        HAL_SimSetLinkUp(e.link, e.up);
+      }
+      if (!e.silent && linkUp[e.link] != e.up) {
+        linkUp[e.link] = e.up;
+        networks += linkShared[e.link] ? 0 : e.up ? 1 : -1;
+      }
+      phaseStart = phaseChange = e.time;
+      phaseTx = tx;
+      phaseHellos = hellosSent;
+      next = std::max(e.time, now + 1);
+    }
+    now = std::max(next, now + 1);
+  }
+
+  uint64_t tx = 0, rx = 0, cpu = 0;
+  int busiest = 0, complete = 0, indirect = 0;
+  size_t reachableTotal = 0;
+  for (int i = 0; i < n; i++) {
+    switchTo(i);
+    uint64_t r, t;
+    HAL_SimGetCounters(i, &r, &t);
+    rx += r;
+    tx += t;
+    cpu += contexts[i].cpuNs;
+    if (contexts[i].cpuNs > contexts[busiest].cpuNs) {
+      busiest = i;
+    }
+    // reachable prefixes, paths of a prefix are adjacent
+    size_t reachable = 0;
+    for (size_t j = 0; j < Fib.size(); j++) {
+      if (j == 0 || Fib[j].addr != Fib[j - 1].addr || Fib[j].len != Fib[j - 1].len) {
+        reachable++;
+      }
+    }
+    reachableTotal += reachable;
+    if (reachable == networks) {
+      complete++;
+    }
+    // the network of a link that is up must be direct at both ends
+    for (int j = 0; j < N_IFACE_ON_BOARD; j++) {
+      int link = addrLink(addrs[j]);
+      if (!enables[j] || link < 0 || !linkUp[link]) {
+        continue;
+      }
+      bool direct = false;
+      for (size_t k = 0; k < RoutingTable.size(); k++) {
+        const RoutingTableEntry &e = RoutingTable[k];
+        direct |= e.addr == (addrs[j] & 0xffffff) && e.len == 24 && e.nexthop == 0 && e.metric == 1;
+      }
+      indirect += !direct;
+    }
+    if (verbose) {
+      printf("router %4d: %5zu routes, rx %llu, tx %llu, cpu %.3f ms, last change at %llu ms\n",
+              i, reachable, (unsigned long long)r, (unsigned long long)t,
+              contexts[i].cpuNs / 1e6, (unsigned long long)contexts[i].lastChange);
+    }
+  }
+  printPhase(phaseStart, phaseChange, tx - phaseTx, hellosSent - phaseHellos);
+  printf("%d/%d routers reach all %zu networks, %.1f on average\n", complete, n,
+          networks, (double)reachableTotal / n);
+  if (indirect > 0) {
+    printf("%d interfaces on a link that is up have no direct route\n", indirect);
+  }
+  printf("RIP packets: %llu sent, %llu received, %.1f per router per second\n",
+          (unsigned long long)(tx - hellosSent), (unsigned long long)(rx - hellosReceived),
+          (tx - hellosSent) * 1000.0 / n / (duration ? duration : 1));
+  if (hellosSent > 0) {
+    printf("hellos: %llu sent, %llu received, %.1f per router per second\n",
+            (unsigned long long)hellosSent, (unsigned long long)hellosReceived,
+            hellosSent * 1000.0 / n / (duration ? duration : 1));
+  }
+  printf("CPU: %.3f ms total, %.3f ms per router, %.3f ms at most (router %d)\n",
+          cpu / 1e6, cpu / 1e6 / n, contexts[busiest].cpuNs / 1e6, busiest);
+  return 0;
+}
@@ -0,0 +1,152 @@
+#include "router.h"
+#include "router_hal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+extern void bulk_load(const RoutingTableEntry* entries, size_t count);
+extern std::vector<RoutingTableEntry> RoutingTable;
+
+/**
+ * Snapshot file layout, in host byte order:
+ * a SnapshotHeader followed by count SnapshotRecords, nothing else.
+ * Records are fixed size so the file can be mapped and read in place.
+ * Only learnt routes are saved, direct routes come from the configuration.
+ */
+#define SNAPSHOT_MAGIC 0x4e535452 // "RTSN"
+#define SNAPSHOT_VERSION 2
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t count;
+  uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct {
+  uint32_t addr; // big endian
+  uint32_t nexthop; // big endian
+  uint8_t len;
+  uint8_t metric;
+  uint16_t if_index;
+  uint32_t age; // ms since the route was last refreshed when it was saved
+} SnapshotRecord;
+
+static_assert(sizeof(SnapshotHeader) == 16, "SnapshotHeader should be packed");
+static_assert(sizeof(SnapshotRecord) == 16, "SnapshotRecord should be packed");
+static_assert(HAL_MAX_IFACES <= 65536, "SnapshotRecord.if_index should hold every interface");
+
+/**
+ * Write the reachable learnt routes to path
+ * The file is written aside and renamed, so a crash never leaves a torn snapshot
+ * @return the number of routes written, -1 on error
+ */
+int saveSnapshot(const char* path){
+  uint64_t now = HAL_GetTicks();
+  std::vector<SnapshotRecord> records;
+  records.reserve(RoutingTable.size());
+  for(size_t i = 0; i < RoutingTable.size(); i++){
+    const RoutingTableEntry& e = RoutingTable[i];
+    if(e.nexthop == 0 || e.metric >= 16)
+      continue;
+    SnapshotRecord r;
+    r.addr = e.addr;
+    r.nexthop = e.nexthop;
+    r.len = e.len;
+    r.if_index = e.if_index;
+    r.metric = e.metric;
+    r.age = now - e.timestamp;
+    records.push_back(r);
+  }
+  SnapshotHeader header;
+  header.magic = SNAPSHOT_MAGIC;
+  header.version = SNAPSHOT_VERSION;
+  header.record_size = sizeof(SnapshotRecord);
+  header.count = records.size();
+  header.reserved = 0;
+
+  char tmp[256];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE* fp = fopen(tmp, "wb");
+  if(!fp){
+    // path, not tmp, outlives the call for the log
+    LOG(WARN, "failed to write snapshot %s: errno %d", path, errno);
+    return -1;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  if(ok && !records.empty())
+    ok = fwrite(records.data(), sizeof(SnapshotRecord), records.size(), fp) == records.size();
+  ok = fclose(fp) == 0 && ok;
+  if(!ok || rename(tmp, path) != 0){
+    LOG(WARN, "failed to write snapshot %s: errno %d", path, errno);
+    unlink(tmp);
+    return -1;
+  }
+  return records.size();
+}
+
+/**
+ * Load the routes of a snapshot written by saveSnapshot()
+ * Restored routes are usable by query() at once, but they are marked stale:
+ * they are not advertised, and they time out as usual unless RIP confirms them.
+ * Their timers are rebased to now, as ticks don't survive a restart, minus
+ * their age when saved and the age of the file; older than TIMEOUT_SEC,
+ * they would have timed out and are left out.
+ * @return the number of routes restored, -1 if there is no valid snapshot
+ */
+int loadSnapshot(const char* path){
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return -1;
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)){
+    close(fd);
+    return -1;
+  }
+  void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED)
+    return -1;
+  const SnapshotHeader* header = (const SnapshotHeader*)base;
+  const SnapshotRecord* records = (const SnapshotRecord*)(header + 1);
+  int restored = -1;
+  if(header->magic == SNAPSHOT_MAGIC && header->version == SNAPSHOT_VERSION
+      && header->record_size == sizeof(SnapshotRecord)
+      && st.st_size == sizeof(SnapshotHeader) + (off_t)header->count * sizeof(SnapshotRecord)){
+    uint64_t now = HAL_GetTicks();
+    // time since the snapshot was written, the router was down meanwhile
+    time_t wall = time(NULL);
+    uint64_t downMs = wall > st.st_mtime ? (uint64_t)(wall - st.st_mtime) * 1000 : 0;
+    std::vector<RoutingTableEntry> entries;
+    entries.reserve(header->count);
+    for(uint32_t i = 0; i < header->count; i++){
+      const SnapshotRecord& r = records[i];
+      uint64_t age = r.age + downMs;
+      if(r.len > 32 || r.if_index >= (uint32_t)HAL_InterfaceCount() || r.metric >= 16
+          || age >= TIMEOUT_SEC * 1000)
+        continue;
+      RoutingTableEntry entry;
+      entry.addr = r.addr;
+      entry.len = r.len;
+      entry.if_index = r.if_index;
+      entry.nexthop = r.nexthop;
+      entry.metric = r.metric;
+      // may wrap below 0, the timers only look at differences
+      entry.timestamp = now - age;
+      entry.change_flag = 0;
+      entry.stale = 1;
+      entries.push_back(entry);
+    }
+    bulk_load(entries.data(), entries.size());
+    restored = entries.size();
+  }
+  munmap(base, st.st_size);
+  return restored;
+}
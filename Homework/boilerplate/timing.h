@@ -0,0 +1,58 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include "router_stats.h"
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Stages of the forwarding path, in the order a packet goes through them
+ * Only packets that reach a stage are accounted for it
+ */
+enum TimingStage {
+  STAGE_RECEIVE, // HAL_ReceiveIPPacket
+  STAGE_CHECKSUM, // validateIPChecksum()
+  STAGE_DST_IS_ME, // comparing dst with the interface addresses
+  STAGE_QUERY, // route cache and query()
+  STAGE_ARP, // HAL_ArpGetMacAddress, skipped on a route cache hit
+  STAGE_FORWARD, // forward()
+  STAGE_SEND, // HAL_SendIPPacket
+  N_STAGE
+};
+
+extern const char *stageNames[N_STAGE];
+// cycles spent in each stage per packet, published in the HAL stats page
+extern HAL_Histogram *stageHist[N_STAGE];
+
+/**
+ * A cheap timestamp: the TSC where there is one, nanoseconds otherwise
+ */
+static inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+#endif
+}
+
+// compiled in only with -DROUTER_PROFILE, the router pays nothing otherwise
+#ifdef ROUTER_PROFILE
+#define TIMING_START() uint64_t timing_mark = readCycles()
+// charge the time since the previous mark to stage
+#define TIMING_MARK(stage)                                                     \
+  do {                                                                         \
+    uint64_t timing_now = readCycles();                                        \
+    HAL_HistogramRecord(stageHist[stage], timing_now - timing_mark);           \
+    timing_mark = timing_now;                                                  \
+  } while (0)
+#else
+#define TIMING_START() do {} while (0)
+#define TIMING_MARK(stage) do {} while (0)
+#endif
+
+#endif
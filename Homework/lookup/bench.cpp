@@ -0,0 +1,184 @@
+#include "router.h"
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+extern void update(bool insert, const RoutingTableEntry& entry);
+extern void bulk_load(const RoutingTableEntry* entries, size_t count);
+extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
+extern std::vector<RoutingTableEntry> RoutingTable;
+extern std::vector<FibEntry> Fib;
+extern uint32_t fibBegin[34];
+extern uint32_t masks[33];
+
+const int N_QUERY = 1000000;
+
+uint64_t nowNs() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+// hardware cache miss counter of this thread, -1 if perf is not available
+int openCacheMissCounter() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+uint64_t readCounter(int fd) {
+  uint64_t value = 0;
+  if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+    return 0;
+  }
+  return value;
+}
+
+// the linear RIB scan query() used before the FIB existed, as a reference
+bool queryRib(uint32_t addr, uint32_t *nexthop, uint32_t *if_index) {
+  uint32_t maxMatch = 0;
+  int matchIndex = -1;
+  for (size_t i = 0; i < RoutingTable.size(); i++) {
+    const RoutingTableEntry &e = RoutingTable[i];
+    if ((addr & masks[e.len]) == e.addr && e.len > maxMatch && e.metric < 16) {
+      maxMatch = e.len;
+      matchIndex = i;
+    }
+  }
+  if (matchIndex < 0) {
+    return false;
+  }
+  *nexthop = RoutingTable[matchIndex].nexthop;
+  *if_index = RoutingTable[matchIndex].if_index;
+  return true;
+}
+
+// parse 'route a.b.c.d/len via ...;' lines of a BIRD static protocol config
+std::vector<RoutingTableEntry> loadConf(const char *path) {
+  std::vector<RoutingTableEntry> routes;
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    perror(path);
+    exit(1);
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), fp)) {
+    unsigned a, b, c, d, len;
+    unsigned n1, n2, n3, n4;
+    if (sscanf(line, " route %u.%u.%u.%u/%u", &a, &b, &c, &d, &len) != 5 ||
+        len > 32) {
+      continue;
+    }
+    RoutingTableEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.addr = (a | (b << 8) | (c << 16) | (d << 24)) & masks[len];
+    entry.len = len;
+    const char *via = strstr(line, "via ");
+    if (via && sscanf(via, "via %u.%u.%u.%u", &n1, &n2, &n3, &n4) == 4) {
+      entry.nexthop = n1 | (n2 << 8) | (n3 << 16) | (n4 << 24);
+    } else {
+      // via an interface, pick a fixed gateway
+      entry.nexthop = 0x0100000a;
+    }
+    entry.metric = 1;
+    routes.push_back(entry);
+  }
+  fclose(fp);
+  return routes;
+}
+
+void runQueries(const char *name, bool (*fn)(uint32_t, uint32_t *, uint32_t *),
+                const std::vector<uint32_t> &addrs) {
+  int fd = openCacheMissCounter();
+  uint32_t nexthop, if_index;
+  uint32_t found = 0, checksum = 0;
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  uint64_t begin = nowNs();
+  for (size_t i = 0; i < addrs.size(); i++) {
+    if (fn(addrs[i], &nexthop, &if_index)) {
+      found++;
+      checksum += nexthop;
+    }
+  }
+  uint64_t elapsed = nowNs() - begin;
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+  uint64_t misses = readCounter(fd);
+  printf("%-6s %8.1f ns/lookup, %u hits (%08x)", name,
+         (double)elapsed / addrs.size(), found, checksum);
+  if (fd >= 0) {
+    printf(", %.2f cache misses/lookup\n", (double)misses / addrs.size());
+    close(fd);
+  } else {
+    printf(", cache misses n/a (perf_event_open failed)\n");
+  }
+}
+
+void clearTables() {
+  RoutingTable.clear();
+  Fib.clear();
+  memset(fibBegin, 0, sizeof(uint32_t) * 34);
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : "../../Setup/conf-part9.conf";
+  std::vector<RoutingTableEntry> routes = loadConf(path);
+  uint64_t begin = nowNs();
+  for (size_t i = 0; i < routes.size(); i++) {
+    update(true, routes[i]);
+  }
+  uint64_t updateNs = nowNs() - begin;
+  size_t ribSize = RoutingTable.size(), fibSize = Fib.size();
+  clearTables();
+  begin = nowNs();
+  bulk_load(routes.data(), routes.size());
+  uint64_t bulkNs = nowNs() - begin;
+  printf("build: update() %.3f ms, bulk_load() %.3f ms%s\n", updateNs / 1e6,
+         bulkNs / 1e6,
+         ribSize == RoutingTable.size() && fibSize == Fib.size()
+             ? ""
+             : " (tables differ!)");
+  printf("%s: %zu routes, %zu in RIB, %zu in FIB\n", path, routes.size(),
+         RoutingTable.size(), Fib.size());
+  printf("RIB %zu bytes/route, %zu KiB total\n", sizeof(RoutingTableEntry),
+         RoutingTable.size() * sizeof(RoutingTableEntry) / 1024);
+  printf("FIB %zu bytes/route, %zu KiB total\n", sizeof(FibEntry),
+         Fib.size() * sizeof(FibEntry) / 1024);
+  if (routes.empty()) {
+    return 0;
+  }
+
+  // half of the destinations hit a random route, the other half are random
+  std::vector<uint32_t> addrs(N_QUERY);
+  srand(1);
+  for (int i = 0; i < N_QUERY; i++) {
+    uint32_t r = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    if (i & 1) {
+      addrs[i] = r;
+    } else {
+      const RoutingTableEntry &e = routes[rand() % routes.size()];
+      addrs[i] = e.addr | (r & ~masks[e.len]);
+    }
+  }
+  runQueries("FIB", query, addrs);
+  runQueries("RIB", queryRib, std::vector<uint32_t>(addrs.begin(),
+                                                      addrs.begin() + N_QUERY / 100));
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include "log.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// records per thread, a power of two
+const uint32_t LOG_RING_SIZE = 1024;
+const int LOG_MAX_THREADS = 16;
+// how long the drain sleeps when every ring is empty
+const long LOG_IDLE_NS = 1000000;
+
+int logLevel = LOG_LEVEL_INFO;
+
+// single producer, the owning thread, and single consumer, the drain
+struct LogRing {
+  uint64_t head; // written by the producer
+  uint64_t tail; // written by the drain
+  uint64_t dropped; // written by the producer
+  uint64_t reported; // drops already reported, drain only
+  LogRecord records[LOG_RING_SIZE];
+};
+
+LogRing *logRings[LOG_MAX_THREADS];
+int logThreads = 0;
+__thread LogRing *logRing = NULL;
+// threads beyond LOG_MAX_THREADS get no ring and drop everything
+__thread bool logNoRing = false;
+// records lost because their thread had no ring
+uint64_t logOrphans = 0;
+
+pthread_once_t logOnce = PTHREAD_ONCE_INIT;
+pthread_t logDrain;
+bool logStop = false;
+pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t logNow() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+// writes go straight to the fd, so that they never mix with stdio buffers
+static void logOut(const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(STDERR_FILENO, data, len);
+    if (n <= 0)
+      return;
+    data += n;
+    len -= n;
+  }
+}
+
+/**
+ * Format and write every committed record
+ * @return the number of records written
+ */
+static size_t logDrainOnce() {
+  static char out[65536];
+  size_t len = 0, written = 0;
+  char line[512];
+  int threads = __atomic_load_n(&logThreads, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < threads; i++) {
+    LogRing *ring = __atomic_load_n(&logRings[i], __ATOMIC_ACQUIRE);
+    if (!ring)
+      continue;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    for (; tail < head; tail++) {
+      const LogRecord &r = ring->records[tail & (LOG_RING_SIZE - 1)];
+      static const char levels[] = "DIWE";
+      int n = snprintf(line, sizeof(line), "%llu.%03llu %c ",
+                       (unsigned long long)(r.ns / 1000000000),
+                       (unsigned long long)(r.ns / 1000000 % 1000), levels[r.level & 3]);
+      int m = r.format(line + n, sizeof(line) - n - 1, r.fmt, r.args);
+      n = m < 0 ? n : (n + m < (int)sizeof(line) - 1 ? n + m : sizeof(line) - 2);
+      line[n++] = '\n';
+      if (len + n > sizeof(out)) {
+        logOut(out, len);
+        len = 0;
+      }
+      memcpy(out + len, line, n);
+      len += n;
+      written++;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    if (dropped != ring->reported) {
+      int n = snprintf(line, sizeof(line), "log: %llu records dropped, ring %d full\n",
+                       (unsigned long long)(dropped - ring->reported), i);
+      logOut(out, len);
+      len = 0;
+      logOut(line, n);
+      ring->reported = dropped;
+    }
+  }
+  logOut(out, len);
+  static uint64_t orphansReported = 0;
+  uint64_t orphans = __atomic_load_n(&logOrphans, __ATOMIC_RELAXED);
+  if (orphans != orphansReported) {
+    int n = snprintf(line, sizeof(line), "log: %llu records dropped, more than %d threads\n",
+                     (unsigned long long)(orphans - orphansReported), LOG_MAX_THREADS);
+    logOut(line, n);
+    orphansReported = orphans;
+  }
+  return written;
+}
+
+static void *logDrainLoop(void *) {
+  struct timespec idle = {0, LOG_IDLE_NS};
+  while (true) {
+    pthread_mutex_lock(&logLock);
+    size_t written = logDrainOnce();
+    bool stop = logStop;
+    pthread_mutex_unlock(&logLock);
+    if (stop)
+      return NULL;
+    if (written == 0)
+      nanosleep(&idle, NULL);
+  }
+}
+
+static void logShutdown() {
+  pthread_mutex_lock(&logLock);
+  logStop = true;
+  pthread_mutex_unlock(&logLock);
+  pthread_join(logDrain, NULL);
+  logDrainOnce();
+}
+
+static void logStart() {
+  if (pthread_create(&logDrain, NULL, logDrainLoop, NULL) == 0)
+    atexit(logShutdown);
+}
+
+LogRecord *logReserve() {
+  LogRing *ring = logRing;
+  if (!ring) {
+    if (logNoRing) {
+      __atomic_fetch_add(&logOrphans, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }
+    pthread_once(&logOnce, logStart);
+    int index = __atomic_fetch_add(&logThreads, 1, __ATOMIC_ACQ_REL);
+    ring = index < LOG_MAX_THREADS ? (LogRing *)calloc(1, sizeof(LogRing)) : NULL;
+    if (!ring) {
+      logNoRing = true;
+      return NULL;
+    }
+    __atomic_store_n(&logRings[index], ring, __ATOMIC_RELEASE);
+    logRing = ring;
+  }
+  uint64_t head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  LogRecord *record = &ring->records[head & (LOG_RING_SIZE - 1)];
+  record->ns = logNow();
+  return record;
+}
+
+void logCommit() {
+  __atomic_store_n(&logRing->head, logRing->head + 1, __ATOMIC_RELEASE);
+}
+
+bool logAllow(LogSite *site, uint64_t interval_ms) {
+  uint64_t now = logNow();
+  if (now < site->next_ns) {
+    site->suppressed++;
+    return false;
+  }
+  site->next_ns = now + interval_ms * 1000000;
+  if (site->suppressed) {
+    logWrite(LOG_LEVEL_INFO, "(%llu similar messages suppressed)",
+             (unsigned long long)site->suppressed);
+    site->suppressed = 0;
+  }
+  return true;
+}
+
+void logFlush() {
+  pthread_mutex_lock(&logLock);
+  logDrainOnce();
+  pthread_mutex_unlock(&logLock);
+}
@@ -0,0 +1,139 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <type_traits>
+
+/**
+ * Asynchronous logging
+ * A log call copies the format pointer and its arguments into a ring owned by
+ * the calling thread, a background thread formats them and writes to stderr.
+ * The caller never formats, never blocks and never does I/O: when its ring is
+ * full the record is dropped and counted. Order is kept within a thread only.
+ *
+ * Arguments are copied by value, so %s must point to a string that outlives
+ * the call, such as a literal. Lines end with a newline added by the drain.
+ *
+ *   LOG(INFO, "%d routes restored from %s", restored, SNAPSHOT_FILE);
+ *   LOG_RATE(1000, WARN, "IP not found for %x", dst_addr); // at most 1/s
+ */
+enum LogLevel {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+};
+
+// records below this level are discarded at the call site
+extern int logLevel;
+
+// a record takes 256 bytes
+const int LOG_ARG_SIZE = 224;
+
+typedef int (*LogFormatter)(char *buffer, size_t size, const char *fmt, const void *args);
+
+struct LogRecord {
+  LogFormatter format;
+  const char *fmt;
+  uint64_t ns; // CLOCK_MONOTONIC
+  uint32_t level;
+  uint32_t reserved;
+  alignas(8) uint8_t args[LOG_ARG_SIZE];
+};
+
+// state of a LOG_RATE call site
+struct LogSite {
+  uint64_t next_ns;
+  uint64_t suppressed;
+};
+
+/**
+ * A free record in the ring of this thread, to be filled then committed
+ * @return NULL if the ring is full
+ */
+LogRecord *logReserve();
+void logCommit();
+// whether a rate-limited site may log now, notes what it suppressed before
+bool logAllow(LogSite *site, uint64_t interval_ms);
+// write out everything logged so far, also done at exit
+void logFlush();
+
+// the arguments of a record, an aggregate so that it can live in the ring
+template <typename... A> struct LogPack {};
+template <typename T, typename... R> struct LogPack<T, R...> {
+  T head;
+  LogPack<R...> tail;
+};
+
+inline void logPack(LogPack<> *) {}
+template <typename T, typename... R>
+inline void logPack(LogPack<T, R...> *pack, T head, R... tail) {
+  pack->head = head;
+  logPack(&pack->tail, tail...);
+}
+
+// no arguments: only %% needs care
+inline int logApply(char *buffer, size_t size, const char *fmt, const LogPack<> &) {
+  size_t n = 0;
+  for (const char *p = fmt; *p; p++) {
+    if (p[0] == '%' && p[1] == '%')
+      p++;
+    if (n + 1 < size)
+      buffer[n] = *p;
+    n++;
+  }
+  if (size)
+    buffer[n < size ? n : size - 1] = 0;
+  return n;
+}
+template <typename... Done>
+inline int logApply(char *buffer, size_t size, const char *fmt, const LogPack<> &, Done... done) {
+  return snprintf(buffer, size, fmt, done...);
+}
+template <typename T, typename... R, typename... Done>
+inline int logApply(char *buffer, size_t size, const char *fmt, const LogPack<T, R...> &pack,
+                    Done... done) {
+  return logApply(buffer, size, fmt, pack.tail, done..., pack.head);
+}
+
+template <typename P>
+int logFormat(char *buffer, size_t size, const char *fmt, const void *args) {
+  return logApply(buffer, size, fmt, *(const P *)args);
+}
+
+template <typename... A>
+void logWrite(int level, const char *fmt, A... args) {
+  typedef LogPack<typename std::decay<A>::type...> Pack;
+  static_assert(sizeof(Pack) <= LOG_ARG_SIZE, "too many log arguments");
+  LogRecord *record = logReserve();
+  if (!record)
+    return;
+  record->format = &logFormat<Pack>;
+  record->fmt = fmt;
+  record->level = level;
+  logPack(new (record->args) Pack, args...);
+  logCommit();
+}
+
+// printf in dead code makes the compiler check the format
+#define LOG(level, fmt, ...)                                                   \
+  do {                                                                         \
+    if (LOG_LEVEL_##level >= logLevel) {                                       \
+      if (0)                                                                   \
+        printf(fmt, ##__VA_ARGS__);                                            \
+      logWrite(LOG_LEVEL_##level, fmt, ##__VA_ARGS__);                         \
+    }                                                                          \
+  } while (0)
+
+// at most one record every interval_ms from this call site
+#define LOG_RATE(interval_ms, level, fmt, ...)                                 \
+  do {                                                                         \
+    static LogSite log_site;                                                   \
+    if (LOG_LEVEL_##level >= logLevel && logAllow(&log_site, interval_ms))     \
+      LOG(level, fmt, ##__VA_ARGS__);                                          \
+  } while (0)
+
+#endif
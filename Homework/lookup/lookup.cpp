@@ -1,10 +1,20 @@
 #include "router.h"
+#include "router_hal.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <vector>
+#include <algorithm>
 #include <stdio.h>
 
+static_assert(HAL_MAX_IFACES <= 65536, "FibEntry.if_index should hold every interface");
+
+// RIB, with the full RIP state of every route, sorted by (addr, len)
 std::vector<RoutingTableEntry> RoutingTable;
+// FIB, reachable routes only, grouped by prefix length from /32 down to /0
+// and sorted by addr within a group
+std::vector<FibEntry> Fib;
+// group of prefix length len is [fibBegin[32 - len], fibBegin[33 - len])
+uint32_t fibBegin[34] = {0};
 
 void printTable(){
 	for(auto it = RoutingTable.begin(); it != RoutingTable.end(); it++)
@@ -13,15 +23,251 @@ void printTable(){
 
 bool hasUpdate = false;
 
+// bumped whenever the set of usable routes changes, caches compare against it
+uint32_t routeGeneration = 0;
+
+// called with the new FIB entries of a prefix whenever they change,
+// n is 0 when the prefix is removed, e.g. to mirror the FIB somewhere else
+void (*fibNotify)(uint32_t addr, uint32_t len, const FibEntry* paths, int n) = NULL;
+
+// network order masks, masks[len] keeps the first len bits of a big endian address
 uint32_t masks[33] = {0x0,
-	0x1, 0x3, 0x7, 0xf, 
-	0x1f, 0x3f, 0x7f, 0xff, 
-	0x1ff, 0x3ff, 0x7ff, 0xfff, 
-	0x1fff, 0x3fff, 0x7fff, 0xffff, 
-	0x1ffff, 0x3ffff, 0x7ffff, 0xfffff, 
-	0x1fffff, 0x3fffff, 0x7fffff, 0xffffff, 
-	0x1ffffff, 0x3ffffff, 0x7ffffff, 0xfffffff, 
-	0x1fffffff, 0x3fffffff, 0x7fffffff, 0xffffffff};
+	0x80, 0xc0, 0xe0, 0xf0, 
+	0xf8, 0xfc, 0xfe, 0xff, 
+	0x80ff, 0xc0ff, 0xe0ff, 0xf0ff, 
+	0xf8ff, 0xfcff, 0xfeff, 0xffff, 
+	0x80ffff, 0xc0ffff, 0xe0ffff, 0xf0ffff, 
+	0xf8ffff, 0xfcffff, 0xfeffff, 0xffffff, 
+	0x80ffffff, 0xc0ffffff, 0xe0ffffff, 0xf0ffffff, 
+	0xf8ffffff, 0xfcffffff, 0xfeffffff, 0xffffffff};
+
+static bool fibLess(const FibEntry& a, const FibEntry& b){
+	return a.addr < b.addr;
+}
+
+static bool ribLess(const RoutingTableEntry& a, const RoutingTableEntry& b){
+	return a.addr < b.addr || (a.addr == b.addr && a.len < b.len);
+}
+
+static inline bool samePrefix(const RoutingTableEntry& e, uint32_t addr, uint32_t len){
+	return e.addr == addr && e.len == len;
+}
+
+static void fibFill(FibEntry& fe, const RoutingTableEntry& e){
+	fe.addr = e.addr;
+	fe.nexthop = e.nexthop;
+	fe.len = e.len;
+	fe.if_index = e.if_index;
+	fe.reserved = 0;
+	fe.padding = 0;
+}
+
+/**
+ * Find the position of addr/len in its FIB group, or where it should be inserted
+ */
+static uint32_t fibFind(uint32_t addr, uint32_t len){
+	FibEntry key;
+	key.addr = addr;
+	const FibEntry* first = Fib.data() + fibBegin[32 - len];
+	const FibEntry* last = Fib.data() + fibBegin[33 - len];
+	return std::lower_bound(first, last, key, fibLess) - Fib.data();
+}
+
+/**
+ * Replace the FIB entries of addr/len with the reachable ones among paths
+ * paths are the RIB entries of this prefix, n may be 0 to remove the prefix
+ * The i-th FIB entry of a prefix is the i-th reachable path, so the order
+ * of equal-cost paths is stable as long as the RIB group is
+ */
+void fibSet(uint32_t addr, uint32_t len, const RoutingTableEntry* paths, int n){
+	FibEntry entries[ECMP_MAX_PATHS];
+	int count = 0;
+	for(int i = 0; i < n && count < ECMP_MAX_PATHS; i++){
+		if(paths[i].metric >= 16)
+			continue;
+		fibFill(entries[count++], paths[i]);
+	}
+	uint32_t pos = fibFind(addr, len);
+	uint32_t old = 0;
+	while(pos + old < fibBegin[33 - len] && Fib[pos + old].addr == addr)
+		old++;
+	bool same = old == (uint32_t)count;
+	for(int i = 0; same && i < count; i++)
+		same = Fib[pos + i].nexthop == entries[i].nexthop && Fib[pos + i].if_index == entries[i].if_index;
+	if(same)
+		return;
+	if(old > (uint32_t)count)
+		Fib.erase(Fib.begin() + pos + count, Fib.begin() + pos + old);
+	else if(old < (uint32_t)count)
+		Fib.insert(Fib.begin() + pos + old, count - old, entries[0]);
+	for(int i = 0; i < count; i++)
+		Fib[pos + i] = entries[i];
+	for(int i = 33 - len; i < 34; i++)
+		fibBegin[i] += count - old;
+	routeGeneration++;
+	if(fibNotify)
+		fibNotify(addr, len, entries, count);
+}
+
+/**
+ * Remove addr/len from the FIB, if present
+ */
+void fibRemove(uint32_t addr, uint32_t len){
+	fibSet(addr, len, NULL, 0);
+}
+
+/**
+ * Tell fibNotify about every prefix whose entries differ between the old FIB
+ * and the current one, by walking the groups of both side by side
+ */
+static void fibDiff(const std::vector<FibEntry>& old, const uint32_t* oldBegin){
+	for(int g = 0; g < 33; g++){
+		uint32_t i = oldBegin[g], j = fibBegin[g];
+		while(i < oldBegin[g + 1] || j < fibBegin[g + 1]){
+			bool fromOld = j == fibBegin[g + 1] || (i < oldBegin[g + 1] && old[i].addr <= Fib[j].addr);
+			uint32_t addr = fromOld ? old[i].addr : Fib[j].addr;
+			uint32_t i0 = i, j0 = j;
+			while(i < oldBegin[g + 1] && old[i].addr == addr)
+				i++;
+			while(j < fibBegin[g + 1] && Fib[j].addr == addr)
+				j++;
+			bool same = i - i0 == j - j0;
+			for(uint32_t k = 0; same && k < i - i0; k++)
+				same = old[i0 + k].nexthop == Fib[j0 + k].nexthop && old[i0 + k].if_index == Fib[j0 + k].if_index;
+			if(!same)
+				fibNotify(addr, 32 - g, Fib.data() + j0, j - j0);
+		}
+	}
+}
+
+/**
+ * Rebuild the whole FIB from the RIB in one pass
+ * The RIB is sorted by addr, so distributing its reachable paths
+ * into the groups of their length keeps every group sorted
+ */
+static void fibBuild(){
+	// only kept when someone needs to hear about the changes
+	std::vector<FibEntry> old;
+	uint32_t oldBegin[34];
+	if(fibNotify){
+		old = Fib;
+		std::copy(fibBegin, fibBegin + 34, oldBegin);
+	}
+	uint32_t count[34] = {0};
+	for(size_t i = 0; i < RoutingTable.size(); i++)
+		if(RoutingTable[i].metric < 16)
+			count[32 - RoutingTable[i].len]++;
+	fibBegin[0] = 0;
+	for(int i = 0; i < 33; i++)
+		fibBegin[i + 1] = fibBegin[i] + count[i];
+	uint32_t next[33];
+	for(int i = 0; i < 33; i++)
+		next[i] = fibBegin[i];
+	Fib.resize(fibBegin[33]);
+	for(size_t i = 0; i < RoutingTable.size(); i++)
+		if(RoutingTable[i].metric < 16)
+			fibFill(Fib[next[32 - RoutingTable[i].len]++], RoutingTable[i]);
+	routeGeneration++;
+	if(fibNotify)
+		fibDiff(old, oldBegin);
+}
+
+static void printAdded(uint32_t addr){
+	LOG(DEBUG, "Add RTE: %u.%u.%u.%u",
+		addr & 0xff, 
+		(addr >> 8) & 0xff, 
+		(addr >> 16) & 0xff,
+		addr >> 24);
+}
+
+static uint32_t bestMetric(const RoutingTableEntry* paths, int n){
+	uint32_t best = 16;
+	for(int i = 0; i < n; i++)
+		if(paths[i].metric < best)
+			best = paths[i].metric;
+	return best;
+}
+
+/**
+ * Apply a RIP update to the paths of one prefix
+ * Paths are kept only while they are all of the best metric,
+ * unless every path is unreachable and waiting for deletion
+ * @return whether the reachable paths or their metric changed
+ */
+static bool mergePath(RoutingTableEntry* paths, int& n, const RoutingTableEntry& entry){
+	bool changed = false;
+	int same = -1;
+	for(int i = 0; i < n; i++)
+		if(paths[i].nexthop == entry.nexthop)
+			same = i;
+	if(same >= 0){
+		RoutingTableEntry& path = paths[same];
+		// different metric, use the latest one
+		if(path.metric != entry.metric){
+			path = entry;
+			// if the new entry marks the route as unreachable
+			// timeout immediately and enter deletion
+			if(entry.metric == 16)
+				path.timestamp -= TIMEOUT_SEC * 1000;
+			changed = true;
+		}
+		// simply reset timer without setting the change flag
+		// if already unreachable, don't reset timer
+		else if(path.metric != 16){
+			path.timestamp = entry.timestamp;
+			// a path restored from a snapshot is confirmed by its next hop,
+			// it is advertised again from now on
+			if(path.stale && !entry.stale){
+				path.stale = 0;
+				path.change_flag = 1;
+			}
+		}
+	}
+	else{
+		uint32_t best = bestMetric(paths, n);
+		// different route path. use the better one
+		if(entry.metric < best){
+			paths[0] = entry;
+			n = 1;
+			changed = true;
+		}
+		// from different router but have same metric, use both
+		else if(entry.metric == best && entry.metric < 16){
+			if(n < ECMP_MAX_PATHS){
+				paths[n++] = entry;
+				changed = true;
+			}
+			// no room for another path
+			// if the oldest path is halfway to timeout, use the newer one
+			else{
+				int oldest = 0;
+				for(int i = 1; i < n; i++)
+					if(paths[i].timestamp < paths[oldest].timestamp)
+						oldest = i;
+				if(entry.timestamp - paths[oldest].timestamp > TIMEOUT_SEC / 2 * 1000){
+					paths[oldest] = entry;
+					changed = true;
+				}
+			}
+		}
+	}
+	if(changed){
+		// drop paths that are no longer of equal cost
+		uint32_t best = bestMetric(paths, n);
+		if(best < 16){
+			int kept = 0;
+			for(int i = 0; i < n; i++)
+				if(paths[i].metric == best)
+					paths[kept++] = paths[i];
+			n = kept;
+		}
+	}
+	for(int i = 0; i < n; i++)
+		if(paths[i].change_flag)
+			hasUpdate = true;
+	return changed;
+}
+
 /*
   RoutingTable Entry 的定义如下：
   typedef struct {
@@ -47,59 +293,125 @@ uint32_t masks[33] = {0x0,
  * 删除时按照 addr 和 len 匹配。
  */
 void update(bool insert, const RoutingTableEntry& entry) {
+	// paths of the same prefix are adjacent in RoutingTable
 	int length = RoutingTable.size();
-	for(int i = 0; i < length; i++){
-		if(RoutingTable[i].addr == entry.addr && RoutingTable[i].len == entry.len){ // skip direct networks
-			// direct networks should never be updated or deleted
-			if(RoutingTable[i].nexthop == 0)
-				return;
-			if(insert){
-				// the same route path.
-				if(RoutingTable[i].nexthop == entry.nexthop){
-					// different metric, use the latest one
-					if(RoutingTable[i].metric != entry.metric){
-						RoutingTable[i] = entry;
-						// if the new entry marks the route as unreachable
-						// timeout immediately and enter deletion
-						if(entry.metric == 16)
-							RoutingTable[i].timestamp -= TIMEOUT_SEC * 1000;
-					}
-					// simply reset timer without setting the change flag
-					// if already unreachable, don't reset timer
-					else if(RoutingTable[i].metric != 16)
-						RoutingTable[i].timestamp = entry.timestamp;
-				}
-				// different route path. use the better one
-				else if(RoutingTable[i].metric > entry.metric)
-					RoutingTable[i] = entry;
-				// from different router but have same metric
-				// if the existing entry is halfway to timeout, use the newer one
-				// if already unreachable, leave it alone
-				else if(entry.metric != 16 && entry.timestamp - RoutingTable[i].timestamp > TIMEOUT_SEC / 2 * 1000)
-					RoutingTable[i] = entry;
-				
-				if(RoutingTable[i].change_flag)
-					hasUpdate = true;
-			}
-			else
-				RoutingTable.erase(RoutingTable.begin() + i);
-			return;
+	int first = std::lower_bound(RoutingTable.begin(), RoutingTable.end(), entry, ribLess) - RoutingTable.begin();
+	int last = first;
+	while(last < length && samePrefix(RoutingTable[last], entry.addr, entry.len))
+		last++;
+	// direct networks should never be updated or deleted,
+	// unless their link is down and they are poisoned
+	if(first < last && RoutingTable[first].nexthop == 0 && RoutingTable[first].metric < 16)
+		return;
+	if(!insert){
+		if(first < last){
+			RoutingTable.erase(RoutingTable.begin() + first, RoutingTable.begin() + last);
+			fibRemove(entry.addr, entry.len);
 		}
+		return;
+	}
+	// ignore new prefixes with metric of 16, since it means unreachable
+	if(first == last && entry.metric >= 16)
+		return;
+	RoutingTableEntry paths[ECMP_MAX_PATHS];
+	int n = last - first;
+	for(int i = 0; i < n; i++)
+		paths[i] = RoutingTable[first + i];
+	if(!mergePath(paths, n, entry)){
+		// only timers may have been refreshed
+		for(int i = 0; i < n; i++)
+			RoutingTable[first + i] = paths[i];
+		return;
 	}
-	// ignore entry with metric of 16, since it means unreachable
-	if(insert && entry.metric < 16){
-		RoutingTable.push_back(entry);
-		printf("Add RTE: %d.%d.%d.%d\n",
-			entry.addr & 0xff, 
-			(entry.addr >> 8) & 0xff, 
-			(entry.addr >> 16) & 0xff,
-			entry.addr >> 24);
+	if(first == last){
+		printAdded(entry.addr);
 		hasUpdate = true;
 	}
+	// splice the new paths into the group
+	if(n < last - first)
+		RoutingTable.erase(RoutingTable.begin() + first + n, RoutingTable.begin() + last);
+	else if(n > last - first)
+		RoutingTable.insert(RoutingTable.begin() + last, n - (last - first), paths[0]);
+	for(int i = 0; i < n; i++)
+		RoutingTable[first + i] = paths[i];
+	fibSet(entry.addr, entry.len, paths, n);
+}
+
+/**
+ * Insert many routes at once, with the same result as calling update(true, ...)
+ * on each of them in order
+ * The input is sorted, so that the paths given for a prefix are merged together,
+ * then merged with the RIB in one pass, and the FIB is rebuilt from scratch.
+ * Small batches are cheaper as separate updates and take that path.
+ */
+void bulk_load(const RoutingTableEntry* entries, size_t count) {
+	if(count < BULK_LOAD_MIN){
+		for(size_t i = 0; i < count; i++)
+			update(true, entries[i]);
+		return;
+	}
+	std::vector<RoutingTableEntry> input(entries, entries + count);
+	// stable, so the paths of a prefix are merged in the order given
+	std::stable_sort(input.begin(), input.end(), ribLess);
+	std::vector<RoutingTableEntry> rib;
+	rib.reserve(RoutingTable.size() + count);
+	bool changed = false;
+	size_t i = 0, j = 0;
+	while(i < RoutingTable.size() || j < input.size()){
+		// the next prefix of either sequence
+		bool fromRib = j == input.size() || (i < RoutingTable.size() && !ribLess(input[j], RoutingTable[i]));
+		uint32_t addr = fromRib ? RoutingTable[i].addr : input[j].addr;
+		uint32_t len = fromRib ? RoutingTable[i].len : input[j].len;
+		RoutingTableEntry paths[ECMP_MAX_PATHS];
+		int n = 0;
+		while(i < RoutingTable.size() && samePrefix(RoutingTable[i], addr, len))
+			paths[n++] = RoutingTable[i++];
+		bool added = n == 0;
+		for(; j < input.size() && samePrefix(input[j], addr, len); j++){
+			// same rules as update()
+			if(n > 0 && paths[0].nexthop == 0 && paths[0].metric < 16)
+				continue;
+			if(n == 0 && input[j].metric >= 16)
+				continue;
+			if(mergePath(paths, n, input[j]))
+				changed = true;
+		}
+		if(added && n > 0){
+			printAdded(addr);
+			hasUpdate = true;
+		}
+		rib.insert(rib.end(), paths, paths + n);
+	}
+	RoutingTable.swap(rib);
+	if(changed)
+		fibBuild();
 }
 
-uint8_t CommonPrefixLength(uint32_t addr1, uint32_t addr2, int len){
-	return (addr1 & masks[len]) == addr2 ? len : 0;
+/**
+ * Longest prefix match with equal-cost multipath
+ * @param hash flow hash, selects one of the equal-cost paths
+ * @return the number of equal-cost paths of the matched prefix, 0 if not found
+ */
+int queryMultipath(uint32_t addr, uint32_t hash, uint32_t *nexthop, uint32_t *if_index) {
+	// only the FIB is touched, longest prefix group first
+	// routes of length 0 never match, as in the original linear scan
+	for(int len = 32; len > 0; len--){
+		uint32_t first = fibBegin[32 - len], last = fibBegin[33 - len];
+		if(first == last)
+			continue;
+		uint32_t key = addr & masks[len];
+		uint32_t pos = fibFind(key, len);
+		if(pos != last && Fib[pos].addr == key){
+			uint32_t n = 1;
+			while(pos + n < last && Fib[pos + n].addr == key)
+				n++;
+			pos += hash % n;
+			*nexthop = Fib[pos].nexthop;
+			*if_index = Fib[pos].if_index;
+			return n;
+		}
+	}
+	return 0;
 }
 
 /**
@@ -110,20 +422,5 @@ uint8_t CommonPrefixLength(uint32_t addr1, uint32_t addr2, int len){
  * @return 查到则返回 true ，没查到则返回 false
  */
 bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index) {
-	uint8_t maxMatch = 0;
-	int matchIndex = -1;
-	int length = RoutingTable.size();
-	for(int i = 0; i < length; i++){
-		int tmpMatch = CommonPrefixLength(addr, RoutingTable[i].addr, RoutingTable[i].len);
-		// ignore entries with metric of 16
-		if(tmpMatch > maxMatch && RoutingTable[i].metric < 16){
-			maxMatch = tmpMatch;
-			matchIndex = i;
-		}
-	}
-	if(maxMatch == 0)
-		return false;
-	*nexthop = RoutingTable[matchIndex].nexthop;
-	*if_index = RoutingTable[matchIndex].if_index;
-	return true;
+	return queryMultipath(addr, 0, nexthop, if_index) > 0;
 }
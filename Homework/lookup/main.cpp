@@ -4,7 +4,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-extern void update(bool insert, RoutingTableEntry entry);
+extern void update(bool insert, const RoutingTableEntry& entry);
 extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
 char buffer[1024];
 
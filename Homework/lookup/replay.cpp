@@ -0,0 +1,166 @@
+#include "router.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Replay a binary trace made by trace_convert and time every operation
+// usage: ./replay [-p] trace
+// -p prints query results like ./lookup, so the output can be compared
+// against data/lookup_output*.out
+
+extern void update(bool insert, const RoutingTableEntry& entry);
+extern bool query(uint32_t addr, uint32_t *nexthop, uint32_t *if_index);
+
+// log2 buckets of cycles per operation
+const int N_BUCKET = 32;
+
+struct OpStats {
+  const char *name;
+  uint64_t count;
+  uint64_t cycles;
+  uint64_t max;
+  uint64_t buckets[N_BUCKET];
+};
+
+uint64_t nowNs() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+static inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return nowNs();
+#endif
+}
+
+void record(OpStats &s, uint64_t cycles) {
+  s.count++;
+  s.cycles += cycles;
+  if (cycles > s.max) {
+    s.max = cycles;
+  }
+  int bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+  s.buckets[bucket < N_BUCKET ? bucket : N_BUCKET - 1]++;
+}
+
+// largest value of the bucket holding the given fraction of operations,
+// never more than the largest value seen
+uint64_t percentile(const OpStats &s, double fraction) {
+  uint64_t target = (uint64_t)(s.count * fraction), seen = 0;
+  for (int i = 0; i < N_BUCKET; i++) {
+    seen += s.buckets[i];
+    if (seen > target) {
+      uint64_t bound = (2ull << i) - 1;
+      return bound < s.max ? bound : s.max;
+    }
+  }
+  return s.max;
+}
+
+int main(int argc, char *argv[]) {
+  bool print = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "p")) != -1) {
+    if (opt == 'p') {
+      print = true;
+    } else {
+      optind = argc;
+      break;
+    }
+  }
+  if (argc - optind != 1) {
+    fprintf(stderr, "usage: %s [-p] trace\n", argv[0]);
+    return 1;
+  }
+  const char *path = argv[optind];
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    return 1;
+  }
+  if ((size_t)st.st_size < sizeof(TraceHeader)) {
+    fprintf(stderr, "%s: not a trace\n", path);
+    return 1;
+  }
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    perror(path);
+    return 1;
+  }
+  const TraceHeader *header = (const TraceHeader *)base;
+  if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION ||
+      header->record_size != sizeof(TraceRecord) ||
+      header->count > (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord)) {
+    fprintf(stderr, "%s: bad trace header\n", path);
+    return 1;
+  }
+  const TraceRecord *records = (const TraceRecord *)(header + 1);
+  madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+  OpStats stats[3];
+  memset(stats, 0, sizeof(stats));
+  stats[0].name = "insert";
+  stats[1].name = "delete";
+  stats[2].name = "query";
+  uint64_t found = 0;
+  uint64_t beginNs = nowNs(), beginCycles = readCycles();
+  for (uint64_t i = 0; i < header->count; i++) {
+    const TraceRecord &r = records[i];
+    uint32_t nexthop, if_index;
+    if (r.op == 'I' || r.op == 'D') {
+      // same entry as ./lookup builds from the .in line
+      RoutingTableEntry entry = {
+          .addr = r.addr, .len = r.len, .if_index = r.if_index, .nexthop = r.nexthop};
+      uint64_t begin = readCycles();
+      update(r.op == 'I', entry);
+      record(stats[r.op == 'I' ? 0 : 1], readCycles() - begin);
+    } else if (r.op == 'Q') {
+      uint64_t begin = readCycles();
+      bool res = query(r.addr, &nexthop, &if_index);
+      record(stats[2], readCycles() - begin);
+      found += res;
+      if (print) {
+        if (res) {
+          printf("0x%08x %d\n", nexthop, if_index);
+        } else {
+          printf("Not Found\n");
+        }
+      }
+    }
+  }
+  uint64_t elapsedNs = nowNs() - beginNs;
+  double cyclesPerNs = elapsedNs ? (double)(readCycles() - beginCycles) / elapsedNs : 1;
+
+  fprintf(stderr, "%s: %llu operations in %.1f ms, %llu of %llu queries found\n", path,
+          (unsigned long long)header->count, elapsedNs / 1e6,
+          (unsigned long long)found, (unsigned long long)stats[2].count);
+  fprintf(stderr, "%-8s %12s %10s %10s %10s %10s %10s\n", "op", "count", "avg ns",
+          "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+  for (int i = 0; i < 3; i++) {
+    const OpStats &s = stats[i];
+    if (!s.count) {
+      continue;
+    }
+    fprintf(stderr, "%-8s %12llu %10.1f %10.0f %10.0f %10.0f %10.0f\n", s.name,
+            (unsigned long long)s.count, s.cycles / cyclesPerNs / s.count,
+            percentile(s, 0.5) / cyclesPerNs, percentile(s, 0.99) / cyclesPerNs,
+            percentile(s, 0.999) / cyclesPerNs, s.max / cyclesPerNs);
+  }
+  munmap(base, st.st_size);
+  return 0;
+}
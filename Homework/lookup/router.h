@@ -1,5 +1,8 @@
+#include "log.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <set>
+#include <utility>
 
 /**
  * Interval for multicast whole table
@@ -21,6 +24,55 @@
  * Time for refresh routing table
  */
 #define REFRESH_SEC 5
+/**
+ * Maximum number of equal-cost paths kept for a prefix
+ */
+#define ECMP_MAX_PATHS 4
+/**
+ * Batches smaller than this are installed by bulk_load() one update() at a time
+ * A merge copies the whole RIB and rebuilds the FIB, on conf-part9 it takes
+ * ~130 us for 32 routes, where update() takes ~7 us to refresh 32 known
+ * prefixes and about as long as the merge to add 32 new ones. A RIP response
+ * (RIP_MAX_ENTRY routes) and the direct routes of a few interfaces stay below
+ * it, only snapshots and large configurations take the merge.
+ */
+#define BULK_LOAD_MIN 32
+/**
+ * Number of slots in the destination cache, as a power of 2
+ */
+#define ROUTE_CACHE_BITS 10
+/**
+ * Lifetime of a destination cache slot, so that ARP changes are picked up
+ */
+#define ROUTE_CACHE_TTL_MS 1000
+/**
+ * Interval for writing the routing table snapshot
+ */
+#define SNAPSHOT_SEC 10
+/**
+ * Snapshot file, loaded on startup for a warm restart
+ */
+#define SNAPSHOT_FILE "router.snapshot"
+/**
+ * Stats file, the HAL counters are mapped here for Example/shell to read
+ */
+#define STATS_FILE "router.stats"
+/**
+ * Unix socket for inspecting the router, see control.cpp
+ */
+#define CONTROL_FILE "router.ctl"
+/**
+ * UDP port of the hellos, that of single hop BFD control packets
+ */
+#define HELLO_PORT 3784
+/**
+ * A neighbor is down after this many of its hello intervals without a hello
+ */
+#define HELLO_DETECT_MULT 3
+/**
+ * Neighbors listed in a hello, and kept per interface
+ */
+#define HELLO_MAX_NEIGHBORS 32
 
 typedef struct {
     uint32_t addr;
@@ -30,21 +82,44 @@ typedef struct {
     uint32_t metric; // little endian, while RipEntry.metric is in  big endian
     uint64_t timestamp; // to get rid of entries that haven't been updated for too long
     uint32_t change_flag; // if the entry has been changed
+    uint32_t stale; // restored from a snapshot, forwarded but not advertised until RIP confirms it
     //uint32_t learnt_from_if; // the if index this entry is learnt from, for split horizon
     void print(){
-        // print IP address
-        printf("%u.%u.%u.%u", addr & 0xff, (addr >> 8) & 0xff, (addr >> 16) & 0xff, addr >> 24);
-        // print mask
-        printf("/%u, ", len);
-        // print interface
-        printf("IF %u, ", if_index);
-        // print nextHop
-        printf("next hop: %u.%u.%u.%u, ", nexthop & 0xff, (nexthop >> 8) & 0xff, (nexthop >> 16) & 0xff, nexthop >> 24);
-        // print metric
-        printf("metric: %u, ", metric);
-        // print timestamp
-        printf("timestamp: %llu, ", timestamp);
-        // print change flag
-        printf("change flag: %u\n", change_flag);
+        // one record per entry, at debug level as a table is thousands of lines
+        LOG(DEBUG, "%u.%u.%u.%u/%u, IF %u, next hop: %u.%u.%u.%u, metric: %u, timestamp: %llu, change flag: %u%s",
+            addr & 0xff, (addr >> 8) & 0xff, (addr >> 16) & 0xff, addr >> 24, len, if_index,
+            nexthop & 0xff, (nexthop >> 8) & 0xff, (nexthop >> 16) & 0xff, nexthop >> 24,
+            metric, (unsigned long long)timestamp, change_flag, stale ? ", stale" : "");
     }
 } RoutingTableEntry;
+
+/**
+ * Forwarding entry, holding only what query() needs
+ * RoutingTableEntry above is the RIB entry with the full RIP state,
+ * every reachable RIB entry has exactly one FibEntry
+ * Equal-cost paths of a prefix are adjacent, in the order of the RIB
+ */
+typedef struct {
+    uint32_t addr; // big endian, only the lowest len bits may be non-zero
+    uint32_t nexthop; // big endian, zero for direct routes
+    uint8_t len;
+    uint8_t reserved;
+    uint16_t if_index;
+    uint32_t padding; // up to 16 bytes, 4 entries in a cache line
+} FibEntry;
+
+static_assert(sizeof(FibEntry) == 16, "FibEntry should fit 4 entries in a cache line");
+
+/**
+ * A neighbor heard through hellos, see hello.cpp
+ */
+typedef struct {
+    uint32_t addr; // big endian
+    uint32_t if_index;
+    uint64_t lastSeen; // when its last hello arrived
+    uint32_t detectMs; // silence after which it is down, from its own hello
+    bool up; // it lists us in its hellos
+    // the prefixes learnt from it, (addr, len), so that its paths are found
+    // without a scan of the routing table; some may be gone from it already
+    std::set<std::pair<uint32_t, uint32_t>> prefixes;
+} HelloNeighbor;
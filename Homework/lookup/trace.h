@@ -0,0 +1,35 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+/**
+ * Binary operation trace for the lookup engine, in host byte order:
+ * a TraceHeader followed by count TraceRecords, nothing else.
+ * Records are fixed size so a trace is mapped and replayed in place.
+ * addr and nexthop are stored exactly as passed to update() and query(),
+ * i.e. big endian addresses as in the .in files.
+ */
+#define TRACE_MAGIC 0x52544b4c // "LKTR"
+#define TRACE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t count;
+} TraceHeader;
+
+typedef struct {
+    uint8_t op; // 'I', 'D' or 'Q', as in the .in files
+    uint8_t len; // prefix length of I and D
+    uint8_t if_index; // interface of I
+    uint8_t reserved;
+    uint32_t addr;
+    uint32_t nexthop; // next hop of I
+} TraceRecord;
+
+static_assert(sizeof(TraceHeader) == 16, "TraceHeader should be packed");
+static_assert(sizeof(TraceRecord) == 12, "TraceRecord should be packed");
+
+#endif
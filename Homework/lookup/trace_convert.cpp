@@ -0,0 +1,145 @@
+#include "router.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+// Convert a lookup .in file or the routes of a BIRD config into a binary trace
+// usage: ./trace_convert [-q queries] [-s seed] input output
+// -q appends random queries, half of them inside the inserted prefixes
+
+extern uint32_t masks[33];
+
+// 'I,0x00030201,24,9,0x0203a8c0', 'D,0x00030201,24' or 'Q,0x04030201'
+bool parseIn(const char *line, TraceRecord &r) {
+  char op;
+  unsigned addr, len = 0, if_index = 0, nexthop = 0;
+  if (sscanf(line, "%c,%x", &op, &addr) != 2) {
+    return false;
+  }
+  if (op == 'I') {
+    if (sscanf(line, "%c,%x,%u,%u,%x", &op, &addr, &len, &if_index, &nexthop) != 5) {
+      return false;
+    }
+  } else if (op == 'D') {
+    if (sscanf(line, "%c,%x,%u", &op, &addr, &len) != 3) {
+      return false;
+    }
+  } else if (op != 'Q') {
+    return false;
+  }
+  if (len > 32 || if_index > 0xff) {
+    return false;
+  }
+  r.op = op;
+  r.len = len;
+  r.if_index = if_index;
+  r.reserved = 0;
+  r.addr = addr;
+  r.nexthop = nexthop;
+  return true;
+}
+
+// 'route a.b.c.d/len via a.b.c.d;' or 'route a.b.c.d/len via "iface";'
+bool parseConf(const char *line, TraceRecord &r) {
+  unsigned a, b, c, d, len;
+  unsigned n1, n2, n3, n4;
+  if (sscanf(line, " route %u.%u.%u.%u/%u", &a, &b, &c, &d, &len) != 5 || len > 32) {
+    return false;
+  }
+  r.op = 'I';
+  r.len = len;
+  r.if_index = 0;
+  r.reserved = 0;
+  r.addr = (a | (b << 8) | (c << 16) | (d << 24)) & masks[len];
+  const char *via = strstr(line, "via ");
+  if (via && sscanf(via, "via %u.%u.%u.%u", &n1, &n2, &n3, &n4) == 4) {
+    r.nexthop = n1 | (n2 << 8) | (n3 << 16) | (n4 << 24);
+  } else {
+    // via an interface, pick a fixed gateway
+    r.nexthop = 0x0100000a;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t queries = 0;
+  unsigned seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "q:s:")) != -1) {
+    if (opt == 'q') {
+      queries = strtoull(optarg, NULL, 10);
+    } else if (opt == 's') {
+      seed = atoi(optarg);
+    } else {
+      optind = argc;
+      break;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr, "usage: %s [-q queries] [-s seed] input output\n", argv[0]);
+    return 1;
+  }
+  const char *input = argv[optind], *output = argv[optind + 1];
+  FILE *in = fopen(input, "r");
+  if (!in) {
+    perror(input);
+    return 1;
+  }
+  std::vector<TraceRecord> records;
+  std::vector<size_t> inserts;
+  char line[256];
+  size_t lineno = 0, skipped = 0;
+  while (fgets(line, sizeof(line), in)) {
+    lineno++;
+    TraceRecord r;
+    if (parseIn(line, r) || parseConf(line, r)) {
+      if (r.op == 'I') {
+        inserts.push_back(records.size());
+      }
+      records.push_back(r);
+    } else if (line[0] == 'I' || line[0] == 'D' || line[0] == 'Q') {
+      fprintf(stderr, "%s:%zu: bad operation\n", input, lineno);
+      skipped++;
+    }
+  }
+  fclose(in);
+
+  srand(seed);
+  for (uint64_t i = 0; i < queries; i++) {
+    TraceRecord q;
+    memset(&q, 0, sizeof(q));
+    q.op = 'Q';
+    q.addr = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    if ((i & 1) == 0 && !inserts.empty()) {
+      const TraceRecord &e = records[inserts[rand() % inserts.size()]];
+      q.addr = e.addr | (q.addr & ~masks[e.len]);
+    }
+    records.push_back(q);
+  }
+
+  FILE *out = fopen(output, "wb");
+  if (!out) {
+    perror(output);
+    return 1;
+  }
+  TraceHeader header;
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.record_size = sizeof(TraceRecord);
+  header.count = records.size();
+  bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+  if (ok && !records.empty()) {
+    ok = fwrite(records.data(), sizeof(TraceRecord), records.size(), out) == records.size();
+  }
+  if (fclose(out) != 0 || !ok) {
+    perror(output);
+    return 1;
+  }
+  fprintf(stderr, "%s: %zu operations (%zu inserts, %llu queries added), %zu skipped\n",
+          output, records.size(), inserts.size(), (unsigned long long)queries, skipped);
+  return 0;
+}
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+# Traffic for fwbench.sh: raw UDP frames are sent on one interface and counted
+# on another, so the forwarding rate of the router in between is measured
+# without the kernel stack of either end.
+#
+# With a RATE, the packets are sent one by one at that pace, each stamped with
+# the time it leaves PC1, and recv also reports the latency through the
+# router, taken against the kernel receive time so that Python is left out.
+#
+#   fwbench.py send IFACE DST_MAC SRC_IP DST_IP SECONDS [SIZE] [RATE]
+#   fwbench.py recv IFACE SECONDS
+
+import socket
+import struct
+import sys
+import time
+
+ETH_P_IP = 0x0800
+PORT = 9
+# where the send time goes in a frame, after the UDP header
+STAMP = 42
+SO_TIMESTAMPNS = getattr(socket, 'SO_TIMESTAMPNS', 35)
+
+
+def checksum(header):
+    s = sum(struct.unpack('!%dH' % (len(header) // 2), header))
+    while s > 0xffff:
+        s = (s & 0xffff) + (s >> 16)
+    return ~s & 0xffff
+
+
+def frame(src_mac, dst_mac, src_ip, dst_ip, size, sport):
+    # size is that of the IP packet, UDP checksum 0 means none
+    payload = bytes(size - 28)
+    udp = struct.pack('!HHHH', sport, PORT, size - 20, 0)
+    ip = struct.pack('!BBHHHBBH4s4s', 0x45, 0, size, 0, 0x4000, 64, 17, 0,
+                     socket.inet_aton(src_ip), socket.inet_aton(dst_ip))
+    ip = ip[:10] + struct.pack('!H', checksum(ip)) + ip[12:]
+    return dst_mac + src_mac + struct.pack('!H', ETH_P_IP) + ip + udp + payload
+
+
+def mac(iface):
+    with open('/sys/class/net/%s/address' % iface) as f:
+        return bytes.fromhex(f.read().strip().replace(':', ''))
+
+
+def send(iface, dst_mac, src_ip, dst_ip, seconds, size=64, rate=0):
+    s = socket.socket(socket.AF_PACKET, socket.SOCK_RAW)
+    s.bind((iface, 0))
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 1 << 22)
+    dst = bytes.fromhex(dst_mac.replace(':', ''))
+    # a few flows, so that per flow paths are exercised too
+    frames = [bytearray(frame(mac(iface), dst, src_ip, dst_ip, size, 10000 + i))
+              for i in range(16)]
+    sent = 0
+    begin = time.time()
+    end = begin + seconds
+    while rate:
+        # the packets due by now, then a sleep until the next one
+        now = time.time()
+        if now >= end:
+            break
+        while sent < (now - begin) * rate:
+            f = frames[sent % len(frames)]
+            f[STAMP:STAMP + 8] = struct.pack('!Q', time.time_ns())
+            try:
+                s.send(f)
+            except BlockingIOError:
+                pass
+            sent += 1
+        time.sleep(max(0, begin + sent / rate - time.time()))
+    while time.time() < end:
+        for f in frames * 4:
+            try:
+                s.send(f)
+                sent += 1
+            except BlockingIOError:
+                pass
+    print('sent %d packets, %.0f pps' % (sent, sent / seconds))
+
+
+def recv(iface, seconds):
+    s = socket.socket(socket.AF_PACKET, socket.SOCK_RAW,
+                      socket.htons(ETH_P_IP))
+    s.bind((iface, 0))
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 24)
+    s.setsockopt(socket.SOL_SOCKET, SO_TIMESTAMPNS, 1)
+    s.settimeout(0.1)
+    buffer = bytearray(2048)
+    received = 0
+    first = last = None
+    latency = []
+    end = time.time() + seconds
+    while time.time() < end:
+        try:
+            n, ancillary, _, _ = s.recvmsg_into([buffer], 64)
+        except socket.timeout:
+            continue
+        # ours: UDP to PORT, forwarded with TTL 63
+        if n >= 42 and buffer[23] == 17 and buffer[36:38] == b'\x00\x09' \
+                and buffer[22] == 63:
+            received += 1
+            last = time.time()
+            if first is None:
+                first = last
+            stamp = struct.unpack('!Q', buffer[STAMP:STAMP + 8])[0] \
+                if n >= STAMP + 8 else 0
+            for level, kind, data in ancillary:
+                if stamp and level == socket.SOL_SOCKET and kind == SO_TIMESTAMPNS:
+                    sec, nsec = struct.unpack('qq', data[:16])
+                    latency.append(sec * 1000000000 + nsec - stamp)
+    rate = received / (last - first) if received > 1 and last > first else 0
+    print('received %d packets, %.0f pps' % (received, rate))
+    if latency:
+        latency.sort()
+        print('latency p50 %.1f us, p99 %.1f us, avg %.1f us' % (
+            latency[len(latency) // 2] / 1000,
+            latency[len(latency) * 99 // 100] / 1000,
+            sum(latency) / len(latency) / 1000))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) >= 7 and sys.argv[1] == 'send':
+        send(sys.argv[2], sys.argv[3], sys.argv[4], sys.argv[5],
+             float(sys.argv[6]), int(sys.argv[7]) if len(sys.argv) > 7 else 64,
+             int(sys.argv[8]) if len(sys.argv) > 8 else 0)
+    elif len(sys.argv) == 4 and sys.argv[1] == 'recv':
+        recv(sys.argv[2], float(sys.argv[3]))
+    else:
+        print('usage: fwbench.py send IFACE DST_MAC SRC_IP DST_IP SECONDS [SIZE] [RATE]\n'
+              '       fwbench.py recv IFACE SECONDS')
+        sys.exit(1)
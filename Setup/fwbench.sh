@@ -0,0 +1,74 @@
+#!/bin/bash
+# Forwarding benchmark: PC1 -- R -- PC2 in three netns joined by veth pairs.
+# The router under test runs in R on eth1 (192.168.4.2) and eth2
+# (192.168.5.2), the addresses of Homework/boilerplate/main.cpp. PC1 floods
+# UDP to PC2, the rate seen by PC2 is what the router forwards.
+#
+#   [RATE=pps] fwbench.sh ROUTER [SECONDS] [SIZE] [-- ROUTER OPTIONS]
+#
+# With RATE, PC1 sends at most that many packets per second, so that
+# backends can be compared at an equal load by the CPU time the router
+# spends per forwarded packet, and the latency through the router is
+# reported too. Setup/rxbench.sh runs it for each receive policy.
+#
+# e.g. compare the backends with
+#   make -C Homework/boilerplate clean all && Setup/fwbench.sh Homework/boilerplate/boilerplate
+#   make -C Homework/boilerplate clean all BACKEND=AFXDP && Setup/fwbench.sh Homework/boilerplate/boilerplate
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 ROUTER [SECONDS] [SIZE] [-- ROUTER OPTIONS]"
+  exit 1
+fi
+router=$(realpath "$1")
+shift
+seconds=10
+size=64
+if [ $# -gt 0 ] && [ "$1" != "--" ]; then seconds=$1; shift; fi
+if [ $# -gt 0 ] && [ "$1" != "--" ]; then size=$1; shift; fi
+if [ "$1" == "--" ]; then shift; fi
+dir=$( cd "$(dirname "${BASH_SOURCE[0]}")" ; pwd -P )
+
+cleanup() {
+  [ -n "$pid" ] && kill $pid 2>/dev/null && wait $pid 2>/dev/null
+  for ns in fwPC1 fwR fwPC2; do ip netns delete $ns 2>/dev/null; done
+}
+trap cleanup EXIT
+cleanup
+
+for ns in fwPC1 fwR fwPC2; do ip netns add $ns; ip -n $ns l set lo up; done
+ip l add pc1 netns fwPC1 type veth peer name eth1 netns fwR
+ip l add pc2 netns fwPC2 type veth peer name eth2 netns fwR
+ip -n fwPC1 a add 192.168.4.1/24 dev pc1
+ip -n fwPC2 a add 192.168.5.1/24 dev pc2
+for l in "fwPC1 pc1" "fwR eth1" "fwR eth2" "fwPC2 pc2"; do
+  ip -n ${l% *} l set ${l#* } up
+done
+# the router must see all of the traffic, not the kernel of R
+ip netns exec fwR sysctl -qw net.ipv4.ip_forward=0
+
+(cd "$(dirname "$router")" && exec ip netns exec fwR "$router" "$@" >/dev/null 2>&1) &
+pid=$!
+# HAL_Init, and the first ARP exchange for PC2
+sleep 2
+mac=$(ip netns exec fwR cat /sys/class/net/eth1/address)
+
+# user and system time of the router, in clock ticks
+cpu() { awk '{print $14 + $15}' /proc/$pid/stat; }
+
+ip netns exec fwPC2 python3 "$dir/fwbench.py" recv pc2 $((seconds + 2)) > /tmp/fwbench.$$ &
+recv=$!
+sleep 0.5
+begin=$(cpu)
+begin_time=$(date +%s%N)
+ip netns exec fwPC1 python3 "$dir/fwbench.py" send pc1 $mac 192.168.4.1 192.168.5.1 $seconds $size ${RATE:-0}
+wait $recv
+end=$(cpu)
+end_time=$(date +%s%N)
+cat /tmp/fwbench.$$
+received=$(awk 'NR == 1 {print $2}' /tmp/fwbench.$$)
+rm -f /tmp/fwbench.$$
+ticks=$(getconf CLK_TCK)
+echo "router CPU: $(( (end - begin) * 100000000000 / ticks / (end_time - begin_time) ))% of a core"
+if [ "${received:-0}" -gt 0 ]; then
+  echo "router CPU: $(( (end - begin) * 1000000000 / ticks / received )) ns per packet"
+fi
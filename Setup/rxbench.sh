@@ -0,0 +1,30 @@
+#!/bin/bash
+# Receive policy benchmark: fwbench.sh at a few offered loads for each
+# HAL_SetReceivePolicy policy, to weigh the wakeup latency of the router
+# against the CPU it burns.
+#
+#   [RATES="1000 10000 50000"] [POLICIES="block adaptive busy"] rxbench.sh ROUTER [SECONDS]
+#
+# e.g. make -C Homework/boilerplate clean all BACKEND=PACKET && Setup/rxbench.sh Homework/boilerplate/boilerplate
+# Busy polling needs a core of its own to pay off, on a machine with few
+# cores the router and the traffic generator compete for it.
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 ROUTER [SECONDS]"
+  exit 1
+fi
+dir=$( cd "$(dirname "${BASH_SOURCE[0]}")" ; pwd -P )
+seconds=${2:-5}
+
+printf "%-12s %8s %10s %10s %10s %10s %6s\n" policy rate received p50_us p99_us avg_us cpu%
+for policy in ${POLICIES:-block adaptive busy}; do
+  for rate in ${RATES:-1000 10000 50000}; do
+    out=$(RATE=$rate "$dir/fwbench.sh" "$1" $seconds 64 -- -p $policy)
+    printf "%-12s %8s %10s %10s %10s %10s %6s\n" $policy $rate \
+      "$(echo "$out" | awk '/^received/ {print $2}')" \
+      "$(echo "$out" | awk '/^latency/ {print $3}')" \
+      "$(echo "$out" | awk '/^latency/ {print $6}')" \
+      "$(echo "$out" | awk '/^latency/ {print $9}')" \
+      "$(echo "$out" | awk '/% of a core/ {print $3}')"
+  done
+done